@@ -0,0 +1,136 @@
+#!/bin/sh
+# Runs the benchmarks on clox, clox --jit, the C program clox --emit-c
+# writes for each benchmark, and jlox. Each program prints its result
+# followed by the seconds it spent, measured with clock(). Everything but
+# that last line must match what clox prints, otherwise the benchmark is
+# reported as a mismatch and the script fails. The disassembly a clox
+# built with DEBUG_PRINT_CODE prints is not compared, but for meaningful
+# times build it with -O2 and the DEBUG_ switches off. Two cases no
+# benchmark covers are checked after them: NaN comparisons under --jit,
+# and functions with code after `return` under --regvm.
+#
+# usage: bench/calls.sh [path-to-clox]
+# The C programs are built with $CC (cc by default) against the sources in
+# clox/, and jlox is compiled from lox/ with javac. Either is skipped when
+# its compiler is missing. For repeated runs, memory and instruction
+# counts, and results to compare between commits, use bench/run.py.
+
+root=$(cd "$(dirname "$0")/.." && pwd)
+clox=${1:-$root/clox/clox}
+cc=${CC:-cc}
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+jlox=""
+if command -v javac >/dev/null 2>&1; then
+	javac -d "$work" "$root"/lox/com/craftinginterpreters/lox/*.java &&
+		jlox="java -cp $work com.craftinginterpreters.lox.Lox"
+fi
+
+runtime=""
+if command -v "$cc" >/dev/null 2>&1; then
+	runtime=$(ls "$root"/clox/*.c | grep -v '/main\.c$')
+fi
+
+# drops the disassembly a clox built with DEBUG_PRINT_CODE prints before
+# running, which the --emit-c programs never print.
+results() {
+	echo "$1" | grep -v -e '^== .* ==$' -e '^[0-9][0-9][0-9][0-9] '
+}
+
+# prints the time on the last line of a run, or "mismatch" and flags the
+# failure if the rest of its output differs from what clox printed.
+time_of() {
+	if [ "$(results "$1" | sed '$d')" != "$clox_results" ]; then
+		echo "mismatch"
+		return 1
+	fi
+	echo "$1" | tail -n 1
+}
+
+status=0
+printf "%-16s %12s %12s %12s %12s\n" \
+	"benchmark" "clox" "clox --jit" "--emit-c" "jlox"
+for file in "$root"/bench/*.lox; do
+	bench=$(basename "$file" .lox)
+	clox_out=$("$clox" "$file")
+	clox_results=$(results "$clox_out" | sed '$d')
+	clox_time=$(echo "$clox_out" | tail -n 1)
+	jit_time=$(time_of "$("$clox" --jit "$file")") || status=1
+
+	aot_time="-"
+	if [ -n "$runtime" ] &&
+		"$clox" --emit-c "$file" -o "$work/$bench.c" >/dev/null &&
+		"$cc" -O2 -I"$root/clox" -o "$work/$bench" "$work/$bench.c" \
+			$runtime -lm; then
+		aot_time=$(time_of "$("$work/$bench")") || status=1
+	fi
+
+	jlox_time="-"
+	if [ -n "$jlox" ]; then
+		jlox_time=$($jlox "$file" | tail -n 1)
+	fi
+	printf "%-16s %12s %12s %12s %12s\n" \
+		"$bench" "$clox_time" "$jit_time" "$aot_time" "$jlox_time"
+done
+
+# no benchmark compares NaN. `>=` and `<=` mean `!(a < b)` and `!(a > b)`,
+# so they hold for NaN, and must keep doing so once the JIT has compiled
+# the loop.
+cat > "$work/nan.lox" <<'LOX'
+var n = 0 / 0;
+{
+  var ge = 0;
+  var le = 0;
+  var gt = 0;
+  var lt = 0;
+  for (var i = 0; i < 3000; i = i + 1) {
+    if (n >= 1) ge = ge + 1;
+    if (1 <= n) le = le + 1;
+    if (n > 1) gt = gt + 1;
+    if (!(n < 1)) lt = lt + 1;
+  }
+  print ge;
+  print le;
+  print gt;
+  print lt;
+}
+LOX
+nan_status="ok"
+if [ "$(results "$("$clox" --jit "$work/nan.lox")")" != \
+	"$(results "$("$clox" "$work/nan.lox")")" ]; then
+	nan_status="mismatch"
+	status=1
+fi
+echo "NaN comparisons under --jit: $nan_status"
+
+# code after `return` is never run and the translator leaves it out, so
+# the functions below must run on the register VM without a note.
+cat > "$work/dead.lox" <<'LOX'
+fun early(a) {
+  var b = a + 1;
+  return b;
+  var c = b * 2;
+  var d = c + b;
+  print c + d;
+}
+fun branches(n) {
+  if (n > 0) {
+    return n;
+    print "never";
+  }
+  return -n;
+}
+var sum = 0;
+for (var i = 0; i < 10; i = i + 1) sum = sum + early(i) + branches(i - 5);
+print sum;
+LOX
+dead_status="ok"
+if [ "$(results "$("$clox" --regvm "$work/dead.lox" 2>&1)")" != \
+	"$(results "$("$clox" "$work/dead.lox")")" ]; then
+	dead_status="mismatch"
+	status=1
+fi
+echo "Code after return under --regvm: $dead_status"
+exit $status
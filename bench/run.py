@@ -0,0 +1,364 @@
+#!/usr/bin/env python3
+# Runs each benchmark on clox and jlox several times and records, per
+# benchmark and interpreter:
+#   wall     seconds from starting the process to its exit, so start-up
+#            (and the JVM's warm-up) is included: min, median and max.
+#   clock    seconds the program measured itself with clock(), which it
+#            prints on its last line: the median.
+#   rss_kb   peak resident set size of the process, in one extra run.
+#   instructions
+#            user-space instructions retired in one extra run under
+#            `perf stat`, or null when perf is missing or not permitted.
+#   output   a digest of everything the program printed but the time, so
+#            a change in behaviour shows up when results are compared.
+#   status   "ok", "error" if a run exited with a failure, or "mismatch"
+#            if the output differs from what clox printed.
+#
+# The results are written as JSON lines, sorted keys and one line per
+# benchmark and interpreter after a line describing the run, so two files
+# diff cleanly and --compare can line them up:
+#
+# usage: bench/run.py [-n runs] [--clox path] [--impl name]... [-o file]
+#                     [benchmark...]
+#        bench/run.py --compare old.jsonl new.jsonl
+#
+# Benchmarks are the bench/*.lox files, all of them unless some are named.
+# The interpreters are clox and jlox unless --impl picks others from:
+#   clox         clox as common.h configures it.
+#   clox-jit     the same binary run with --jit.
+#   clox-regvm   the same binary run with --regvm. Functions the register
+#                VM cannot translate run on the stack VM, which clox notes
+#                on stderr.
+#   clox-switch  clox built with -DNO_THREADED_DISPATCH, so `run()`
+#                dispatches through a switch.
+#   clox-tagged  clox built with -DNO_NAN_BOXING, for the tagged union.
+#   jlox         compiled from lox/ with javac, and skipped when javac is
+#                missing. Benchmarks using features jlox does not have yet
+#                are recorded as errors.
+# Each run of a benchmark takes every interpreter in turn, so a change in
+# the machine's load is shared between them. The exit status is 1 if a
+# clox failed or any interpreter's output did not match.
+#
+# clox and its variants are built from clox/ with $CC (cc by default) and
+# $CFLAGS (-O2 by default) plus -DNDEBUG, which leaves out the
+# disassembly DEBUG_PRINT_CODE prints. The compiler and flags are
+# recorded in the first line of the results. --clox runs a binary built
+# elsewhere instead of the plain clox; it should be optimized and have
+# the DEBUG_ switches in common.h off, or the numbers measure the
+# debugging aids. Any disassembly it prints is left out of the output
+# that is compared and digested, so such a build still matches jlox and
+# keeps its digests when only the bytecode changes.
+
+import argparse
+import hashlib
+import json
+import os
+import re
+import resource
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+CC = os.environ.get("CC", "cc")
+CFLAGS = os.environ.get("CFLAGS", "-O2").split()
+IMPLS = ["clox", "clox-jit", "clox-regvm", "clox-switch", "clox-tagged", "jlox"]
+# the variants of clox built with their own flags.
+BUILDS = {"clox-switch": ["-DNO_THREADED_DISPATCH"],
+		  "clox-tagged": ["-DNO_NAN_BOXING"]}
+# the headers and instructions a build with DEBUG_PRINT_CODE prints to
+# stdout as it compiles each function.
+DISASSEMBLY = re.compile(r"== .* ==$|\d{4} ")
+
+
+def run_once(command):
+	"""Runs a command, returning its exit code, stdout and wall time."""
+	start = time.perf_counter()
+	result = subprocess.run(command, stdout=subprocess.PIPE,
+							stderr=subprocess.DEVNULL)
+	wall = time.perf_counter() - start
+	return result.returncode, result.stdout.decode(errors="replace"), wall
+
+
+def peak_rss(command):
+	"""Runs a command, returning its peak resident set size in kilobytes.
+	A child inherits the peak of the process that started it, so the usage
+	wait4 reports never reads below this script's own. Below that the
+	peak is taken from VmHWM in /proc, watched until the child exits,
+	which misses only what it allocates in its last moments."""
+	floor = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+	process = subprocess.Popen(command, stdout=subprocess.DEVNULL,
+							   stderr=subprocess.DEVNULL)
+	watched = 0
+	while True:
+		pid, status, usage = os.wait4(process.pid, os.WNOHANG)
+		if pid != 0:
+			break
+		try:
+			with open("/proc/%d/status" % process.pid) as file:
+				for line in file:
+					if line.startswith("VmHWM:"):
+						watched = max(watched, int(line.split()[1]))
+		except (OSError, ValueError):
+			pass
+		time.sleep(0.001)
+	process.returncode = os.waitstatus_to_exitcode(status)
+	if usage.ru_maxrss > floor or watched == 0:
+		return usage.ru_maxrss
+	return watched
+
+
+def count_instructions(command, work):
+	"""Runs a command under perf stat, returning the user-space
+	instructions it retired, or None if they could not be counted."""
+	if shutil.which("perf") is None:
+		return None
+	path = os.path.join(work, "perf.csv")
+	result = subprocess.run(["perf", "stat", "-x", ",", "-e", "instructions:u",
+							 "-o", path, "--"] + command,
+							stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+	if result.returncode != 0 or not os.path.exists(path):
+		return None
+	with open(path) as file:
+		for line in file:
+			fields = line.split(",")
+			if len(fields) > 2 and fields[2].startswith("instructions"):
+				return int(fields[0]) if fields[0].isdigit() else None
+	return None
+
+
+def split_output(output):
+	"""Splits what a benchmark printed into its results and the time on
+	its last line, leaving out any disassembly clox printed first."""
+	lines = [line for line in output.rstrip("\n").split("\n")
+			 if not DISASSEMBLY.match(line)]
+	try:
+		return "\n".join(lines[:-1]), float(lines[-1])
+	except ValueError:
+		return output, None
+
+
+def build(work, name, flags):
+	"""Compiles clox from the sources in clox/, returning the path of the
+	binary."""
+	sources = os.path.join(ROOT, "clox")
+	files = sorted(os.path.join(sources, file)
+				   for file in os.listdir(sources) if file.endswith(".c"))
+	path = os.path.join(work, name)
+	subprocess.run([CC] + CFLAGS + ["-DNDEBUG"] + flags + ["-o", path] +
+				   files + ["-lm"], check=True)
+	return path
+
+
+def commands(args, work):
+	"""Returns the command line, without the script, of each interpreter
+	to run, and whether any of them had to be built."""
+	if args.clox is not None and not os.access(args.clox, os.X_OK):
+		sys.exit("clox not found at " + args.clox)
+	# clox first, as the others are checked against its output.
+	wanted = args.impl or ["clox", "jlox"]
+	clox = args.clox
+	built = False
+	found = {}
+	for impl in [impl for impl in IMPLS if impl in wanted]:
+		if impl in BUILDS:
+			found[impl] = [build(work, impl, BUILDS[impl])]
+			built = True
+			continue
+		if impl.startswith("clox") and clox is None:
+			clox = build(work, "clox", [])
+			built = True
+		if impl == "clox":
+			found[impl] = [clox]
+		elif impl == "clox-jit":
+			found[impl] = [clox, "--jit"]
+		elif impl == "clox-regvm":
+			found[impl] = [clox, "--regvm"]
+		elif shutil.which("javac") is None or shutil.which("java") is None:
+			print("jlox skipped: javac or java not found", file=sys.stderr)
+		else:
+			sources = os.path.join(ROOT, "lox", "com", "craftinginterpreters",
+								   "lox")
+			java = sorted(os.path.join(sources, name)
+						  for name in os.listdir(sources) if name.endswith(".java"))
+			subprocess.run(["javac", "-d", work] + java, check=True)
+			found[impl] = ["java", "-cp", work,
+						   "com.craftinginterpreters.lox.Lox"]
+	return found, built
+
+
+def benchmarks(names):
+	"""Returns the name and path of each benchmark to run."""
+	directory = os.path.join(ROOT, "bench")
+	available = sorted(name[:-len(".lox")] for name in os.listdir(directory)
+					   if name.endswith(".lox"))
+	for name in names:
+		if name not in available:
+			sys.exit("unknown benchmark: " + name)
+	return [(name, os.path.join(directory, name + ".lox"))
+			for name in (names or available)]
+
+
+def measure(name, path, found, runs, work):
+	"""Runs one benchmark on every interpreter, taking turns, and returns
+	the record of each."""
+	samples = {impl: {"walls": [], "clocks": [], "status": "ok",
+					  "results": ""} for impl in found}
+	for _ in range(runs):
+		for impl, command in found.items():
+			sample = samples[impl]
+			if sample["status"] == "error":
+				continue
+			code, output, wall = run_once(command + [path])
+			sample["results"], clock = split_output(output)
+			if code != 0:
+				sample["status"] = "error"
+				continue
+			sample["walls"].append(wall)
+			if clock is not None:
+				sample["clocks"].append(clock)
+
+	# clox's output is what the others must print.
+	expected = None
+	if "clox" in samples and samples["clox"]["status"] == "ok":
+		expected = samples["clox"]["results"]
+
+	records = []
+	for impl, command in found.items():
+		sample = samples[impl]
+		walls, clocks, status = sample["walls"], sample["clocks"], \
+			sample["status"]
+		if status == "ok" and expected is not None and \
+				sample["results"] != expected:
+			status = "mismatch"
+
+		record = {"benchmark": name, "impl": impl, "status": status,
+				  "runs": len(walls), "rss_kb": None,
+				  "output": None,
+				  "wall_min": None, "wall_median": None, "wall_max": None,
+				  "clock": None, "instructions": None}
+		if walls:
+			record["wall_min"] = round(min(walls), 4)
+			record["wall_median"] = round(statistics.median(walls), 4)
+			record["wall_max"] = round(max(walls), 4)
+		if clocks:
+			record["clock"] = round(statistics.median(clocks), 4)
+		if status != "error":
+			results = sample["results"].encode()
+			record["output"] = hashlib.sha1(results).hexdigest()[:12]
+			record["rss_kb"] = peak_rss(command + [path])
+			record["instructions"] = count_instructions(command + [path],
+														work)
+		records.append(record)
+	return records
+
+
+def describe():
+	"""Returns the line describing the run: the commit and the host."""
+	try:
+		commit = subprocess.run(["git", "-C", ROOT, "describe", "--always",
+								 "--dirty"], capture_output=True, text=True,
+								check=True).stdout.strip()
+	except (OSError, subprocess.CalledProcessError):
+		commit = None
+	return {"commit": commit, "host": os.uname().nodename,
+			"perf": shutil.which("perf") is not None}
+
+
+def run(args):
+	output = open(args.output, "w") if args.output else sys.stdout
+	with tempfile.TemporaryDirectory() as work:
+		names = benchmarks(args.benchmarks)
+		found, built = commands(args, work)
+		meta = describe()
+		meta["runs"] = args.runs
+		if built:
+			meta["cc"] = " ".join([CC] + CFLAGS)
+		print(json.dumps(meta, sort_keys=True), file=output, flush=True)
+
+		print("%-12s %-12s %-8s %10s %10s %10s %14s" %
+			  ("benchmark", "impl", "status", "wall", "clock", "rss_kb",
+			   "instructions"), file=sys.stderr)
+		failed = False
+		for name, path in names:
+			for record in measure(name, path, found, args.runs, work):
+				impl = record["impl"]
+				# jlox is allowed to lack features clox has.
+				failed = failed or record["status"] == "mismatch" or \
+					(record["status"] == "error" and impl != "jlox")
+				print(json.dumps(record, sort_keys=True), file=output,
+					  flush=True)
+				print("%-12s %-12s %-8s %10s %10s %10s %14s" %
+					  (name, impl, record["status"], record["wall_median"],
+					   record["clock"], record["rss_kb"],
+					   record["instructions"]), file=sys.stderr)
+	if output is not sys.stdout:
+		output.close()
+	return 1 if failed else 0
+
+
+def load(path):
+	"""Reads a results file into its records, keyed by benchmark and
+	interpreter."""
+	with open(path) as file:
+		lines = [json.loads(line) for line in file if line.strip()]
+	return {(line["benchmark"], line["impl"]): line
+			for line in lines if "benchmark" in line}
+
+
+def ratio(old, new, key):
+	"""Formats the change in one field as new / old."""
+	if old.get(key) in (None, 0) or new.get(key) is None:
+		return "-"
+	return "%.3f" % (new[key] / old[key])
+
+
+def compare(old_path, new_path):
+	old, new = load(old_path), load(new_path)
+	print("%-12s %-12s %10s %10s %10s %14s  %s" %
+		  ("benchmark", "impl", "wall", "clock", "rss_kb", "instructions",
+		   "note"))
+	for key in sorted(old.keys() | new.keys()):
+		if key not in old or key not in new:
+			print("%-12s %-12s %10s %10s %10s %14s  only in %s" %
+				  (key + ("-",) * 4 + (old_path if key in old else new_path,)))
+			continue
+		before, after = old[key], new[key]
+		notes = []
+		if before["status"] != after["status"]:
+			notes.append("%s -> %s" % (before["status"], after["status"]))
+		elif before["output"] != after["output"]:
+			notes.append("output changed")
+		print("%-12s %-12s %10s %10s %10s %14s  %s" %
+			  (key[0], key[1], ratio(before, after, "wall_median"),
+			   ratio(before, after, "clock"), ratio(before, after, "rss_kb"),
+			   ratio(before, after, "instructions"), ", ".join(notes)))
+	return 0
+
+
+def main():
+	parser = argparse.ArgumentParser(
+		description="Runs the Lox benchmarks and records their cost.")
+	parser.add_argument("benchmarks", nargs="*", metavar="benchmark")
+	parser.add_argument("-n", "--runs", type=int, default=5,
+						help="runs of each benchmark (default 5)")
+	parser.add_argument("--clox",
+						help="path to clox (default: build it from clox/)")
+	parser.add_argument("--impl", action="append", choices=IMPLS,
+						help="interpreter to run, may be repeated")
+	parser.add_argument("-o", "--output", help="write the results here")
+	parser.add_argument("--compare", nargs=2, metavar=("OLD", "NEW"),
+						help="print new / old for two results files")
+	args = parser.parse_args()
+	if args.compare:
+		return compare(*args.compare)
+	if args.runs < 1:
+		parser.error("--runs must be at least 1")
+	return run(args)
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,419 @@
+#include <stdlib.h>
+
+#include "aot.h"
+#include "bytecode.h"
+#include "object.h"
+
+/**
+ * `--emit-c` turns a compiled chunk into a C program. Every chunk, the
+ * script and each function, becomes a C function with a label per basic
+ * block and a statement per instruction, working on the same `Value`
+ * stack as the interpreter. The program also carries the chunk serialized
+ * as by `--compile`, for its constants and for the interpreter, which
+ * runs the instructions the C leaves to it: calls and returns, closures,
+ * classes and properties, and any operation whose operands need the slow
+ * path, such as adding two strings. The interpreter enters the C again
+ * wherever it calls into a chunk, returns into one or jumps back to one
+ * of its loops, so those are the offsets each C function can start at.
+*/
+
+/**
+ * readShort - decodes a 16-bit operand.
+ * @code: pointer to the operand.
+ * Return: the operand.
+*/
+static int readShort(uint8_t* code)
+{
+	return (code[0] << 8) | code[1];
+}
+
+/**
+ * findEntries - marks the offsets the interpreter can enter a chunk's C
+ * at: its start, the start of each loop and the instruction after each
+ * call.
+ * @chunk: the chunk.
+ * Return: a flag per offset, which the caller frees.
+*/
+static bool* findEntries(Chunk* chunk)
+{
+	bool* entries = calloc(chunk->count, sizeof(bool));
+	if (entries == NULL)
+	{
+		fprintf(stderr, "Error: Not enough memory to emit C.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	entries[0] = true;
+	for (int offset = 0; offset < chunk->count;
+		 offset += instructionLength(chunk, offset))
+	{
+		int next = offset + instructionLength(chunk, offset);
+		switch (chunk->code[offset])
+		{
+			case OP_LOOP:
+				entries[next - readShort(chunk->code + offset + 1)] = true;
+				break;
+			case OP_CALL:
+			case OP_INVOKE:
+			case OP_SUPER_INVOKE:
+			case OP_TAIL_CALL:
+			case OP_TAIL_INVOKE:
+				if (next < chunk->count) entries[next] = true;
+				break;
+		}
+	}
+	return entries;
+}
+
+/**
+ * emitBinary - writes an arithmetic or comparison instruction.
+ * @file: the output file.
+ * @valueType: macro making the result a `Value`.
+ * @operator: the C operator.
+ * @offset: offset of the instruction.
+*/
+static void emitBinary(FILE* file, const char* valueType,
+					   const char* operator, int offset)
+{
+	fprintf(file, "\tAOT_BINARY(%s, %s, %d);\n", valueType, operator, offset);
+}
+
+/**
+ * emitInstruction - writes the C of one instruction.
+ * @file: the output file.
+ * @chunk: the chunk holding the instruction.
+ * @offset: offset of the instruction.
+ * @labels: a flag per offset, set here for the target of each jump.
+ * Return: false if control never continues to the next instruction.
+*/
+static bool emitInstruction(FILE* file, Chunk* chunk, int offset,
+							bool* labels)
+{
+	uint8_t* code = chunk->code + offset;
+	int next = offset + instructionLength(chunk, offset);
+
+	switch (code[0])
+	{
+		case OP_CONSTANT:
+			fprintf(file, "\tAOT_PUSH(AOT_CONSTANT(%d));\n", code[1]);
+			return true;
+		case OP_CONSTANT_LONG:
+			fprintf(file, "\tAOT_PUSH(AOT_CONSTANT(%d));\n",
+					(code[1] << 16) | (code[2] << 8) | code[3]);
+			return true;
+		case OP_NIL: fprintf(file, "\tAOT_PUSH(NIL_VAL);\n"); return true;
+		case OP_TRUE:
+			fprintf(file, "\tAOT_PUSH(BOOL_VAL(true));\n");
+			return true;
+		case OP_FALSE:
+			fprintf(file, "\tAOT_PUSH(BOOL_VAL(false));\n");
+			return true;
+
+		case OP_EQUAL: fprintf(file, "\tAOT_EQUAL(BOOL_VAL);\n"); return true;
+		case OP_NOT_EQUAL:
+			fprintf(file, "\tAOT_EQUAL(AOT_NOT_BOOL_VAL);\n");
+			return true;
+
+		// `OP_GREATER_EQUAL` and `OP_LESS_EQUAL` negate the opposite
+		// comparison, as in the interpreter, to treat NaN the same.
+		case OP_GREATER:
+		case OP_GREATER_NUM:
+			emitBinary(file, "BOOL_VAL", ">", offset);
+			return true;
+		case OP_GREATER_EQUAL:
+		case OP_GREATER_EQUAL_NUM:
+			emitBinary(file, "AOT_NOT_BOOL_VAL", "<", offset);
+			return true;
+		case OP_LESS:
+		case OP_LESS_NUM:
+			emitBinary(file, "BOOL_VAL", "<", offset);
+			return true;
+		case OP_LESS_EQUAL:
+		case OP_LESS_EQUAL_NUM:
+			emitBinary(file, "AOT_NOT_BOOL_VAL", ">", offset);
+			return true;
+		case OP_ADD:
+		case OP_ADD_NUM:
+		case OP_ADD_STR:
+			emitBinary(file, "NUMBER_VAL", "+", offset);
+			return true;
+		case OP_SUBTRACT:
+		case OP_SUBTRACT_NUM:
+			emitBinary(file, "NUMBER_VAL", "-", offset);
+			return true;
+		case OP_MULTIPLY:
+		case OP_MULTIPLY_NUM:
+			emitBinary(file, "NUMBER_VAL", "*", offset);
+			return true;
+		case OP_DIVIDE:
+		case OP_DIVIDE_NUM:
+			emitBinary(file, "NUMBER_VAL", "/", offset);
+			return true;
+
+		case OP_NOT:
+			fprintf(file, "\tsp[-1] = BOOL_VAL(AOT_FALSEY(sp[-1]));\n");
+			return true;
+		case OP_NEGATE:
+			fprintf(file, "\tAOT_NEGATE(%d);\n", offset);
+			return true;
+		case OP_PRINT: fprintf(file, "\tAOT_PRINT();\n"); return true;
+
+		case OP_JUMP: {
+			int target = next + readShort(code + 1);
+			labels[target] = true;
+			fprintf(file, "\tgoto L%d;\n", target);
+			return false;
+		}
+		case OP_JUMP_IF_FALSE: {
+			int target = next + readShort(code + 1);
+			labels[target] = true;
+			fprintf(file, "\tif (AOT_FALSEY(sp[-1])) goto L%d;\n", target);
+			return true;
+		}
+		case OP_LOOP:
+			fprintf(file, "\tAOT_COUNT_LOOP(%d);\n", readShort(code + 3));
+			fprintf(file, "\tgoto L%d;\n", next - readShort(code + 1));
+			return false;
+
+		case OP_POP: fprintf(file, "\tsp--;\n"); return true;
+		case OP_POPN: fprintf(file, "\tsp -= %d;\n", code[1]); return true;
+		case OP_GET_LOCAL:
+			fprintf(file, "\tAOT_PUSH(AOT_LOCAL(%d));\n", code[1]);
+			return true;
+		case OP_SET_LOCAL:
+			fprintf(file, "\tAOT_LOCAL(%d) = sp[-1];\n", code[1]);
+			return true;
+		case OP_GET_UPVALUE:
+			fprintf(file, "\tAOT_PUSH(AOT_UPVALUE(%d));\n", code[1]);
+			return true;
+		case OP_SET_UPVALUE:
+			fprintf(file, "\tAOT_UPVALUE(%d) = sp[-1];\n", code[1]);
+			return true;
+		case OP_GET_GLOBAL:
+			fprintf(file, "\tAOT_GET_GLOBAL(%d, %d);\n",
+					readShort(code + 1), offset);
+			return true;
+		case OP_SET_GLOBAL:
+			fprintf(file, "\tAOT_SET_GLOBAL(%d, %d);\n",
+					readShort(code + 1), offset);
+			return true;
+		case OP_DEFINE_GLOBAL:
+			fprintf(file, "\tAOT_GLOBAL(%d) = *--sp;\n", readShort(code + 1));
+			return true;
+
+		default:
+			fprintf(file, "\tAOT_EXIT(%d);\n", offset);
+			return false;
+	}
+}
+
+/**
+ * emitChunk - writes the C function of one chunk. It starts by jumping to
+ * the frame's next instruction, or returns that instruction's offset
+ * straight away if the C cannot start there. Instructions control never
+ * reaches in the C, such as those after an exit, are left out.
+ * @file: the output file.
+ * @chunk: the chunk.
+ * @index: number of the chunk, which names the function.
+ * @name: name of the chunk's function, or NULL for the script.
+*/
+static void emitChunk(FILE* file, Chunk* chunk, int index, ObjStringVec* name)
+{
+	bool* entries = findEntries(chunk);
+	bool* labels = calloc(chunk->count, sizeof(bool));
+	if (labels == NULL)
+	{
+		fprintf(stderr, "Error: Not enough memory to emit C.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (name == NULL) fprintf(file, "// <script>\n");
+	else fprintf(file, "// fun %s\n", name->chars);
+	fprintf(file, "static int chunk%d(CallFrame* frame)\n{\n", index);
+	fprintf(file, "\tValue* sp = vm.stackTop;\n");
+	fprintf(file, "\tint offset = (int)(frame->ip - frame->chunk->code);\n");
+	fprintf(file, "\tswitch (offset)\n\t{\n");
+	for (int offset = 0; offset < chunk->count; offset++)
+	{
+		if (!entries[offset]) continue;
+		fprintf(file, "\t\tcase %d: goto L%d;\n", offset, offset);
+		labels[offset] = true;
+	}
+	fprintf(file, "\t\tdefault: return offset;\n\t}\n");
+
+	bool reachable = false;
+	int line = -1;
+	for (int offset = 0; offset < chunk->count;
+		 offset += instructionLength(chunk, offset))
+	{
+		if (labels[offset])
+		{
+			fprintf(file, "\nL%d:\n", offset);
+			reachable = true;
+		}
+		if (!reachable) continue;
+
+		if (getLine(chunk, offset) != line)
+		{
+			line = getLine(chunk, offset);
+			fprintf(file, "\t// line %d\n", line);
+		}
+		reachable = emitInstruction(file, chunk, offset, labels);
+	}
+	fprintf(file, "}\n\n");
+
+	free(entries);
+	free(labels);
+}
+
+/**
+ * emitChunks - writes the C function of a chunk and of every function
+ * nested in it, numbering them in the order `attachChunks` visits them.
+ * @file: the output file.
+ * @chunk: the chunk.
+ * @name: name of the chunk's function, or NULL for the script.
+ * @count: number of chunks written so far.
+ * Return: number of chunks written once this one and its nested ones are.
+*/
+static int emitChunks(FILE* file, Chunk* chunk, ObjStringVec* name,
+					  int count)
+{
+	emitChunk(file, chunk, count++, name);
+	for (int i = 0; i < chunk->constants.count; i++)
+	{
+		Value constant = chunk->constants.values[i];
+		if (!IS_FUNCTION(constant)) continue;
+		ObjFunction* function = AS_FUNCTION(constant);
+		count = emitChunks(file, &function->chunk, function->name, count);
+	}
+	return count;
+}
+
+/**
+ * writeC - compiles a chunk to a C program that runs it. The program is
+ * built against the clox runtime, every source file but main.c.
+ * @chunk: the compiled chunk.
+ * @path: path of the C file to write.
+ * Return: false if the file could not be written.
+*/
+bool writeC(Chunk* chunk, const char* path)
+{
+	FILE* image = tmpfile();
+	if (image == NULL || !writeBytecodeFile(chunk, image))
+	{
+		fprintf(stderr, "Error: Could not serialize the chunk.\n");
+		if (image != NULL) fclose(image);
+		return false;
+	}
+
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Error: Could not open file \"%s\".\n", path);
+		fclose(image);
+		return false;
+	}
+
+	fprintf(file, "// Generated by clox --emit-c. Build it with the clox "
+				  "runtime, every source\n// file of clox but main.c:\n"
+				  "//   cc -O2 -Iclox -o program program.c "
+				  "$(ls clox/*.c | grep -v main.c) -lm\n\n");
+	fprintf(file, "#include \"aot.h\"\n\n");
+
+	int count = emitChunks(file, chunk, NULL, 0);
+
+	fprintf(file, "static AotCode code[] = {");
+	for (int i = 0; i < count; i++)
+	{
+		fprintf(file, "%s\tchunk%d,", i % 8 == 0 ? "\n" : "", i);
+	}
+	fprintf(file, "\n};\n\n");
+
+	fprintf(file, "// the chunk as written by --compile.\n");
+	fprintf(file, "static const uint8_t image[] = {");
+	rewind(image);
+	int byte;
+	for (int i = 0; (byte = fgetc(image)) != EOF; i++)
+	{
+		fprintf(file, "%s0x%02x,", i % 16 == 0 ? "\n\t" : " ", byte);
+	}
+	fprintf(file, "\n};\n\n");
+	fclose(image);
+
+	fprintf(file, "int main()\n{\n");
+	fprintf(file, "\treturn runAotProgram(image, sizeof(image), code, %d);\n",
+			count);
+	fprintf(file, "}\n");
+
+	bool ok = !ferror(file);
+	if (fclose(file) != 0) ok = false;
+	if (!ok) fprintf(stderr, "Error: Could not write file \"%s\".\n", path);
+	return ok;
+}
+
+/**
+ * runAot - runs the C of the current frame's chunk from the frame's next
+ * instruction. Returns when the C reaches an instruction it leaves to the
+ * interpreter, with the frame's `ip` pointing at that instruction.
+ * @frame: the current frame.
+*/
+void runAot(CallFrame* frame)
+{
+	frame->ip = frame->chunk->code + frame->chunk->aot(frame);
+}
+
+/**
+ * attachChunks - hands each chunk its C function, visiting the chunks in
+ * the order `emitChunks` numbered them.
+ * @chunk: the chunk.
+ * @code: the C function of each chunk.
+ * @count: number of C functions.
+ * @next: number of chunks visited so far.
+ * Return: number of chunks visited once this one and its nested ones are.
+*/
+static int attachChunks(Chunk* chunk, AotCode* code, int count, int next)
+{
+	if (next < count) chunk->aot = code[next];
+	next++;
+	for (int i = 0; i < chunk->constants.count; i++)
+	{
+		Value constant = chunk->constants.values[i];
+		if (!IS_FUNCTION(constant)) continue;
+		next = attachChunks(&AS_FUNCTION(constant)->chunk, code, count, next);
+	}
+	return next;
+}
+
+/**
+ * runAotProgram - runs a program written by `--emit-c`: loads the chunk
+ * built into it and runs it with the C of each of its chunks.
+ * @image: the serialized chunk.
+ * @size: size of the image in bytes.
+ * @code: the C function of each chunk.
+ * @count: number of C functions.
+ * Return: the exit status, as for running the source with clox.
+*/
+int runAotProgram(const uint8_t* image, size_t size, AotCode* code,
+				  int count)
+{
+	initVM();
+
+	Chunk chunk;
+	if (!loadBytecodeImage(image, size, &chunk))
+	{
+		freeVM();
+		return 65;
+	}
+	if (attachChunks(&chunk, code, count, 0) != count)
+	{
+		fprintf(stderr, "Error: The built-in bytecode does not match its C.\n");
+		unloadBytecode(&chunk);
+		freeVM();
+		return 65;
+	}
+
+	InterpretResult result = interpretChunk(&chunk);
+	unloadBytecode(&chunk);
+	freeVM();
+	return result == INTERPRET_RUNTIME_ERROR ? 70 : 0;
+}
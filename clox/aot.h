@@ -0,0 +1,72 @@
+#if !defined(clox_aot_h)
+#define clox_aot_h
+
+#include "vm.h"
+
+// the C written by `--emit-c` is built out of these. Each compiled chunk
+// keeps the top of the VM stack in the local `sp` while it runs and puts
+// it back in `vm.stackTop` when it hands the frame to the interpreter.
+#define AOT_PUSH(value) (*sp++ = (value))
+#define AOT_CONSTANT(index) (frame->chunk->constants.values[index])
+#define AOT_LOCAL(slot) (frame->slots[slot])
+#define AOT_UPVALUE(slot) (*frame->closure->upvalues[slot]->location)
+#define AOT_GLOBAL(slot) (vm.globalValues.values[slot])
+#define AOT_FALSEY(value) \
+		(IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)))
+#define AOT_NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+// leaves the instruction at `offset` to the interpreter, which also
+// reports any runtime error the instruction raises.
+#define AOT_EXIT(offset) \
+		do { \
+			vm.stackTop = sp; \
+			return (offset); \
+		} while (false)
+
+#define AOT_EQUAL(valueType) \
+		do { \
+			sp[-2] = valueType(valuesEqual(sp[-2], sp[-1])); \
+			sp--; \
+		} while (false)
+
+// arithmetic and comparisons on anything but two numbers, adding strings
+// included, run in the interpreter.
+#define AOT_BINARY(valueType, op, offset) \
+		do { \
+			if (!IS_NUMBER(sp[-2]) || !IS_NUMBER(sp[-1])) AOT_EXIT(offset); \
+			sp[-2] = valueType(AS_NUMBER(sp[-2]) op AS_NUMBER(sp[-1])); \
+			sp--; \
+		} while (false)
+
+#define AOT_NEGATE(offset) \
+		do { \
+			if (!IS_NUMBER(sp[-1])) AOT_EXIT(offset); \
+			sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1])); \
+		} while (false)
+
+#define AOT_PRINT() \
+		do { \
+			printValue(*--sp); \
+			printf("\n"); \
+		} while (false)
+
+#define AOT_GET_GLOBAL(slot, offset) \
+		do { \
+			if (IS_UNDEFINED(AOT_GLOBAL(slot))) AOT_EXIT(offset); \
+			AOT_PUSH(AOT_GLOBAL(slot)); \
+		} while (false)
+
+#define AOT_SET_GLOBAL(slot, offset) \
+		do { \
+			if (IS_UNDEFINED(AOT_GLOBAL(slot))) AOT_EXIT(offset); \
+			AOT_GLOBAL(slot) = sp[-1]; \
+		} while (false)
+
+#define AOT_COUNT_LOOP(loop) (frame->chunk->loops[loop].iterations++)
+
+bool writeC(Chunk* chunk, const char* path);
+void runAot(CallFrame* frame);
+int runAotProgram(const uint8_t* image, size_t size, AotCode* code,
+				  int count);
+
+#endif // clox_aot_h
@@ -0,0 +1,616 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytecode.h"
+#include "jit.h"
+#include "memory.h"
+#include "object.h"
+#include "verifier.h"
+#include "vm.h"
+
+/**
+ * struct reader - a cursor over the bytes of a mapped bytecode file.
+ * @start: pointer to the first byte of the file.
+ * @size: size of the file in bytes.
+ * @offset: position of the next byte to read.
+*/
+typedef struct reader
+{
+	const uint8_t* start;
+	size_t size;
+	size_t offset;
+} Reader;
+
+/**
+ * readBytes - copies the next bytes of the file into the given buffer.
+ * `memcpy` is used since the sections of the file are not aligned.
+ * @reader: pointer to the cursor.
+ * @bytes: buffer to copy the bytes into.
+ * @size: number of bytes to read.
+ * Return: false if the file ends before the bytes could be read.
+*/
+static bool readBytes(Reader* reader, void* bytes, size_t size)
+{
+	if (reader->size - reader->offset < size) return false;
+	memcpy(bytes, reader->start + reader->offset, size);
+	reader->offset += size;
+	return true;
+}
+
+/**
+ * readString - interns the length-prefixed string at the cursor.
+ * @reader: pointer to the cursor.
+ * @string: output parameter for the interned string.
+ * Return: false if the file ends before the whole string could be read.
+*/
+static bool readString(Reader* reader, ObjStringVec** string)
+{
+	uint32_t length;
+	if (!readBytes(reader, &length, sizeof(length))) return false;
+	if (reader->size - reader->offset < length) return false;
+
+	*string = copyStringVec((const char*)reader->start + reader->offset,
+							(int)length);
+	reader->offset += length;
+	return true;
+}
+
+/**
+ * writeString - writes a string as its 32-bit length followed by its
+ * characters.
+ * @file: the output file.
+ * @string: the string to write.
+*/
+static void writeString(FILE* file, ObjStringVec* string)
+{
+	uint32_t length = (uint32_t)string->length;
+	fwrite(&length, sizeof(length), 1, file);
+	fwrite(string->chars, sizeof(char), string->length, file);
+}
+
+/**
+ * writeCount - writes a section's element count as 32 bits.
+ * @file: the output file.
+ * @count: the count.
+*/
+static void writeCount(FILE* file, int count)
+{
+	uint32_t value = (uint32_t)count;
+	fwrite(&value, sizeof(value), 1, file);
+}
+
+static bool writeConstants(FILE* file, Chunk* chunk);
+
+/**
+ * writeCaches - writes the property name of each inline cache of a chunk
+ * as the index of the name among the chunk's constants. What the caches
+ * learned at run time is not kept.
+ * @file: the output file.
+ * @chunk: the chunk whose caches to write.
+*/
+static void writeCaches(FILE* file, Chunk* chunk)
+{
+	for (int i = 0; i < chunk->cacheCount; i++)
+	{
+		int32_t name = findConstant(chunk, OBJ_VAL(chunk->caches[i].name));
+		fwrite(&name, sizeof(name), 1, file);
+	}
+}
+
+/**
+ * writeFunction - writes a function's arity, upvalue count, name and chunk. The chunk is
+ * written whole, constants and nested functions included.
+ * @file: the output file.
+ * @function: the function to write.
+ * Return: false if one of its constants cannot be serialized.
+*/
+static bool writeFunction(FILE* file, ObjFunction* function)
+{
+	Chunk* chunk = &function->chunk;
+	writeCount(file, function->arity);
+	writeCount(file, function->upvalueCount);
+	writeString(file, function->name);
+
+	writeCount(file, chunk->count);
+	fwrite(chunk->code, sizeof(uint8_t), chunk->count, file);
+	writeCount(file, chunk->lineCount);
+	fwrite(chunk->lines, sizeof(LineStart), chunk->lineCount, file);
+	writeCount(file, chunk->loopCount);
+	for (int i = 0; i < chunk->loopCount; i++)
+	{
+		int32_t line = chunk->loops[i].line;
+		fwrite(&line, sizeof(line), 1, file);
+	}
+
+	writeCount(file, chunk->constants.count);
+	if (!writeConstants(file, chunk)) return false;
+
+	writeCount(file, chunk->cacheCount);
+	writeCaches(file, chunk);
+	return true;
+}
+
+/**
+ * writeConstants - writes each constant of a chunk as a tag followed by
+ * its payload.
+ * @file: the output file.
+ * @chunk: the chunk whose constants to write.
+ * Return: false if a constant cannot be serialized.
+*/
+static bool writeConstants(FILE* file, Chunk* chunk)
+{
+	for (int i = 0; i < chunk->constants.count; i++)
+	{
+		Value value = chunk->constants.values[i];
+		if (IS_NUMBER(value))
+		{
+			uint8_t tag = CONSTANT_NUMBER;
+			double number = AS_NUMBER(value);
+			fwrite(&tag, sizeof(tag), 1, file);
+			fwrite(&number, sizeof(number), 1, file);
+		} else if (IS_OBJ(value) && OBJ_TYPE(value) == OBJ_STRING)
+		{
+			uint8_t tag = CONSTANT_STRING;
+			fwrite(&tag, sizeof(tag), 1, file);
+			writeString(file, AS_STRING(value));
+		} else if (IS_FUNCTION(value))
+		{
+			uint8_t tag = CONSTANT_FUNCTION;
+			fwrite(&tag, sizeof(tag), 1, file);
+			if (!writeFunction(file, AS_FUNCTION(value))) return false;
+		} else
+		{
+			fprintf(stderr, "Error: Cannot serialize constant %d.\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * isBytecodeFile - checks whether a file starts with the bytecode magic.
+ * @path: path to the file.
+ * Return: true for a serialized chunk, false for anything else.
+*/
+bool isBytecodeFile(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return false;
+
+	char magic[4];
+	bool isBytecode = fread(magic, sizeof(char), 4, file) == 4 &&
+					  memcmp(magic, BYTECODE_MAGIC, 4) == 0;
+	fclose(file);
+	return isBytecode;
+}
+
+/**
+ * writeBytecodeFile - serializes a compiled chunk: its code, its line
+ * table, the source lines of its loops, the property names of its inline
+ * caches, its constant pool and the names of the
+ * global variables whose slots the code refers to. The header is written
+ * last, once the offset of every section is known.
+ * @chunk: the compiled chunk.
+ * @file: the output file, positioned at its start and seekable.
+ * Return: false if a constant cannot be serialized or a write failed.
+*/
+bool writeBytecodeFile(Chunk* chunk, FILE* file)
+{
+	BytecodeHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, BYTECODE_MAGIC, 4);
+	header.version = BYTECODE_VERSION;
+	header.endianCheck = BYTECODE_ENDIAN_CHECK;
+	header.codeLength = (uint32_t)chunk->count;
+	header.lineCount = (uint32_t)chunk->lineCount;
+	header.loopCount = (uint32_t)chunk->loopCount;
+	header.cacheCount = (uint32_t)chunk->cacheCount;
+	header.constantCount = (uint32_t)chunk->constants.count;
+	header.globalCount = (uint32_t)vm.globalNames.count;
+
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(chunk->code, sizeof(uint8_t), chunk->count, file);
+
+	// keep the line table 4-byte aligned so it can be used in place.
+	static const uint8_t padding[4] = { 0 };
+	fwrite(padding, sizeof(uint8_t), (4 - ftell(file) % 4) % 4, file);
+	header.linesOffset = (uint32_t)ftell(file);
+	fwrite(chunk->lines, sizeof(LineStart), chunk->lineCount, file);
+
+	// only the lines are stored, the iteration counters start at zero.
+	header.loopsOffset = (uint32_t)ftell(file);
+	for (int i = 0; i < chunk->loopCount; i++)
+	{
+		int32_t line = chunk->loops[i].line;
+		fwrite(&line, sizeof(line), 1, file);
+	}
+
+	header.cachesOffset = (uint32_t)ftell(file);
+	writeCaches(file, chunk);
+
+	header.constantsOffset = (uint32_t)ftell(file);
+	if (!writeConstants(file, chunk)) return false;
+
+	header.globalsOffset = (uint32_t)ftell(file);
+	for (int i = 0; i < vm.globalNames.count; i++)
+	{
+		writeString(file, AS_STRING(vm.globalNames.values[i]));
+	}
+
+	header.fileSize = (uint32_t)ftell(file);
+	fseek(file, 0L, SEEK_SET);
+	fwrite(&header, sizeof(header), 1, file);
+	return !ferror(file);
+}
+
+/**
+ * writeBytecode - serializes a compiled chunk into a file.
+ * @chunk: the compiled chunk.
+ * @path: path of the file to write.
+ * Return: false if the file could not be written.
+*/
+bool writeBytecode(Chunk* chunk, const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Error: Could not open file \"%s\".\n", path);
+		return false;
+	}
+
+	bool ok = writeBytecodeFile(chunk, file);
+	if (fclose(file) != 0) ok = false;
+	if (!ok) fprintf(stderr, "Error: Could not write file \"%s\".\n", path);
+	return ok;
+}
+
+static bool readConstants(Reader* reader, uint32_t count, Chunk* chunk);
+
+/**
+ * readCaches - gives the chunk an empty inline cache for each property
+ * name index read. The chunk's constants must already be loaded.
+ * @reader: pointer to the cursor.
+ * @count: number of caches to read.
+ * @chunk: the chunk the caches belong to.
+ * Return: false if an index does not name a string constant.
+*/
+static bool readCaches(Reader* reader, uint32_t count, Chunk* chunk)
+{
+	if (count > UINT16_MAX + 1) return false;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		int32_t name;
+		if (!readBytes(reader, &name, sizeof(name))) return false;
+		if (name < 0 || name >= chunk->constants.count) return false;
+
+		Value value = chunk->constants.values[name];
+		if (!IS_OBJ(value) || OBJ_TYPE(value) != OBJ_STRING) return false;
+		addPropertyCache(chunk, AS_STRING(value));
+	}
+	return true;
+}
+
+/**
+ * readArray - copies a counted section of the file into a newly
+ * allocated array.
+ * @reader: pointer to the cursor.
+ * @size: size of each element.
+ * @count: where to store the number of elements read.
+ * Return: the array, or NULL if the file ends first or the section is
+ * empty.
+*/
+static void* readArray(Reader* reader, size_t size, int* count)
+{
+	uint32_t length;
+	*count = 0;
+	if (!readBytes(reader, &length, sizeof(length))) return NULL;
+	if ((reader->size - reader->offset) / size < length) return NULL;
+	if (length == 0) return NULL;
+
+	void* array = reallocate(NULL, 0, size * length);
+	readBytes(reader, array, size * length);
+	*count = (int)length;
+	return array;
+}
+
+/**
+ * readFunction - rebuilds a serialized function. Unlike the top-level
+ * code, function bodies are copied out of the mapping since the function
+ * owns and frees its chunk. The function sits on the stack while its
+ * parts are allocated.
+ * @reader: pointer to the cursor.
+ * @value: where to store the function.
+ * Return: false if the function is malformed.
+*/
+static bool readFunction(Reader* reader, Value* value)
+{
+	ObjFunction* function = newFunction();
+	push(OBJ_VAL(function));
+	Chunk* chunk = &function->chunk;
+
+	uint32_t arity = 0;
+	uint32_t upvalueCount = 0;
+	bool ok = readBytes(reader, &arity, sizeof(arity)) && arity <= UINT8_MAX &&
+			  readBytes(reader, &upvalueCount, sizeof(upvalueCount)) &&
+			  upvalueCount <= UINT8_COUNT &&
+			  readString(reader, &function->name);
+	function->arity = (int)arity;
+	function->upvalueCount = (int)upvalueCount;
+
+	if (ok)
+	{
+		chunk->code = readArray(reader, sizeof(uint8_t), &chunk->count);
+		chunk->capacity = chunk->count;
+		ok = chunk->count > 0;
+	}
+	if (ok)
+	{
+		chunk->lines = readArray(reader, sizeof(LineStart), &chunk->lineCount);
+		chunk->lineCapacity = chunk->lineCount;
+		ok = chunk->lineCount > 0;
+	}
+
+	int loopCount = 0;
+	int32_t* loopLines = ok
+		? readArray(reader, sizeof(int32_t), &loopCount)
+		: NULL;
+	for (int i = 0; i < loopCount; i++) addLoop(chunk, loopLines[i]);
+	FREE_ARRAY(int32_t, loopLines, loopCount);
+	ok = ok && loopCount <= UINT16_MAX + 1;
+
+	uint32_t constantCount;
+	ok = ok && readBytes(reader, &constantCount, sizeof(constantCount)) &&
+		 readConstants(reader, constantCount, chunk);
+
+	uint32_t cacheCount;
+	ok = ok && readBytes(reader, &cacheCount, sizeof(cacheCount)) &&
+		 readCaches(reader, cacheCount, chunk);
+
+	*value = pop();
+	return ok;
+}
+
+/**
+ * readConstants - reads the given number of tagged constants into a
+ * chunk's array of constants, interning strings and rebuilding functions.
+ * @reader: pointer to the cursor.
+ * @count: number of constants to read.
+ * @chunk: the chunk the constants belong to, already reachable by the
+ * collector.
+ * Return: false if a constant is malformed.
+*/
+static bool readConstants(Reader* reader, uint32_t count, Chunk* chunk)
+{
+	for (uint32_t i = 0; i < count; i++)
+	{
+		uint8_t tag;
+		Value value;
+		if (!readBytes(reader, &tag, sizeof(tag))) return false;
+
+		if (tag == CONSTANT_NUMBER)
+		{
+			double number;
+			if (!readBytes(reader, &number, sizeof(number))) return false;
+			value = NUMBER_VAL(number);
+		} else if (tag == CONSTANT_STRING)
+		{
+			ObjStringVec* string;
+			if (!readString(reader, &string)) return false;
+			value = OBJ_VAL(string);
+		} else if (tag == CONSTANT_FUNCTION)
+		{
+			if (!readFunction(reader, &value)) return false;
+		} else
+		{
+			return false;
+		}
+
+		push(value);
+		writeValueArray(&chunk->constants, value);
+		pop();
+	}
+	return true;
+}
+
+/**
+ * loadConstants - rebuilds the chunk's array of constants and its inline
+ * caches, then binds the
+ * global variables the code refers to to the same slots they had when
+ * the file was compiled.
+ * @reader: pointer to a cursor over the mapped file.
+ * @header: pointer to the file's header.
+ * @chunk: the chunk being loaded.
+ * Return: false if the sections are malformed.
+*/
+static bool loadConstants(Reader* reader, BytecodeHeader* header, Chunk* chunk)
+{
+	reader->offset = header->constantsOffset;
+	if (!readConstants(reader, header->constantCount, chunk)) return false;
+
+	reader->offset = header->cachesOffset;
+	if (!readCaches(reader, header->cacheCount, chunk)) return false;
+
+	reader->offset = header->globalsOffset;
+	for (uint32_t i = 0; i < header->globalCount; i++)
+	{
+		ObjStringVec* name;
+		if (!readString(reader, &name)) return false;
+		if (globalSlot(name) != (int)i) return false;
+	}
+	return true;
+}
+
+/**
+ * loadMapping - sets up a chunk to execute a serialized chunk in place.
+ * Nothing is scanned or parsed: the code and line table are used straight
+ * from the mapping, only the strings of the constant pool and the global
+ * names are interned and the loop counters, which the VM updates, are
+ * allocated. The mapping must be writable so that the VM can patch the
+ * code. The code is verified like freshly compiled code, as the VM trusts
+ * it just as much.
+ * @base: the mapping, which the chunk takes over.
+ * @size: size of the mapping in bytes.
+ * @name: what to call the bytecode in error messages.
+ * @chunk: the chunk to set up.
+ * Return: false if the bytecode is malformed or holds invalid code, in
+ * which case the mapping is released.
+*/
+static bool loadMapping(uint8_t* base, size_t size, const char* name,
+						Chunk* chunk)
+{
+	BytecodeHeader* header = (BytecodeHeader*)base;
+	if (memcmp(header->magic, BYTECODE_MAGIC, 4) != 0 ||
+		header->version != BYTECODE_VERSION ||
+		header->endianCheck != BYTECODE_ENDIAN_CHECK)
+	{
+		fprintf(stderr, "Error: \"%s\" was compiled by an incompatible clox.\n",
+				name);
+		munmap(base, size);
+		return false;
+	}
+
+	if (header->fileSize != size ||
+		header->codeLength == 0 ||
+		header->codeLength > size - sizeof(BytecodeHeader) ||
+		header->linesOffset % sizeof(int) != 0 ||
+		header->linesOffset > size ||
+		header->lineCount == 0 ||
+		header->lineCount > (size - header->linesOffset) / sizeof(LineStart) ||
+		header->loopsOffset % sizeof(int32_t) != 0 ||
+		header->loopsOffset > size ||
+		header->loopCount > UINT16_MAX + 1 ||
+		header->loopCount > (size - header->loopsOffset) / sizeof(int32_t) ||
+		header->cachesOffset > size ||
+		header->constantsOffset > size ||
+		header->globalsOffset > size)
+	{
+		fprintf(stderr, "Error: \"%s\" is corrupt.\n", name);
+		munmap(base, size);
+		return false;
+	}
+
+	// the capacities stay zero as the chunk does not own the mapped arrays.
+	initChunk(chunk);
+	chunk->code = base + sizeof(BytecodeHeader);
+	chunk->count = (int)header->codeLength;
+	chunk->lines = (LineStart*)(base + header->linesOffset);
+	chunk->lineCount = (int)header->lineCount;
+
+	// allocated before any constant exists that a collection could free.
+	const int32_t* loopLines = (const int32_t*)(base + header->loopsOffset);
+	chunk->loopCapacity = (int)header->loopCount;
+	chunk->loops = GROW_ARRAY(Loop, NULL, 0, chunk->loopCapacity);
+	for (uint32_t i = 0; i < header->loopCount; i++)
+	{
+		addLoop(chunk, loopLines[i]);
+	}
+
+	// make the constants loaded so far reachable while more get interned.
+	vm.chunk = chunk;
+	Reader reader = { base, size, 0 };
+	bool ok = loadConstants(&reader, header, chunk) && verifyChunk(chunk);
+	vm.chunk = NULL;
+
+	if (!ok)
+	{
+		fprintf(stderr, "Error: \"%s\" is corrupt.\n", name);
+		unloadBytecode(chunk);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * loadBytecode - maps a bytecode file into memory and sets up the chunk
+ * to execute the mapped code in place. The mapping is private so that
+ * the VM can patch the code without touching the file.
+ * @path: path to the bytecode file.
+ * @chunk: the chunk to set up.
+ * Return: false if the file could not be mapped, is malformed or holds
+ * invalid code.
+*/
+bool loadBytecode(const char* path, Chunk* chunk)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		fprintf(stderr, "Error: Could not open file \"%s\".\n", path);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(BytecodeHeader))
+	{
+		fprintf(stderr, "Error: \"%s\" is not a bytecode file.\n", path);
+		close(fd);
+		return false;
+	}
+
+	size_t size = (size_t)st.st_size;
+	uint8_t* base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED)
+	{
+		fprintf(stderr, "Error: Could not map file \"%s\".\n", path);
+		return false;
+	}
+
+	return loadMapping(base, size, path, chunk);
+}
+
+/**
+ * loadBytecodeImage - sets up a chunk to execute a serialized chunk held
+ * in memory, such as one built into a program by `--emit-c`. The image is
+ * copied to a fresh mapping so the chunk can be unloaded like one loaded
+ * from a file.
+ * @image: the serialized chunk.
+ * @size: size of the image in bytes.
+ * @chunk: the chunk to set up.
+ * Return: false if the image could not be copied, is malformed or holds
+ * invalid code.
+*/
+bool loadBytecodeImage(const uint8_t* image, size_t size, Chunk* chunk)
+{
+	if (size < sizeof(BytecodeHeader))
+	{
+		fprintf(stderr, "Error: \"built-in bytecode\" is not a bytecode file.\n");
+		return false;
+	}
+
+	uint8_t* base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+	{
+		fprintf(stderr, "Error: Could not map the built-in bytecode.\n");
+		return false;
+	}
+	memcpy(base, image, size);
+	return loadMapping(base, size, "built-in bytecode", chunk);
+}
+
+/**
+ * unloadBytecode - releases a chunk set up by `loadBytecode`. The code
+ * always starts right after the header, which locates the mapping.
+ * @chunk: the loaded chunk.
+*/
+void unloadBytecode(Chunk* chunk)
+{
+	uint8_t* base = chunk->code - sizeof(BytecodeHeader);
+	size_t size = ((BytecodeHeader*)base)->fileSize;
+
+	freeValueArray(&chunk->constants);
+	FREE_ARRAY(int, chunk->constantIndex, chunk->indexCapacity);
+	FREE_ARRAY(Loop, chunk->loops, chunk->loopCapacity);
+	FREE_ARRAY(PropertyCache, chunk->caches, chunk->cacheCapacity);
+	#if defined(JIT)
+	freeJit(chunk->jit);
+	#endif // JIT
+	deleteRegChunk(chunk->regChunk);
+	munmap(base, size);
+	initChunk(chunk);
+}
@@ -0,0 +1,79 @@
+#if !defined(clox_bytecode_h)
+#define clox_bytecode_h
+
+#include "chunk.h"
+
+#define BYTECODE_MAGIC "LOXC"
+// bump whenever the layout of the file or the numbering of the opcodes
+// changes so that stale files are rejected instead of misinterpreted.
+#define BYTECODE_VERSION 9
+// written in the machine's byte order; a mismatch on load means the file
+// was produced on a machine with a different endianness.
+#define BYTECODE_ENDIAN_CHECK 0x01020304
+
+/**
+ * struct bytecodeHeader - the fixed-size header at the start of a
+ * serialized chunk. The code immediately follows the header and every
+ * other section is located by its offset from the start of the file, so
+ * the file can be mapped anywhere in memory and used in place.
+ * @magic: the bytes "LOXC".
+ * @version: format version, `BYTECODE_VERSION`.
+ * @endianCheck: `BYTECODE_ENDIAN_CHECK` in the writer's byte order.
+ * @fileSize: total size of the file in bytes.
+ * @codeLength: number of bytes of bytecode.
+ * @lineCount: number of entries in the run-length encoded line table.
+ * @linesOffset: file offset of the line table.
+ * @loopCount: number of loops in the code.
+ * @loopsOffset: file offset of the source line of each loop.
+ * @cacheCount: number of property access sites in the code.
+ * @cachesOffset: file offset of the constant index of each site's
+ * property name.
+ * @constantCount: number of entries in the constant pool.
+ * @constantsOffset: file offset of the constant pool.
+ * @globalCount: number of global variable slots the code refers to.
+ * @globalsOffset: file offset of the names of the global variables.
+*/
+typedef struct bytecodeHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t endianCheck;
+	uint32_t fileSize;
+	uint32_t codeLength;
+	uint32_t lineCount;
+	uint32_t linesOffset;
+	uint32_t loopCount;
+	uint32_t loopsOffset;
+	uint32_t cacheCount;
+	uint32_t cachesOffset;
+	uint32_t constantCount;
+	uint32_t constantsOffset;
+	uint32_t globalCount;
+	uint32_t globalsOffset;
+} BytecodeHeader;
+
+/**
+ * enum constantTag - identifies the type of each serialized constant.
+ * @CONSTANT_NUMBER: followed by the 8 bytes of a double.
+ * @CONSTANT_STRING: followed by a 32-bit length and the characters.
+ * @CONSTANT_FUNCTION: followed by the function's 32-bit arity and upvalue
+ * count, its name as a string, then its chunk: the code, line table and loop lines, each
+ * preceded by its 32-bit count, the count of its constants followed
+ * by the constants themselves, and the count of its property access sites
+ * followed by the constant index of each site's property name.
+*/
+typedef enum constantTag
+{
+	CONSTANT_NUMBER,
+	CONSTANT_STRING,
+	CONSTANT_FUNCTION
+} ConstantTag;
+
+bool isBytecodeFile(const char* path);
+bool writeBytecodeFile(Chunk* chunk, FILE* file);
+bool writeBytecode(Chunk* chunk, const char* path);
+bool loadBytecode(const char* path, Chunk* chunk);
+bool loadBytecodeImage(const uint8_t* image, size_t size, Chunk* chunk);
+void unloadBytecode(Chunk* chunk);
+
+#endif // clox_bytecode_h
@@ -1,7 +1,13 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
+#include "jit.h"
 #include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#define CONSTANT_INDEX_MAX_LOAD 0.75
 
 
 /**
@@ -14,15 +20,33 @@ void initChunk(Chunk *chunk)
 {
 	chunk->count = 0;
 	chunk->capacity = 0;
-	// chunk->lcount = 0;
 	chunk->code = NULL;
+	chunk->lineCount = 0;
+	chunk->lineCapacity = 0;
 	chunk->lines = NULL;
 	initValueArray(&chunk->constants);
+	chunk->constantIndex = NULL;
+	chunk->indexCapacity = 0;
+	chunk->loopCount = 0;
+	chunk->loopCapacity = 0;
+	chunk->loops = NULL;
+	chunk->cacheCount = 0;
+	chunk->cacheCapacity = 0;
+	chunk->caches = NULL;
+	chunk->stackSize = 0;
+	#if defined(JIT)
+	chunk->hotness = 0;
+	chunk->jit = NULL;
+	#endif // JIT
+	chunk->aot = NULL;
+	chunk->regChunk = NULL;
 }
 
 /**
  * writeChunk - Append a new byte to the end of a dynamic array
- * together with its line number in the source code.
+ * together with its line number in the source code. The line is only
+ * recorded when it differs from the line of the previous byte, so a
+ * statement's worth of bytecode costs a single line table entry.
  * @chunk: pointer to a struct defining a dynamic array.
  * @byte: fixed-width 8-bit int to append to the end of the array.
  * @line: the source line the byte of code being written came from.
@@ -36,59 +60,321 @@ void writeChunk(Chunk *chunk, uint8_t byte, int line)
 
 		chunk->capacity = GROW_CAPACITY(oldCapacity);
 		chunk->code = GROW_ARRAY(
-			u_int8_t, chunk->code, oldCapacity, chunk->capacity
-		);
-		chunk->lines = GROW_ARRAY(
-			int, chunk->lines, oldCapacity, chunk->capacity
+			uint8_t, chunk->code, oldCapacity, chunk->capacity
 		);
 	}
 
 	chunk->code[chunk->count] = byte;
-	// if (chunk->count == 0)
-	// {
-	// 	chunk->lines[chunk->lcount] = line;
-	// 	chunk->lines[chunk->lcount + 1] = 1;
-	// } else
-	// {
-	// 	if (line == chunk->lines[chunk->lcount])
-	// 	{
-	// 		chunk->lines[chunk->lcount + 1] += 1;
-	// 	} else
-	// 	{
-	// 		chunk->lcount += 2;
-	// 		chunk->lines[chunk->lcount] = line;
-	// 		chunk->lines[chunk->lcount + 1] = 1;
-	// 	}
-	// }
-	chunk->lines[chunk->count] = line;
 	chunk->count++;
 
+	if (chunk->lineCount > 0 &&
+		chunk->lines[chunk->lineCount - 1].line == line)
+	{
+		return;
+	}
+
+	if (chunk->lineCapacity < chunk->lineCount + 1)
+	{
+		int oldCapacity = chunk->lineCapacity;
+
+		chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+		chunk->lines = GROW_ARRAY(
+			LineStart, chunk->lines, oldCapacity, chunk->lineCapacity
+		);
+	}
+
+	LineStart* lineStart = &chunk->lines[chunk->lineCount++];
+	lineStart->offset = chunk->count - 1;
+	lineStart->line = line;
+}
+
+/**
+ * truncateChunk - discards the code written from the given offset onwards
+ * along with any line table runs that started there. The constants are
+ * kept since other code may still refer to them.
+ * @chunk: pointer to a struct defining a dynamic array.
+ * @count: number of bytes of code to keep.
+ * Return: void.
+*/
+void truncateChunk(Chunk* chunk, int count)
+{
+	chunk->count = count;
+	while (chunk->lineCount > 0 &&
+		   chunk->lines[chunk->lineCount - 1].offset >= count)
+	{
+		chunk->lineCount--;
+	}
+}
+
+/**
+ * getLine - looks up the source line a byte of bytecode was compiled
+ * from by binary searching the run-length encoded line table for the last
+ * run starting at or before the byte.
+ * @chunk: pointer to a struct defining a dynamic array.
+ * @offset: offset of the byte in the chunk's code.
+ * Return: the source line of the byte.
+*/
+int getLine(Chunk* chunk, int offset)
+{
+	int start = 0;
+	int end = chunk->lineCount - 1;
+
+	while (start < end)
+	{
+		int mid = start + (end - start + 1) / 2;
+		if (chunk->lines[mid].offset <= offset)
+		{
+			start = mid;
+		} else
+		{
+			end = mid - 1;
+		}
+	}
+	return chunk->lines[start].line;
+}
+
+/**
+ * instructionLength - works out the size of the instruction at the given
+ * offset, opcode and operands included. `OP_CLOSURE` is followed by a pair
+ * of bytes per variable its function captures.
+ * @chunk: pointer to a struct defining a dynamic array.
+ * @offset: offset of the instruction's opcode.
+ * Return: number of bytes the instruction takes up.
+*/
+int instructionLength(Chunk* chunk, int offset)
+{
+	switch (chunk->code[offset])
+	{
+		case OP_CONSTANT:
+		case OP_GET_LOCAL:
+		case OP_SET_LOCAL:
+		case OP_POPN:
+		case OP_GET_UPVALUE:
+		case OP_SET_UPVALUE:
+		case OP_CALL:
+		case OP_TAIL_CALL:
+			return 2;
+
+		case OP_GET_GLOBAL:
+		case OP_SET_GLOBAL:
+		case OP_DEFINE_GLOBAL:
+		case OP_GET_PROPERTY:
+		case OP_SET_PROPERTY:
+		case OP_GET_SUPER:
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+			return 3;
+
+		case OP_CONSTANT_LONG:
+		case OP_INVOKE:
+		case OP_SUPER_INVOKE:
+		case OP_TAIL_INVOKE:
+		case OP_CLASS:
+		case OP_METHOD:
+			return 4;
+
+		case OP_LOOP:
+			return 5;
+
+		case OP_CLOSURE: {
+			uint32_t constant = (chunk->code[offset + 1] << 16) |
+								(chunk->code[offset + 2] << 8) |
+								chunk->code[offset + 3];
+			ObjFunction* function =
+				AS_FUNCTION(chunk->constants.values[constant]);
+			return 4 + 2 * function->upvalueCount;
+		}
+
+		default:
+			return 1;
+	}
+}
+
+/**
+ * constantBits - gets the raw bits identifying a constant. Numbers are
+ * compared by their bits rather than with `==` so that `0` and `-0` stay
+ * distinct constants while `NaN` can still be deduplicated.
+ * @value: the constant.
+ * Return: the bits of the value's payload.
+*/
+static uint64_t constantBits(Value value)
+{
+	#if defined(NAN_BOXING)
+	return value;
+	#else
+	uint64_t bits = 0;
+	switch (value.type)
+	{
+		case VAL_NUMBER: memcpy(&bits, &value.as.number, sizeof(double)); break;
+		case VAL_BOOL: bits = AS_BOOL(value); break;
+		case VAL_OBJ: bits = (uint64_t)(uintptr_t)AS_OBJ(value); break;
+		default: break;
+	}
+	return bits;
+	#endif // NAN_BOXING
+}
+
+/**
+ * sameConstant - tests whether two constants are interchangeable.
+ * @a: first constant.
+ * @b: second constant.
+ * Return: true if the constants have the same type and bits.
+*/
+static bool sameConstant(Value a, Value b)
+{
+	#if !defined(NAN_BOXING)
+	if (a.type != b.type) return false;
+	#endif // NAN_BOXING
+	return constantBits(a) == constantBits(b);
+}
+
+/**
+ * hashConstant - mixes the bits of a constant into a bucket hash.
+ * @value: the constant.
+ * Return: hash code of the constant.
+*/
+static uint32_t hashConstant(Value value)
+{
+	uint64_t bits = constantBits(value);
+	bits ^= bits >> 33;
+	bits *= 0xff51afd7ed558ccdULL;
+	bits ^= bits >> 33;
+	return (uint32_t)bits;
+}
+
+/**
+ * findIndexBucket - finds the bucket holding the given constant, or the
+ * empty bucket it would go into.
+ * @chunk: pointer to a struct defining a dynamic array.
+ * @value: the constant to look for.
+ * Return: pointer to the bucket.
+*/
+static int* findIndexBucket(Chunk* chunk, Value value)
+{
+	uint32_t index = hashConstant(value) & (chunk->indexCapacity - 1);
+	for (;;)
+	{
+		int* bucket = &chunk->constantIndex[index];
+		if (*bucket == 0 ||
+			sameConstant(chunk->constants.values[*bucket - 1], value))
+		{
+			return bucket;
+		}
+		index = (index + 1) & (chunk->indexCapacity - 1);
+	}
+}
+
+/**
+ * growConstantIndex - doubles the number of buckets of the constant index
+ * and re-inserts every constant of the chunk.
+ * @chunk: pointer to a struct defining a dynamic array.
+*/
+static void growConstantIndex(Chunk* chunk)
+{
+	FREE_ARRAY(int, chunk->constantIndex, chunk->indexCapacity);
+	chunk->indexCapacity = GROW_CAPACITY(chunk->indexCapacity);
+	chunk->constantIndex = ALLOCATE(int, chunk->indexCapacity);
+	memset(chunk->constantIndex, 0, sizeof(int) * chunk->indexCapacity);
+
+	for (int i = 0; i < chunk->constants.count; i++)
+	{
+		*findIndexBucket(chunk, chunk->constants.values[i]) = i + 1;
+	}
 }
 
 /**
  * addConstant - A convenience method to add a new constant to a chunk.
  * Afterwards, returns the index where the constant was added to aid in
- * the constants retrieval.
+ * the constants retrieval. A constant that is already in the chunk is
+ * not added again, its existing index is returned instead. The value is
+ * kept on the stack while the arrays grow in case that triggers a garbage
+ * collection.
  * @chunk: pointer to a struct defining a dynamic array.
  * @value: Constant value to be added to the dynamic array's list of constants.
  * Return: Index where the constant was added to.
 */
 int addConstant(Chunk *chunk, Value value)
 {
+	int index = findConstant(chunk, value);
+	if (index != -1) return index;
+
+	push(value);
 	writeValueArray(&chunk->constants, value);
+	if (chunk->constants.count > chunk->indexCapacity * CONSTANT_INDEX_MAX_LOAD)
+	{
+		growConstantIndex(chunk);
+	} else
+	{
+		*findIndexBucket(chunk, value) = chunk->constants.count;
+	}
+	pop();
 	return chunk->constants.count - 1;
 }
 
 /**
  * findConstant - A convenience method to search for a constant
- * stored within a chunk's constants array.
+ * stored within a chunk's constants array through the chunk's
+ * hashed constant index.
  * @chunk: pointer to a struct defining a dynamic array.
  * @value: Constant value to be searched for.
  * Return: index of the constant value or -1 if the constant is not found.
 */
 int findConstant(Chunk* chunk, Value value)
 {
-	return findValue(&chunk->constants, value);
+	if (chunk->indexCapacity == 0) return -1;
+
+	int bucket = *findIndexBucket(chunk, value);
+	return bucket - 1;
+}
+
+/**
+ * addLoop - adds a loop to the chunk's table of loops with its execution
+ * counter starting at zero.
+ * @chunk: pointer to a struct defining a dynamic array.
+ * @line: source line of the loop.
+ * Return: index of the loop, for its `OP_LOOP` instruction to carry.
+*/
+int addLoop(Chunk* chunk, int line)
+{
+	if (chunk->loopCapacity < chunk->loopCount + 1)
+	{
+		int oldCapacity = chunk->loopCapacity;
+
+		chunk->loopCapacity = GROW_CAPACITY(oldCapacity);
+		chunk->loops = GROW_ARRAY(
+			Loop, chunk->loops, oldCapacity, chunk->loopCapacity
+		);
+	}
+
+	Loop* loop = &chunk->loops[chunk->loopCount];
+	loop->line = line;
+	loop->iterations = 0;
+	return chunk->loopCount++;
+}
+
+/**
+ * addPropertyCache - adds an empty inline cache for a property access site.
+ * @chunk: pointer to a struct defining a dynamic array.
+ * @name: name of the property, which must also be one of the chunk's
+ * constants so that it stays alive.
+ * Return: index of the cache, for the site's instruction to carry.
+*/
+int addPropertyCache(Chunk* chunk, ObjStringVec* name)
+{
+	if (chunk->cacheCapacity < chunk->cacheCount + 1)
+	{
+		int oldCapacity = chunk->cacheCapacity;
+
+		chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+		chunk->caches = GROW_ARRAY(
+			PropertyCache, chunk->caches, oldCapacity, chunk->cacheCapacity
+		);
+	}
+
+	PropertyCache* cache = &chunk->caches[chunk->cacheCount];
+	cache->name = name;
+	cache->count = 0;
+	return chunk->cacheCount++;
 }
 
 /**
@@ -98,7 +384,14 @@ int findConstant(Chunk* chunk, Value value)
 void freeChunk(Chunk *chunk)
 {
 	FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-	FREE_ARRAY(int, chunk->lines, chunk->capacity);
+	FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
 	freeValueArray(&chunk->constants);
+	FREE_ARRAY(int, chunk->constantIndex, chunk->indexCapacity);
+	FREE_ARRAY(Loop, chunk->loops, chunk->loopCapacity);
+	FREE_ARRAY(PropertyCache, chunk->caches, chunk->cacheCapacity);
+	#if defined(JIT)
+	freeJit(chunk->jit);
+	#endif // JIT
+	deleteRegChunk(chunk->regChunk);
 	initChunk(chunk);
 }
@@ -4,18 +4,37 @@
 #include "common.h"
 #include "value.h"
 
+typedef struct jitCode JitCode;
+typedef struct regChunk RegChunk;
+typedef struct callFrame CallFrame;
+
+// a chunk compiled to C by `--emit-c`. Runs the frame from its `ip` up to
+// an instruction it leaves to the interpreter and returns the offset of
+// that instruction.
+typedef int (*AotCode)(CallFrame* frame);
+
 /**
  * enum opcode - defines the various opcodes of the bytecode.
+ * Serialized chunks store these numbers, so bump `BYTECODE_VERSION` in
+ * bytecode.h whenever opcodes are added, removed or reordered.
+ * The opcodes after `OP_RETURN` are never emitted by the compiler. The VM
+ * rewrites a generic instruction into one of them once it has seen the
+ * operand types at that site (quickening), and back when a later
+ * execution sees different types.
 */
 typedef enum opcode
 {
 	OP_CONSTANT,
+	OP_CONSTANT_LONG,
 	OP_NIL,
 	OP_TRUE,
 	OP_FALSE,
 	OP_EQUAL,
+	OP_NOT_EQUAL,
 	OP_GREATER,
+	OP_GREATER_EQUAL,
 	OP_LESS,
+	OP_LESS_EQUAL,
 	OP_ADD,
 	OP_SUBTRACT,
 	OP_MULTIPLY,
@@ -25,40 +44,164 @@ typedef enum opcode
 	OP_PRINT,
 	OP_JUMP,
 	OP_JUMP_IF_FALSE,
+	OP_LOOP,
 	OP_POP,
+	OP_POPN,
 	OP_GET_LOCAL,
 	OP_SET_LOCAL,
 	OP_GET_GLOBAL,
 	OP_DEFINE_GLOBAL,
 	OP_SET_GLOBAL,
-	OP_RETURN
+	OP_GET_PROPERTY,
+	OP_SET_PROPERTY,
+	OP_GET_SUPER,
+	OP_GET_UPVALUE,
+	OP_SET_UPVALUE,
+	OP_CALL,
+	OP_INVOKE,
+	OP_SUPER_INVOKE,
+	OP_TAIL_CALL,
+	OP_TAIL_INVOKE,
+	OP_CLOSURE,
+	OP_CLOSE_UPVALUE,
+	OP_CLASS,
+	OP_INHERIT,
+	OP_METHOD,
+	OP_RETURN,
+	OP_ADD_NUM,
+	OP_ADD_STR,
+	OP_SUBTRACT_NUM,
+	OP_MULTIPLY_NUM,
+	OP_DIVIDE_NUM,
+	OP_GREATER_NUM,
+	OP_GREATER_EQUAL_NUM,
+	OP_LESS_NUM,
+	OP_LESS_EQUAL_NUM
 } OpCode;
 
 
+/**
+ * struct lineStart - marks the start of a run of bytecode that was all
+ * compiled from the same source line.
+ * @offset: offset of the first byte of the run.
+ * @line: the source line the run of bytes came from.
+*/
+typedef struct lineStart
+{
+	int offset;
+	int line;
+} LineStart;
+
+/**
+ * struct loop - a loop in the chunk. Each loop's `OP_LOOP` instruction
+ * carries the loop's index into the chunk's table of loops.
+ * @line: source line of the loop's `while` or `for` keyword.
+ * @iterations: number of times the loop has jumped back to its header.
+*/
+typedef struct loop
+{
+	int line;
+	uint64_t iterations;
+} Loop;
+
+// number of shapes a property access site remembers before it gives up
+// caching and becomes megamorphic.
+#define PROPERTY_CACHE_WAYS 4
+
+/**
+ * struct propertyCache - the inline cache of a property access site. Each
+ * property instruction carries the index of its own cache, which
+ * remembers the slot the property lives in for the last few instance
+ * shapes seen at that site. An `OP_INVOKE` site also remembers the method
+ * it found for a shape with no field of that name, and an
+ * `OP_SUPER_INVOKE` site the method it found in the superclass, keyed by
+ * the superclass's empty shape. A site that only ever sees
+ * one shape is monomorphic, one that sees up to `PROPERTY_CACHE_WAYS` is
+ * polymorphic and checks each in turn.
+ * @name: name of the property.
+ * @count: number of ways in use.
+ * @shapes: the shape of the instance for each way.
+ * @transitions: for stores, the shape of the instance after the store,
+ * which differs from `shapes` when the store adds a field.
+ * @slots: index of the field in the instance's fields for each way, or -1
+ * when the way caches a method.
+ * @methods: the method cached by each way whose slot is -1.
+*/
+typedef struct propertyCache
+{
+	ObjStringVec* name;
+	int count;
+	ObjShape* shapes[PROPERTY_CACHE_WAYS];
+	ObjShape* transitions[PROPERTY_CACHE_WAYS];
+	int slots[PROPERTY_CACHE_WAYS];
+	Value methods[PROPERTY_CACHE_WAYS];
+} PropertyCache;
+
 /**
  * struct ar - structure to define a dynamic array.
  * @count: Number of entries currently in the array.
  * @capacity: Current size of the dynamic array.
  * @code: pointer to an array that will vary in size.
- * @lines: pointer to an array whose elements are the
- * corresponding line numbers in the bytecode.
+ * @lineCount: number of runs in the line table.
+ * @lineCapacity: allocated size of the line table.
+ * @lines: run-length encoded line table. Holds one entry per run of
+ * consecutive bytes compiled from the same source line.
  * @constants: store the constants within a chunk
+ * @constantIndex: open-addressed hash set of indices into `constants`
+ * (offset by one so zero marks an empty bucket) used to deduplicate
+ * constants in O(1).
+ * @indexCapacity: number of buckets in `constantIndex`.
+ * @loopCount: number of loops in the chunk.
+ * @loopCapacity: allocated size of `loops`.
+ * @loops: the loops in the chunk, indexed by their `OP_LOOP` operand.
+ * @cacheCount: number of property access sites in the chunk.
+ * @cacheCapacity: allocated size of `caches`.
+ * @caches: inline cache of each property access site.
+ * @stackSize: the most stack slots a frame running the chunk uses,
+ * counting from the frame's first slot. Set by `verifyChunk()`.
+ * @hotness: number of times the VM has entered the chunk with the JIT
+ * on, up to the point it compiled the chunk.
+ * @jit: the chunk compiled to machine code, or NULL.
+ * @aot: the chunk compiled ahead of time to C, or NULL.
+ * @regChunk: the chunk translated for the register VM, made the first
+ * time the register VM runs it, or NULL.
 */
 typedef struct ar
 {
 	int count;
 	int capacity;
 	uint8_t *code;
-	int* lines;
-	// int lcount;
+	int lineCount;
+	int lineCapacity;
+	LineStart* lines;
 	ValueArray constants;
+	int* constantIndex;
+	int indexCapacity;
+	int loopCount;
+	int loopCapacity;
+	Loop* loops;
+	int cacheCount;
+	int cacheCapacity;
+	PropertyCache* caches;
+	int stackSize;
+	#if defined(JIT)
+	int hotness;
+	JitCode* jit;
+	#endif // JIT
+	AotCode aot;
+	RegChunk* regChunk;
 } Chunk;
 
 
 void initChunk(Chunk *chunk);
 void writeChunk(Chunk *chunk, uint8_t byte, int line);
+void truncateChunk(Chunk* chunk, int count);
+int getLine(Chunk* chunk, int offset);
+int instructionLength(Chunk* chunk, int offset);
 int addConstant(Chunk *chunk, Value value);
 int findConstant(Chunk *chunk, Value value);
+int addLoop(Chunk* chunk, int line);
+int addPropertyCache(Chunk* chunk, ObjStringVec* name);
 void freeChunk(Chunk *chunk);
 
 #endif // clox_chunk_h
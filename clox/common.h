@@ -7,8 +7,61 @@
 #include <stdio.h>
 
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT24_MAX ((1 << 24) - 1)
 
+// pack every `Value` into a single 64-bit word using NaN-boxing.
+// Comment out, or compile with -DNO_NAN_BOXING, to fall back to the
+// portable tagged union.
+#if !defined(NO_NAN_BOXING)
+#define NAN_BOXING
+#endif // NO_NAN_BOXING
+
+// compile hot chunks to x86-64 machine code when run with --jit. The
+// generated code works on NaN-boxed values and needs Linux for mmap.
+#if defined(NAN_BOXING) && defined(__x86_64__) && defined(__linux__)
+#define JIT
+#endif // NAN_BOXING && __x86_64__ && __linux__
+
+// dispatch opcodes through a table of label addresses ("computed goto")
+// where the compiler supports it. Otherwise, or when compiled with
+// -DNO_THREADED_DISPATCH, `run()` uses a plain switch.
+#if defined(__GNUC__) && !defined(NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+#endif // __GNUC__ && !NO_THREADED_DISPATCH
+
+// let arithmetic and comparison instructions rewrite themselves into
+// variants specialized for the operand types they see at run time.
+#define QUICKENING
+
+// lay instance fields out in a dense array described by a shape shared
+// between instances that gained the same fields in the same order, and
+// cache the slot of each property access per shape. Comment out to give
+// every instance its own hash table of fields instead.
+#define HIDDEN_CLASSES
+
+// reserve the whole stack limit as address space up front, ending in an
+// inaccessible guard page, so pushes need no bounds check and an overflow
+// faults into a runtime error. Needs POSIX signals and mmap. Otherwise
+// the stack is reallocated as it grows and calls check the limit.
+// #define STACK_GUARD_PAGE
+
+// check every push and pop against the ends of the stack instead of
+// trusting the stack depths worked out by the verifier.
+// #define DEBUG_CHECK_STACK
+
+// count the opcodes `run()` dispatches, and each pair of consecutive
+// ones, for `--stats`. Without it `--stats` does nothing and the
+// interpreter loop carries no trace of the counters.
+// #define OPCODE_STATS
+
+// print the bytecode of each function as it is compiled. Release builds,
+// compiled with -DNDEBUG, leave it out.
+#if !defined(NDEBUG)
 #define DEBUG_PRINT_CODE
+#endif // NDEBUG
 // #define DEBUG_TRACE_EXECUTION
 
+// #define DEBUG_STRESS_GC
+// #define DEBUG_LOG_GC
+
 #endif // clox_common_h
@@ -3,13 +3,19 @@
 
 #include "chunk.h"
 #include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
 #include "scanner.h"
+#include "verifier.h"
 
 #if defined(DEBUG_PRINT_CODE)
 #include "debug.h"
 #endif // DEBUG_PRINT_CODE
 
-
+// longest string the compiler builds out of string literals. Longer
+// concatenations are left to the runtime, which appends in place.
+#define MAX_FOLDED_STRING 1024
 
 typedef struct _parser
 {
@@ -17,6 +23,10 @@ typedef struct _parser
 	bool panicMode;
 	Token current;
 	Token previous;
+	// offset where the left operand of the infix expression begins.
+	int operandStart;
+	// offset of the last call or invocation emitted.
+	int lastCall;
 } Parser;
 
 /**
@@ -58,39 +68,99 @@ typedef struct _rule
  * and the scope depth where it was caputred.
  * @name: Token identifier for the local variable.
  * @depth: The scope depth where the local variable was captured at.
+ * @isCaptured: whether a nested function refers to the variable, in which
+ * case it must be closed over when it goes out of scope. Variables that
+ * are never captured are simply popped and never get an upvalue object.
 */
 typedef struct _local
 {
 	Token name;
 	int depth;
+	bool isCaptured;
 } Local;
 
+/**
+ * struct _upvalue - a variable of an enclosing function that the function
+ * being compiled refers to.
+ * @index: slot of the local in the enclosing function when `isLocal`,
+ * otherwise the index of the enclosing function's own upvalue.
+ * @isLocal: whether the variable is a local of the immediately enclosing
+ * function.
+*/
+typedef struct _upvalue
+{
+	uint8_t index;
+	bool isLocal;
+} Upvalue;
+
+/**
+ * enum functionType - the kinds of code a compiler can be compiling.
+ * @TYPE_FUNCTION: the body of a function declaration.
+ * @TYPE_INITIALIZER: the body of a class's `init` method.
+ * @TYPE_METHOD: the body of any other method.
+ * @TYPE_SCRIPT: the top-level code of a program.
+*/
+typedef enum functionType
+{
+	TYPE_FUNCTION,
+	TYPE_INITIALIZER,
+	TYPE_METHOD,
+	TYPE_SCRIPT
+} FunctionType;
+
 /**
  * struct compiler - state management for local variables and
- * lexical scoping.
+ * lexical scoping. Each function being compiled gets its own, linked to
+ * the compiler of the code surrounding it.
+ * @enclosing: compiler of the surrounding function, or NULL for the
+ * top-level script.
+ * @function: the function being compiled, or NULL for the script.
+ * @chunk: the chunk being written, the function's or the script's.
+ * @type: whether a function or the script is being compiled.
  * @locals: flat array of all the locals in scope during each
  * point of the compilation process. Kept in the order of appearance
  * within the code.
  * @localcount: tracks how many locals are in scope.
+ * @upvalues: the variables of enclosing functions the function refers to.
  * @scopedepth: number of blocks surrounding the current bit of
  * code compiling. 
 */
 typedef struct compiler
 {
+	struct compiler* enclosing;
+	ObjFunction* function;
+	Chunk* chunk;
+	FunctionType type;
 	//insruction operand is only a single byte which limits no. of local
 	// variables that can exits within a scope.
 	Local locals[UINT8_COUNT];
 	int localCount;
+	Upvalue upvalues[UINT8_COUNT];
 	int scopeDepth;
 } Compiler;
 
+/**
+ * struct classCompiler - tracks the class whose body is being compiled,
+ * linked to the class it is nested in.
+ * @enclosing: the class surrounding this one, or NULL.
+ * @hasSuperclass: whether the class inherits from another, making `super`
+ * available to its methods.
+*/
+typedef struct classCompiler
+{
+	struct classCompiler* enclosing;
+	bool hasSuperclass;
+} ClassCompiler;
+
+CompilerOptions compilerOptions = { true, false };
+
 Parser parser;
 Compiler* current = NULL;
-Chunk* compilingChunk;
+ClassCompiler* currentClass = NULL;
 
 static Chunk* currentChunk()
 {
-	return compilingChunk;
+	return current->chunk;
 }
 
 
@@ -221,6 +291,46 @@ static void emitBytes(uint8_t byte1, uint8_t byte2)
 	emitByte(byte2);
 }
 
+/**
+ * emitGlobal - writes an instruction that accesses a global variable
+ * followed by the global's 16-bit slot.
+ * @instruction: opcode.
+ * @slot: slot of the global variable.
+*/
+static void emitGlobal(uint8_t instruction, uint16_t slot)
+{
+	emitByte(instruction);
+	emitByte((slot >> 8) & 0xff);
+	emitByte(slot & 0xff);
+}
+
+/**
+ * emitConstantOperand - emits an instruction followed by the 24-bit index
+ * of a constant.
+ * @instruction: opcode.
+ * @constant: index of the constant.
+*/
+static void emitConstantOperand(uint8_t instruction, int constant)
+{
+	emitByte(instruction);
+	emitByte((constant >> 16) & 0xff);
+	emitByte((constant >> 8) & 0xff);
+	emitByte(constant & 0xff);
+}
+
+/**
+ * emitCache - emits a property access instruction followed by the 16-bit
+ * index of the site's inline cache.
+ * @instruction: opcode.
+ * @cache: index of the cache.
+*/
+static void emitCache(uint8_t instruction, uint16_t cache)
+{
+	emitByte(instruction);
+	emitByte((cache >> 8) & 0xff);
+	emitByte(cache & 0xff);
+}
+
 /**
  * emitJump - emits a bytecode instruction and writes a placeholder value
  * for the jump offset
@@ -236,35 +346,83 @@ static int emitJump(uint8_t instruction)
 	return currentChunk()->count - 2;
 }
 
+/**
+ * emitLoop - emits the backward jump that closes a loop. Besides the
+ * distance back to the loop's header the instruction carries the loop's
+ * index so the VM can count its iterations.
+ * @loopStart: offset of the loop's header.
+ * @loop: index of the loop in the chunk's table of loops.
+*/
+static void emitLoop(int loopStart, int loop)
+{
+	emitByte(OP_LOOP);
+
+	// +4 to adjust for the offset and index operands.
+	int offset = currentChunk()->count - loopStart + 4;
+	if (offset > UINT16_MAX) error("Loop body too large");
+
+	emitByte((offset >> 8) & 0xff);
+	emitByte(offset & 0xff);
+	emitByte((loop >> 8) & 0xff);
+	emitByte(loop & 0xff);
+}
+
+/**
+ * emitReturn - emits the implicit `return nil;` at the end of a function
+ * or script. Initializers return the instance they initialized instead.
+*/
 static void emitReturn()
 {
+	if (current->type == TYPE_INITIALIZER)
+	{
+		emitBytes(OP_GET_LOCAL, 0);
+	} else
+	{
+		emitByte(OP_NIL);
+	}
 	emitByte(OP_RETURN);
 }
 
 /**
  * makeConstant - inserts an entry into the constants table.
  * Ensures that not too many constants are present in the table.
- * This is because the `OP_CONSTANT` instruction uses a single
- * byte for the index operand, thus can store and load only
- * upto 256 constants in a chunk.
+ * Constants are addressed by either the single byte operand of
+ * `OP_CONSTANT` or the three byte operand of `OP_CONSTANT_LONG`, so a
+ * chunk can hold up to 2^24 distinct constants.
  * @value: element to insert into the constants table.
  * Return: index of the element in the constants table.
 */
-static uint8_t makeConstant(Value value)
+static int makeConstant(Value value)
 {
 	int constant = addConstant(currentChunk(), value);
-	if (constant > UINT8_MAX)
+	if (constant > UINT24_MAX)
 	{
 		error("Too many constants in one chunk");
 		return 0;
 	}
-	return (uint8_t)constant;
+	return constant;
 	
 }
 
+/**
+ * emitConstant - emits the instruction that loads a constant, switching
+ * to the wide `OP_CONSTANT_LONG` form once the constant's index no longer
+ * fits in a single byte.
+ * @value: the constant to load.
+*/
 static void emitConstant(Value value)
 {
-	emitBytes(OP_CONSTANT, makeConstant(value));
+	int constant = makeConstant(value);
+	if (constant <= UINT8_MAX)
+	{
+		emitBytes(OP_CONSTANT, (uint8_t)constant);
+		return;
+	}
+
+	emitByte(OP_CONSTANT_LONG);
+	emitByte((constant >> 16) & 0xff);
+	emitByte((constant >> 8) & 0xff);
+	emitByte(constant & 0xff);
 }
 
 /**
@@ -286,23 +444,225 @@ static void patchJump(int offset)
 	currentChunk()->code[offset + 1] = jump & 0xff;
 }
 
-static void initCompiler(Compiler* compiler)
+/**
+ * makeLoop - adds an entry for a loop starting on the previous token's
+ * line to the chunk's table of loops.
+ * Return: index of the loop.
+*/
+static int makeLoop()
 {
+	int loop = addLoop(currentChunk(), parser.previous.line);
+	if (loop > UINT16_MAX)
+	{
+		error("Too many loops in one chunk");
+		return 0;
+	}
+	return loop;
+}
+
+/**
+ * discardCode - throws away the code emitted since the given offset
+ * along with the loops it declared and the inline caches of its property
+ * accesses.
+ * @start: offset of the first instruction to discard.
+ * @loopCount: number of loops the chunk had at that offset.
+ * @cacheCount: number of inline caches the chunk had at that offset.
+*/
+static void discardCode(int start, int loopCount, int cacheCount)
+{
+	truncateChunk(currentChunk(), start);
+	currentChunk()->loopCount = loopCount;
+	currentChunk()->cacheCount = cacheCount;
+}
+
+/**
+ * constantAt - decodes the instruction at the given offset if all it does
+ * is load a constant.
+ * @offset: offset of the instruction in the current chunk.
+ * @value: where to store the value the instruction loads.
+ * Return: length of the instruction, or 0 if it is not a constant load.
+*/
+static int constantAt(int offset, Value* value)
+{
+	Chunk* chunk = currentChunk();
+	if (offset >= chunk->count) return 0;
+
+	uint8_t* code = &chunk->code[offset];
+	switch (code[0])
+	{
+		case OP_NIL: *value = NIL_VAL; return 1;
+		case OP_TRUE: *value = BOOL_VAL(true); return 1;
+		case OP_FALSE: *value = BOOL_VAL(false); return 1;
+		case OP_CONSTANT:
+			*value = chunk->constants.values[code[1]];
+			return 2;
+		case OP_CONSTANT_LONG:
+			*value = chunk->constants.values[
+				(code[1] << 16) | (code[2] << 8) | code[3]];
+			return 4;
+		default: return 0;
+	}
+}
+
+/**
+ * constantExpression - checks whether the code compiled from the given
+ * offset onwards is a single constant load, which makes the expression
+ * it came from a candidate for folding.
+ * @start: offset where the expression's code begins.
+ * @value: where to store the expression's value.
+ * Return: true if the expression is a compile-time constant.
+*/
+static bool constantExpression(int start, Value* value)
+{
+	if (!compilerOptions.optimize) return false;
+
+	int length = constantAt(start, value);
+	return length != 0 && start + length == currentChunk()->count;
+}
+
+/**
+ * emitFolded - replaces the code compiled from the given offset onwards
+ * with an instruction loading the expression's precomputed value.
+ * @start: offset where the expression's code begins.
+ * @value: the value of the expression.
+*/
+static void emitFolded(int start, Value value)
+{
+	truncateChunk(currentChunk(), start);
+	if (IS_NIL(value))
+	{
+		emitByte(OP_NIL);
+	} else if (IS_BOOL(value))
+	{
+		emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+	} else
+	{
+		emitConstant(value);
+	}
+}
+
+static bool isFalseyConstant(Value value)
+{
+	return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
+}
+
+/**
+ * foldBinary - evaluates a binary operator over two constants the same
+ * way the VM would. Operands the VM would reject with a runtime error are
+ * not folded so that the error still happens when the code runs.
+ * @operatorType: the operator's token type.
+ * @a: the left operand.
+ * @b: the right operand.
+ * @result: where to store the result.
+ * Return: true if the expression was folded.
+*/
+static bool foldBinary(TokenType operatorType, Value a, Value b, Value* result)
+{
+	switch (operatorType)
+	{
+		case TOKEN_EQUAL_EQUAL:
+			*result = BOOL_VAL(valuesEqual(a, b));
+			return true;
+		case TOKEN_BANG_EQUAL:
+			*result = BOOL_VAL(!valuesEqual(a, b));
+			return true;
+		case TOKEN_PLUS:
+			if (isObjType(a, OBJ_STRING) && isObjType(b, OBJ_STRING))
+			{
+				if (AS_STRING(a)->length + AS_STRING(b)->length >
+					MAX_FOLDED_STRING)
+				{
+					return false;
+				}
+				*result = OBJ_VAL(takeStringVec(AS_STRING(a), AS_STRING(b)));
+				return true;
+			}
+			break;
+		default:
+			break;
+	}
+
+	if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+
+	double x = AS_NUMBER(a);
+	double y = AS_NUMBER(b);
+	switch (operatorType)
+	{
+		case TOKEN_GREATER: *result = BOOL_VAL(x > y); return true;
+		case TOKEN_GREATER_EQUAL: *result = BOOL_VAL(!(x < y)); return true;
+		case TOKEN_LESS: *result = BOOL_VAL(x < y); return true;
+		case TOKEN_LESS_EQUAL: *result = BOOL_VAL(!(x > y)); return true;
+		case TOKEN_PLUS: *result = NUMBER_VAL(x + y); return true;
+		case TOKEN_MINUS: *result = NUMBER_VAL(x - y); return true;
+		case TOKEN_STAR: *result = NUMBER_VAL(x * y); return true;
+		case TOKEN_SLASH: *result = NUMBER_VAL(x / y); return true;
+		default: return false;
+	}
+}
+
+/**
+ * initCompiler - starts compiling a function or the script. A function's
+ * first local slot holds the function itself while it runs, so it is
+ * claimed with an empty name nothing can refer to. A method's first slot
+ * holds the receiver instead and is named `this`.
+ * @compiler: the compiler to set up and make current.
+ * @type: whether a function or the script is being compiled.
+ * @chunk: the chunk to write the script to. Functions get their own.
+*/
+static void initCompiler(Compiler* compiler, FunctionType type, Chunk* chunk)
+{
+	compiler->enclosing = current;
+	compiler->function = NULL;
+	compiler->chunk = chunk;
+	compiler->type = type;
 	compiler->localCount = 0;
 	compiler->scopeDepth = 0;
 	current = compiler;
+	if (type == TYPE_SCRIPT) return;
+
+	compiler->function = newFunction();
+	compiler->chunk = &compiler->function->chunk;
+	compiler->function->name = copyStringVec(parser.previous.start,
+											 parser.previous.length);
+
+	Local* local = &compiler->locals[compiler->localCount++];
+	local->depth = 0;
+	local->isCaptured = false;
+	if (type == TYPE_FUNCTION)
+	{
+		local->name.start = "";
+		local->name.length = 0;
+	} else
+	{
+		local->name.start = "this";
+		local->name.length = 4;
+	}
 }
 
-static void endCompiler()
+/**
+ * endCompiler - finishes the function or script being compiled and goes
+ * back to compiling the code around it.
+ * Return: the finished function, or NULL for the script.
+*/
+static ObjFunction* endCompiler()
 {
 	emitReturn();
+	ObjFunction* function = current->function;
+	if (compilerOptions.optimize && !parser.hadError)
+	{
+		optimizeChunk(currentChunk(), compilerOptions.optimizerReport);
+	}
+
 	#if defined(DEBUG_PRINT_CODE)
 	if (!parser.hadError)
 	{
-		disassembleChunk(currentChunk(), "code");
+		disassembleChunk(currentChunk(),
+						 function != NULL ? function->name->chars : "code");
 	}
 	#endif // DEBUG_PRINT_CODE
-	
+
+	current = current->enclosing;
+	return function;
 }
 
 static void beginScope()
@@ -317,7 +677,13 @@ static void endScope()
 		   current->locals[current->localCount -1].depth > 
 		   		current->scopeDepth)
 	{
-		emitByte(OP_POP);
+		if (current->locals[current->localCount - 1].isCaptured)
+		{
+			emitByte(OP_CLOSE_UPVALUE);
+		} else
+		{
+			emitByte(OP_POP);
+		}
 		current->localCount--;
 	}
 	
@@ -330,21 +696,41 @@ static ParseRule* getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
 
 /**
- * identifierConstant - takes a token and adds its lexeme to the chunk's
- * constant table as a string, returning the index of that constant in
- * the constant's table.
+ * identifierGlobal - resolves a global variable's name to its slot in the
+ * VM's flat array of global values, so that the generated code can load
+ * and store the global with a single indexed access instead of a hash
+ * table lookup.
  * @name: pointer to the token.
- * @Return: index of the token lexeme within the constant's table.
+ * @Return: slot of the global variable.
+*/
+static uint16_t identifierGlobal(Token* name)
+{
+	int slot = globalSlot(copyStringVec(name->start, name->length));
+	if (slot > UINT16_MAX)
+	{
+		error("Too many global variables");
+		return 0;
+	}
+	return (uint16_t)slot;
+}
+
+/**
+ * makePropertyCache - gives a property access site its own inline cache.
+ * The name also goes into the constants to keep it alive.
+ * @name: pointer to the property name's token.
+ * Return: index of the cache.
 */
-static uint8_t identifierConstant(Token* name)
+static uint16_t makePropertyCache(Token* name)
 {
-	Value strObject = OBJ_VAL(copyStringVec(name->start, name->length));
-	int index = findConstant(currentChunk(), strObject);
-	if (index == -1)
+	ObjStringVec* string = copyStringVec(name->start, name->length);
+	makeConstant(OBJ_VAL(string));
+	int cache = addPropertyCache(currentChunk(), string);
+	if (cache > UINT16_MAX)
 	{
-		return makeConstant(strObject);
+		error("Too many property accesses in one chunk");
+		return 0;
 	}
-	return (uint8_t)index;
+	return (uint16_t)cache;
 }
 
 static bool identifiersEqual(Token* a, Token* b)
@@ -372,6 +758,63 @@ static int resolveLocal(Compiler* compiler, Token* name)
 	
 }
 
+/**
+ * addUpvalue - records that the function refers to a variable of an
+ * enclosing function, reusing the entry if it already does.
+ * @compiler: compiler of the function.
+ * @index: slot or upvalue index of the variable in the enclosing function.
+ * @isLocal: whether the variable is a local of the enclosing function.
+ * Return: index of the upvalue.
+*/
+static int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal)
+{
+	int upvalueCount = compiler->function->upvalueCount;
+	for (int i = 0; i < upvalueCount; i++)
+	{
+		Upvalue* upvalue = &compiler->upvalues[i];
+		if (upvalue->index == index && upvalue->isLocal == isLocal) return i;
+	}
+
+	if (upvalueCount == UINT8_COUNT)
+	{
+		error("Too many closure variables in function");
+		return 0;
+	}
+
+	compiler->upvalues[upvalueCount].isLocal = isLocal;
+	compiler->upvalues[upvalueCount].index = index;
+	return compiler->function->upvalueCount++;
+}
+
+/**
+ * resolveUpvalue - looks for a variable in the functions enclosing the
+ * given one. A local found in the immediately enclosing function is
+ * marked as captured; one found further out is threaded through an
+ * upvalue of every function in between.
+ * @compiler: compiler of the function referring to the variable.
+ * @name: name of the variable.
+ * Return: index of the upvalue, or -1 if no enclosing function has a
+ * local with that name.
+*/
+static int resolveUpvalue(Compiler* compiler, Token* name)
+{
+	if (compiler->enclosing == NULL) return -1;
+
+	int local = resolveLocal(compiler->enclosing, name);
+	if (local != -1)
+	{
+		compiler->enclosing->locals[local].isCaptured = true;
+		return addUpvalue(compiler, (uint8_t)local, true);
+	}
+
+	int upvalue = resolveUpvalue(compiler->enclosing, name);
+	if (upvalue != -1)
+	{
+		return addUpvalue(compiler, (uint8_t)upvalue, false);
+	}
+	return -1;
+}
+
 static void addLocal(Token name)
 {
 	if (current->localCount == UINT8_COUNT)
@@ -383,6 +826,7 @@ static void addLocal(Token name)
 	Local* local = &current->locals[current->localCount++];
 	local->name = name;
 	local->depth = -1;
+	local->isCaptured = false;
 }
 
 /**
@@ -410,28 +854,29 @@ static void declareVariable()
 	addLocal(*name);
 }
 
-static uint8_t parseVariable(const char* errorMessage)
+static uint16_t parseVariable(const char* errorMessage)
 {
 	consume(TOKEN_IDENTIFIER, errorMessage);
 	declareVariable();
 	//return a dummy table index if within a local scope.
 	if (current->scopeDepth > 0) return 0;
 
-	return identifierConstant(&parser.previous);
+	return identifierGlobal(&parser.previous);
 }
 
 static void markInitialized(){
+	if (current->scopeDepth == 0) return;
 	current->locals[current->localCount - 1].depth = current->scopeDepth;
 }
 
 /**
  * defineVariable - outputs the bytecode instruction defining the new
- * variable and stores its initial value. The index of the varible's name
- * in the constants table is the instruction's operand.
- * @global: index of the variable within the constants table.
+ * variable and stores its initial value. The global's slot is the
+ * instruction's operand.
+ * @global: slot of the global variable.
  * @Return: void.
 */
-static void defineVariable(uint8_t global)
+static void defineVariable(uint16_t global)
 {
 	if (current->scopeDepth > 0)
 	{
@@ -439,7 +884,7 @@ static void defineVariable(uint8_t global)
 		return;
 	}
 	
-	emitBytes(OP_DEFINE_GLOBAL, global);
+	emitGlobal(OP_DEFINE_GLOBAL, global);
 }
 
 /**
@@ -447,13 +892,26 @@ static void defineVariable(uint8_t global)
  * `TOKEN_MINUS`, `TOKEN_STAR` and `TOKEN_SLASH` token types.
  * It takes into consideration when parsing the right operand
  * has a precedence level one higher than the binary operator.
+ * When both operands are constants the operation is folded into a
+ * single constant load.
 */
 static void binary(bool canAssign)
 {
 	TokenType operatorType = parser.previous.type;
 	ParseRule* rule = getRule(operatorType);
+	int leftStart = parser.operandStart;
+	int rightStart = currentChunk()->count;
 	parsePrecedence((Precedence)rule->precedence + 1);
 
+	Value left, right, result;
+	if (constantExpression(rightStart, &right) &&
+		constantAt(leftStart, &left) == rightStart - leftStart &&
+		foldBinary(operatorType, left, right, &result))
+	{
+		emitFolded(leftStart, result);
+		return;
+	}
+
 	switch (operatorType)
 	{
 		case TOKEN_BANG_EQUAL: emitBytes(OP_EQUAL, OP_NOT); break;
@@ -481,6 +939,100 @@ static void literal(bool canAssign)
 	}
 }
 
+/**
+ * argumentList - compiles the comma-separated arguments of a call, which
+ * are left on the stack in order.
+ * Return: the number of arguments.
+*/
+static uint8_t argumentList()
+{
+	uint8_t argCount = 0;
+	if (!check(TOKEN_RIGHT_PAREN))
+	{
+		do
+		{
+			expression();
+			if (argCount == 255)
+			{
+				error("Can't have more than 255 arguments");
+			}
+			argCount++;
+		} while (match(TOKEN_COMMA));
+	}
+	consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments");
+	return argCount;
+}
+
+/**
+ * call - the infix parser for `(`. The callee is already on the stack
+ * and the arguments go on top of it.
+*/
+static void call(bool canAssign)
+{
+	uint8_t argCount = argumentList();
+	parser.lastCall = currentChunk()->count;
+	emitBytes(OP_CALL, argCount);
+}
+
+/**
+ * dot - the infix parser for `.`, which reads or, when followed by `=`,
+ * assigns a property of the instance on the stack. A property that is
+ * called straight away compiles to a single `OP_INVOKE`, which calls the
+ * method without creating a bound method for it.
+*/
+static void dot(bool canAssign)
+{
+	consume(TOKEN_IDENTIFIER, "Expect property name after '.'");
+	uint16_t cache = makePropertyCache(&parser.previous);
+
+	if (canAssign && match(TOKEN_EQUAL))
+	{
+		expression();
+		emitCache(OP_SET_PROPERTY, cache);
+	} else if (match(TOKEN_LEFT_PAREN))
+	{
+		uint8_t argCount = argumentList();
+		parser.lastCall = currentChunk()->count;
+		emitCache(OP_INVOKE, cache);
+		emitByte(argCount);
+	} else
+	{
+		emitCache(OP_GET_PROPERTY, cache);
+	}
+}
+
+/**
+ * and_ - compiles the right operand of `and` only for when the left one,
+ * already on the stack, is truthy. A falsey left operand is left as the
+ * value of the whole expression.
+*/
+static void and_(bool canAssign)
+{
+	int endJump = emitJump(OP_JUMP_IF_FALSE);
+
+	emitByte(OP_POP);
+	parsePrecedence(PREC_AND);
+
+	patchJump(endJump);
+}
+
+/**
+ * or_ - compiles the right operand of `or` only for when the left one,
+ * already on the stack, is falsey. A truthy left operand is left as the
+ * value of the whole expression.
+*/
+static void or_(bool canAssign)
+{
+	int elseJump = emitJump(OP_JUMP_IF_FALSE);
+	int endJump = emitJump(OP_JUMP);
+
+	patchJump(elseJump);
+	emitByte(OP_POP);
+
+	parsePrecedence(PREC_OR);
+	patchJump(endJump);
+}
+
 /**
  * grouping - assumes that the initial '(' has already been consumed
  * and recursively calls back into `expression` to compile the
@@ -511,26 +1063,42 @@ static void string(bool canAssign)
 }
 
 static void namedVariable(Token name, bool canAssign){
-	uint8_t getOp, setOp;
 	int arg = resolveLocal(current, &name);
 	if (arg != -1)
 	{
-		getOp = OP_GET_LOCAL;
-		setOp = OP_SET_LOCAL;
-	} else
+		if (canAssign && match(TOKEN_EQUAL))
+		{
+			expression();
+			emitBytes(OP_SET_LOCAL, (uint8_t)arg);
+		} else
+		{
+			emitBytes(OP_GET_LOCAL, (uint8_t)arg);
+		}
+		return;
+	}
+
+	arg = resolveUpvalue(current, &name);
+	if (arg != -1)
 	{
-		arg = identifierConstant(&name);
-		getOp = OP_GET_GLOBAL;
-		setOp = OP_SET_GLOBAL;
+		if (canAssign && match(TOKEN_EQUAL))
+		{
+			expression();
+			emitBytes(OP_SET_UPVALUE, (uint8_t)arg);
+		} else
+		{
+			emitBytes(OP_GET_UPVALUE, (uint8_t)arg);
+		}
+		return;
 	}
-	
+
+	uint16_t global = identifierGlobal(&name);
 	if (canAssign && match(TOKEN_EQUAL))
 	{
 		expression();
-		emitBytes(setOp, (uint8_t)arg);
+		emitGlobal(OP_SET_GLOBAL, global);
 	} else
 	{
-		emitBytes(getOp, (uint8_t)arg);
+		emitGlobal(OP_GET_GLOBAL, global);
 	}
 	
 }
@@ -540,18 +1108,95 @@ static void variable(bool canAssign)
 	namedVariable(parser.previous, canAssign);
 }
 
+/**
+ * syntheticToken - makes an identifier token for a name that does not
+ * appear in the source, such as the hidden `super` local.
+ * @text: the name.
+ * Return: the token.
+*/
+static Token syntheticToken(const char* text)
+{
+	Token token;
+	token.start = text;
+	token.length = (int)strlen(text);
+	return token;
+}
+
+/**
+ * super_ - compiles `super.name`, looking the method up in the superclass
+ * of the class the enclosing method belongs to. A call of it compiles to
+ * `OP_SUPER_INVOKE`, which does not create a bound method either.
+*/
+static void super_(bool canAssign)
+{
+	if (currentClass == NULL)
+	{
+		error("Can't use 'super' outside of a class");
+	} else if (!currentClass->hasSuperclass)
+	{
+		error("Can't use 'super' in a class with no superclass");
+	}
+
+	consume(TOKEN_DOT, "Expect '.' after 'super'");
+	consume(TOKEN_IDENTIFIER, "Expect superclass method name");
+	uint16_t cache = makePropertyCache(&parser.previous);
+
+	namedVariable(syntheticToken("this"), false);
+	if (match(TOKEN_LEFT_PAREN))
+	{
+		uint8_t argCount = argumentList();
+		namedVariable(syntheticToken("super"), false);
+		emitCache(OP_SUPER_INVOKE, cache);
+		emitByte(argCount);
+	} else
+	{
+		namedVariable(syntheticToken("super"), false);
+		emitCache(OP_GET_SUPER, cache);
+	}
+}
+
+/**
+ * this_ - compiles `this` as a read of the method's receiver, which lives
+ * in the local slot named `this`.
+*/
+static void this_(bool canAssign)
+{
+	if (currentClass == NULL)
+	{
+		error("Can't use 'this' outside of a class");
+		return;
+	}
+	variable(false);
+}
+
 /**
  * unary - obtains the unary operator and utilises
  * the `PREC_UNARY` precedence level to permit nested
  * unary expressions to compile the operand and emits the bytecode
- * to perform the negation
+ * to perform the negation. A constant operand is folded.
 */
 static void unary(bool canAssign)
 {
 	TokenType operatorType = parser.previous.type;
+	int start = currentChunk()->count;
 
 	parsePrecedence(PREC_UNARY);
 
+	Value operand;
+	if (constantExpression(start, &operand))
+	{
+		if (operatorType == TOKEN_BANG)
+		{
+			emitFolded(start, BOOL_VAL(isFalseyConstant(operand)));
+			return;
+		}
+		if (operatorType == TOKEN_MINUS && IS_NUMBER(operand))
+		{
+			emitFolded(start, NUMBER_VAL(-AS_NUMBER(operand)));
+			return;
+		}
+	}
+
 	switch (operatorType)
 	{
 		case TOKEN_MINUS: emitByte(OP_NEGATE); break;
@@ -561,12 +1206,12 @@ static void unary(bool canAssign)
 }
 
 ParseRule rules[] = {
-	[TOKEN_LEFT_PAREN] 		= {grouping, NULL, PREC_NONE},
+	[TOKEN_LEFT_PAREN] 		= {grouping, call, PREC_CALL},
 	[TOKEN_RIGHT_PAREN] 	= {NULL, NULL, PREC_NONE},
 	[TOKEN_LEFT_BRACE] 		= {NULL, NULL, PREC_NONE},
 	[TOKEN_RIGHT_BRACE] 	= {NULL, NULL, PREC_NONE},
 	[TOKEN_COMMA] 			= {NULL, NULL, PREC_NONE},
-	[TOKEN_DOT] 			= {NULL, NULL, PREC_NONE},
+	[TOKEN_DOT] 			= {NULL, dot, PREC_CALL},
 	[TOKEN_MINUS] 			= {unary, binary, PREC_TERM},
 	[TOKEN_PLUS] 			= {NULL, binary, PREC_TERM},
 	[TOKEN_SEMICOLON] 		= {NULL, NULL, PREC_NONE},
@@ -583,7 +1228,7 @@ ParseRule rules[] = {
 	[TOKEN_IDENTIFIER] 		= {variable, NULL, PREC_NONE},
 	[TOKEN_STRING] 			= {string, NULL, PREC_NONE},
 	[TOKEN_NUMBER] 			= {number, NULL, PREC_NONE},
-	[TOKEN_AND] 			= {NULL, NULL, PREC_NONE},
+	[TOKEN_AND] 			= {NULL, and_, PREC_AND},
 	[TOKEN_CLASS] 			= {NULL, NULL, PREC_NONE},
 	[TOKEN_ELSE] 			= {NULL, NULL, PREC_NONE},
 	[TOKEN_FALSE] 			= {literal, NULL, PREC_NONE},
@@ -591,11 +1236,11 @@ ParseRule rules[] = {
 	[TOKEN_FUN] 			= {NULL, NULL, PREC_NONE},
 	[TOKEN_IF] 				= {NULL, NULL, PREC_NONE},
 	[TOKEN_NIL] 			= {literal, NULL, PREC_NONE},
-	[TOKEN_OR] 				= {NULL, NULL, PREC_NONE},
+	[TOKEN_OR] 				= {NULL, or_, PREC_OR},
 	[TOKEN_PRINT] 			= {NULL, NULL, PREC_NONE},
 	[TOKEN_RETURN] 			= {NULL, NULL, PREC_NONE},
-	[TOKEN_SUPER] 			= {NULL, NULL, PREC_NONE},
-	[TOKEN_THIS] 			= {NULL, NULL, PREC_NONE},
+	[TOKEN_SUPER] 			= {super_, NULL, PREC_NONE},
+	[TOKEN_THIS] 			= {this_, NULL, PREC_NONE},
 	[TOKEN_TRUE] 			= {literal, NULL, PREC_NONE},
 	[TOKEN_VAR] 			= {NULL, NULL, PREC_NONE},
 	[TOKEN_WHILE] 			= {NULL, NULL, PREC_NONE},
@@ -617,18 +1262,20 @@ static void parsePrecedence(Precedence precedence)
 		return;
 	}
 	bool canAssign = precedence <= PREC_ASSIGNMENT;
+	int start = currentChunk()->count;
 	prefixRule(canAssign);
 
 	while (precedence <= getRule(parser.current.type)->precedence)
 	{
 		advance();
 		ParseFn infixRule = getRule(parser.previous.type)->infix;
+		parser.operandStart = start;
 		infixRule(canAssign);
 	}
 
 	if (canAssign && match(TOKEN_EQUAL))
 	{
-		error("Invalid assignment target.");
+		error("Invalid assignment target");
 	}
 	
 }
@@ -667,6 +1314,141 @@ static void block()
 	consume(TOKEN_RIGHT_BRACE, "Expect '}' after a block");
 }
 
+/**
+ * function - compiles a function's parameters and body into a new
+ * function object with its own compiler, then emits the instruction that
+ * loads the finished function. Only a function that captures variables
+ * needs a closure built around it at runtime, followed by a pair of
+ * operands per captured variable: whether it is a local of this function
+ * and its slot or upvalue index. Any other function is a plain constant
+ * and loading it allocates nothing.
+ * @type: the kind of function.
+*/
+static void function(FunctionType type)
+{
+	Compiler compiler;
+	initCompiler(&compiler, type, NULL);
+	// the body's locals are discarded with the frame, no scope end needed.
+	beginScope();
+
+	consume(TOKEN_LEFT_PAREN, "Expect '(' after function name");
+	if (!check(TOKEN_RIGHT_PAREN))
+	{
+		do
+		{
+			current->function->arity++;
+			if (current->function->arity > 255)
+			{
+				errorAtCurrent("Can't have more than 255 parameters");
+			}
+			uint16_t constant = parseVariable("Expect parameter name");
+			defineVariable(constant);
+		} while (match(TOKEN_COMMA));
+	}
+	consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters");
+	consume(TOKEN_LEFT_BRACE, "Expect '{' before function body");
+	block();
+
+	ObjFunction* function = endCompiler();
+	if (function->upvalueCount == 0)
+	{
+		emitConstant(OBJ_VAL(function));
+		return;
+	}
+
+	emitConstantOperand(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+	for (int i = 0; i < function->upvalueCount; i++)
+	{
+		emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
+		emitByte(compiler.upvalues[i].index);
+	}
+}
+
+/**
+ * method - compiles a method and emits the instruction that adds it to
+ * the class below it on the stack.
+*/
+static void method()
+{
+	consume(TOKEN_IDENTIFIER, "Expect method name");
+	int constant = makeConstant(
+		OBJ_VAL(copyStringVec(parser.previous.start, parser.previous.length)));
+
+	FunctionType type = TYPE_METHOD;
+	if (parser.previous.length == 4 &&
+		memcmp(parser.previous.start, "init", 4) == 0)
+	{
+		type = TYPE_INITIALIZER;
+	}
+	function(type);
+	emitConstantOperand(OP_METHOD, constant);
+}
+
+/**
+ * classDeclaration - compiles a class declaration, which creates the
+ * class and binds it to a variable, copies down the methods of its
+ * superclass if it has one and then adds its own methods. The superclass
+ * is kept in a hidden local named `super` for the methods to capture.
+*/
+static void classDeclaration()
+{
+	uint16_t global = parseVariable("Expect class name");
+	Token className = parser.previous;
+	int nameConstant = makeConstant(
+		OBJ_VAL(copyStringVec(className.start, className.length)));
+
+	emitConstantOperand(OP_CLASS, nameConstant);
+	defineVariable(global);
+
+	ClassCompiler classCompiler;
+	classCompiler.hasSuperclass = false;
+	classCompiler.enclosing = currentClass;
+	currentClass = &classCompiler;
+
+	if (match(TOKEN_LESS))
+	{
+		consume(TOKEN_IDENTIFIER, "Expect superclass name");
+		variable(false);
+
+		if (identifiersEqual(&className, &parser.previous))
+		{
+			error("A class can't inherit from itself");
+		}
+
+		beginScope();
+		addLocal(syntheticToken("super"));
+		defineVariable(0);
+
+		namedVariable(className, false);
+		emitByte(OP_INHERIT);
+		classCompiler.hasSuperclass = true;
+	}
+
+	namedVariable(className, false);
+	consume(TOKEN_LEFT_BRACE, "Expect '{' before class body");
+	while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF))
+	{
+		method();
+	}
+	consume(TOKEN_RIGHT_BRACE, "Expect '}' after class body");
+	emitByte(OP_POP);
+
+	if (classCompiler.hasSuperclass) endScope();
+	currentClass = currentClass->enclosing;
+}
+
+/**
+ * funDeclaration - compiles a function declaration. The name is usable
+ * within the body straight away so that the function can call itself.
+*/
+static void funDeclaration()
+{
+	uint16_t global = parseVariable("Expect function name");
+	markInitialized();
+	function(TYPE_FUNCTION);
+	defineVariable(global);
+}
+
 /**
  * varDeclaration - parses the statement with the following syntax:
  * `var <variable_name> = <optional_initializer expression>;`. If the
@@ -675,7 +1457,7 @@ static void block()
 */
 static void varDeclaration()
 {
-	uint8_t global = parseVariable("Expect variable name");
+	uint16_t global = parseVariable("Expect variable name");
 
 	if (match(TOKEN_EQUAL))
 	{
@@ -702,14 +1484,42 @@ static void expressionStatement()
 }
 
 /**
- * ifStatement - compiles the if statement.
+ * branch - compiles one branch of an if statement whose condition is
+ * known at compile time. A branch that can never run is still parsed
+ * for errors but its code is thrown away.
+ * @live: whether the branch runs.
+*/
+static void branch(bool live)
+{
+	int start = currentChunk()->count;
+	int loopCount = currentChunk()->loopCount;
+	int cacheCount = currentChunk()->cacheCount;
+	statement();
+	if (!live) discardCode(start, loopCount, cacheCount);
+}
+
+/**
+ * ifStatement - compiles the if statement. When the condition is a
+ * constant neither the condition nor the jumps are emitted, only the
+ * branch that runs.
 */
 static void ifStatement()
 {
 	consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+	int conditionStart = currentChunk()->count;
 	expression();
 	consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+	Value condition;
+	if (constantExpression(conditionStart, &condition))
+	{
+		bool taken = !isFalseyConstant(condition);
+		truncateChunk(currentChunk(), conditionStart);
+		branch(taken);
+		if (match(TOKEN_ELSE)) branch(!taken);
+		return;
+	}
+
 	int thenJump = emitJump(OP_JUMP_IF_FALSE);
 	emitByte(OP_POP);
 	statement();
@@ -721,6 +1531,189 @@ static void ifStatement()
 	patchJump(elseJump);
 }
 
+/**
+ * tailCall - turns a call that ends the expression of a `return` into a
+ * tail call, which hands the function's frame and stack window over to
+ * the callee so that recursion in tail position runs in constant space.
+ * Calls in tail position of an `and` or `or` operand qualify as well: a
+ * jump skipping the call lands on the `OP_RETURN` that still follows it.
+*/
+static void tailCall()
+{
+	Chunk* chunk = currentChunk();
+	int call = parser.lastCall;
+	if (call == -1 || call + instructionLength(chunk, call) != chunk->count)
+	{
+		return;
+	}
+
+	if (chunk->code[call] == OP_CALL)
+	{
+		chunk->code[call] = OP_TAIL_CALL;
+	} else if (chunk->code[call] == OP_INVOKE)
+	{
+		chunk->code[call] = OP_TAIL_INVOKE;
+	}
+}
+
+/**
+ * returnStatement - compiles a return, with `nil` as the value when none
+ * is given.
+*/
+static void returnStatement()
+{
+	if (current->type == TYPE_SCRIPT)
+	{
+		error("Can't return from top-level code");
+	}
+
+	if (match(TOKEN_SEMICOLON))
+	{
+		emitReturn();
+	} else
+	{
+		if (current->type == TYPE_INITIALIZER)
+		{
+			error("Can't return a value from an initializer");
+		}
+		parser.lastCall = -1;
+		expression();
+		consume(TOKEN_SEMICOLON, "Expect ';' after return value");
+		tailCall();
+		emitByte(OP_RETURN);
+	}
+}
+
+/**
+ * whileStatement - compiles the while loop. A constant condition is not
+ * emitted: a loop that never runs is thrown away, and one that always
+ * runs needs no exit jump.
+*/
+static void whileStatement()
+{
+	int loopStart = currentChunk()->count;
+	int loopCount = currentChunk()->loopCount;
+	int cacheCount = currentChunk()->cacheCount;
+	int loop = makeLoop();
+
+	consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'");
+	expression();
+	consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
+
+	Value condition;
+	if (constantExpression(loopStart, &condition))
+	{
+		truncateChunk(currentChunk(), loopStart);
+		statement();
+		if (isFalseyConstant(condition))
+		{
+			discardCode(loopStart, loopCount, cacheCount);
+			return;
+		}
+		emitLoop(loopStart, loop);
+		return;
+	}
+
+	int exitJump = emitJump(OP_JUMP_IF_FALSE);
+	emitByte(OP_POP);
+	statement();
+	emitLoop(loopStart, loop);
+
+	patchJump(exitJump);
+	emitByte(OP_POP);
+}
+
+/**
+ * forStatement - compiles the for loop. The increment clause is parsed
+ * before the body but its code is moved after it, so each iteration
+ * takes a single backward jump:
+ * 		`initializer; start: condition; exit-jump; body; increment;
+ * 		loop-to-start; exit:`
+ * Jumps within the increment are relative and all land inside it, so the
+ * moved code needs no patching.
+*/
+static void forStatement()
+{
+	beginScope();
+	consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'");
+	if (match(TOKEN_SEMICOLON))
+	{
+		// no initializer.
+	} else if (match(TOKEN_VAR))
+	{
+		varDeclaration();
+	} else
+	{
+		expressionStatement();
+	}
+
+	int loopStart = currentChunk()->count;
+	int loopCount = currentChunk()->loopCount;
+	int cacheCount = currentChunk()->cacheCount;
+	int loop = makeLoop();
+	int exitJump = -1;
+	bool live = true;
+
+	if (!match(TOKEN_SEMICOLON))
+	{
+		expression();
+		consume(TOKEN_SEMICOLON, "Expect ';' after loop condition");
+
+		Value condition;
+		if (constantExpression(loopStart, &condition))
+		{
+			truncateChunk(currentChunk(), loopStart);
+			live = !isFalseyConstant(condition);
+		} else
+		{
+			exitJump = emitJump(OP_JUMP_IF_FALSE);
+			emitByte(OP_POP);
+		}
+	}
+
+	Chunk increment;
+	initChunk(&increment);
+	if (!match(TOKEN_RIGHT_PAREN))
+	{
+		int incrementStart = currentChunk()->count;
+		expression();
+		emitByte(OP_POP);
+		consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses");
+
+		Chunk* chunk = currentChunk();
+		for (int offset = incrementStart; offset < chunk->count; offset++)
+		{
+			writeChunk(&increment, chunk->code[offset], getLine(chunk, offset));
+		}
+		// the code is moved, not dropped, so its inline caches stay.
+		truncateChunk(chunk, incrementStart);
+	}
+
+	statement();
+	for (int offset = 0; offset < increment.count; offset++)
+	{
+		writeChunk(
+			currentChunk(), increment.code[offset], getLine(&increment, offset)
+		);
+	}
+	freeChunk(&increment);
+
+	if (!live)
+	{
+		discardCode(loopStart, loopCount, cacheCount);
+	} else
+	{
+		emitLoop(loopStart, loop);
+	}
+
+	if (exitJump != -1)
+	{
+		patchJump(exitJump);
+		emitByte(OP_POP);
+	}
+	endScope();
+}
+
 /**
  * printStatement - evaluates an expression and emits print instruction.
 */
@@ -768,7 +1761,13 @@ static void synchronize()
 */
 static void declaration()
 {
-	if (match(TOKEN_VAR))
+	if (match(TOKEN_CLASS))
+	{
+		classDeclaration();
+	} else if (match(TOKEN_FUN))
+	{
+		funDeclaration();
+	} else if (match(TOKEN_VAR))
 	{
 		varDeclaration();
 	} else
@@ -803,6 +1802,15 @@ static void statement()
 	} else if (match(TOKEN_IF))
 	{
 		ifStatement();
+	} else if (match(TOKEN_RETURN))
+	{
+		returnStatement();
+	} else if (match(TOKEN_WHILE))
+	{
+		whileStatement();
+	} else if (match(TOKEN_FOR))
+	{
+		forStatement();
 	} else if (match(TOKEN_LEFT_BRACE))
 	{
 		beginScope();
@@ -818,8 +1826,7 @@ bool compile(const char* source, Chunk* chunk)
 {
 	initScanner(source);
 	Compiler compiler;
-	initCompiler(&compiler);
-	compilingChunk = chunk;
+	initCompiler(&compiler, TYPE_SCRIPT, chunk);
 
 	parser.hadError = false;
 	parser.panicMode = false;
@@ -832,5 +1839,31 @@ bool compile(const char* source, Chunk* chunk)
 	}
 	
 	endCompiler();
-	return !parser.hadError;
-}
\ No newline at end of file
+	// code that compiled cleanly but fails to verify is a compiler bug.
+	return !parser.hadError && verifyChunk(chunk);
+}
+
+/**
+ * markCompilerRoots - marks the functions being compiled and the
+ * constants of the script being compiled. The compiler allocates objects
+ * while they are still being built so they are not yet reachable from
+ * anything the VM knows about.
+*/
+void markCompilerRoots()
+{
+	for (Compiler* compiler = current; compiler != NULL;
+		 compiler = compiler->enclosing)
+	{
+		if (compiler->function != NULL)
+		{
+			markObject((Obj*)compiler->function);
+		} else if (compiler->chunk != NULL)
+		{
+			ValueArray* constants = &compiler->chunk->constants;
+			for (int i = 0; i < constants->count; i++)
+			{
+				markValue(constants->values[i]);
+			}
+		}
+	}
+}
@@ -4,6 +4,20 @@
 #include "object.h"
 #include "vm.h"
 
+/**
+ * struct compilerOptions - switches that control code generation.
+ * @optimize: run the peephole optimizer over every finished chunk.
+ * @optimizerReport: print the opcode counts before and after optimizing.
+*/
+typedef struct compilerOptions
+{
+	bool optimize;
+	bool optimizerReport;
+} CompilerOptions;
+
+extern CompilerOptions compilerOptions;
+
 bool compile(const char* source, Chunk* chunk);
+void markCompilerRoots();
 
 #endif // clox_compiler_h
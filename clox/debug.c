@@ -1,7 +1,10 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "debug.h"
+#include "object.h"
 #include "value.h"
+#include "vm.h"
 
 /**
  * simpleInstruction - simple utility function that displays an instruction.
@@ -30,6 +33,104 @@ static int jumpInstruction(const char* name, int sign, Chunk* chunk, int offset)
 	return offset + 3;
 }
 
+/**
+ * loopInstruction - prints a loop's backward jump along with the index of
+ * the loop whose iterations it counts.
+ * @chunk: pointer to the dynamic array defining a chunk of bytecode.
+ * @offset: current position of the instruction in the bytecode chunk.
+ * Return: The position of the next instruction in the chunk.
+*/
+static int loopInstruction(Chunk* chunk, int offset)
+{
+	uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+	jump |= chunk->code[offset + 2];
+	uint16_t loop = (uint16_t)(chunk->code[offset + 3] << 8);
+	loop |= chunk->code[offset + 4];
+	printf("%-16s %4d -> %d (loop %d)\n", "OP_LOOP", offset,
+		   offset + 5 - jump, loop);
+	return offset + 5;
+}
+
+/**
+ * propertyInstruction - prints a property access along with the index of
+ * its inline cache and the name of the property.
+ * @name: Name of the opcode.
+ * @chunk: pointer to the dynamic array defining a chunk of bytecode.
+ * @offset: current position of the instruction in the bytecode chunk.
+ * Return: The position of the next instruction in the chunk.
+*/
+static int propertyInstruction(const char* name, Chunk* chunk, int offset)
+{
+	uint16_t cache = (uint16_t)((chunk->code[offset + 1] << 8) |
+								chunk->code[offset + 2]);
+	printf("%-16s %4d '%s'\n", name, cache, chunk->caches[cache].name->chars);
+	return offset + 3;
+}
+
+/**
+ * invokeInstruction - prints a method invocation along with the index of
+ * its inline cache, the name of the method and the number of arguments.
+ * @name: Name of the opcode.
+ * @chunk: pointer to the dynamic array defining a chunk of bytecode.
+ * @offset: current position of the instruction in the bytecode chunk.
+ * Return: The position of the next instruction in the chunk.
+*/
+static int invokeInstruction(const char* name, Chunk* chunk, int offset)
+{
+	uint16_t cache = (uint16_t)((chunk->code[offset + 1] << 8) |
+								chunk->code[offset + 2]);
+	uint8_t argCount = chunk->code[offset + 3];
+	printf("%-16s (%d args) %4d '%s'\n", name, argCount, cache,
+		   chunk->caches[cache].name->chars);
+	return offset + 4;
+}
+
+/**
+ * closureInstruction - prints the function a closure is built around
+ * followed by a line for each variable it captures.
+ * @chunk: pointer to the dynamic array defining a chunk of bytecode.
+ * @offset: current position of the instruction in the bytecode chunk.
+ * Return: The position of the next instruction in the chunk.
+*/
+static int closureInstruction(Chunk* chunk, int offset)
+{
+	uint32_t constant = (chunk->code[offset + 1] << 16) |
+						(chunk->code[offset + 2] << 8) |
+						chunk->code[offset + 3];
+	printf("%-16s %4d ", "OP_CLOSURE", constant);
+	printValue(chunk->constants.values[constant]);
+	printf("\n");
+
+	ObjFunction* function = AS_FUNCTION(chunk->constants.values[constant]);
+	offset += 4;
+	for (int i = 0; i < function->upvalueCount; i++)
+	{
+		int isLocal = chunk->code[offset++];
+		int index = chunk->code[offset++];
+		printf("%04d    |                     %s %d\n",
+			   offset - 2, isLocal ? "local" : "upvalue", index);
+	}
+	return offset;
+}
+
+/**
+ * globalInstruction - prints the name of a global variable instruction
+ * along with the slot it accesses and the name of the global in that slot.
+ * @name: Name of the opcode.
+ * @chunk: pointer to the dynamic array defining a chunk of bytecode.
+ * @offset: current position of the instruction in the bytecode chunk.
+ * Return: The position of the next instruction in the chunk.
+*/
+static int globalInstruction(const char* name, Chunk* chunk, int offset)
+{
+	uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+	slot |= chunk->code[offset + 2];
+	printf("%-16s %4d '", name, slot);
+	printValue(vm.globalNames.values[slot]);
+	printf("'\n");
+	return offset + 3;
+}
+
 /**
  * constantInstruction - Pulls out the constant index from the subsequent
  * byte in the chunk and prints out the name of the opcode, the index and
@@ -48,6 +149,91 @@ static int constantInstruction(const char *name, Chunk* chunk, int offset)
 	return offset + 2;
 }
 
+/**
+ * constantLongInstruction - like `constantInstruction` but for the wide
+ * form whose constant index is stored in the next three bytes.
+ * @name: Name of the opcode.
+ * @chunk: pointer to the dynamic array defining a chunk of bytecode.
+ * @offset: current position of the instruction in the bytecode chunk.
+ * Return: The position of the next instruction in the chunk.
+*/
+static int constantLongInstruction(const char* name, Chunk* chunk, int offset)
+{
+	uint32_t constant = (chunk->code[offset + 1] << 16) |
+						(chunk->code[offset + 2] << 8) |
+						chunk->code[offset + 3];
+	printf("%-16s %4d '", name, constant);
+	printValue(chunk->constants.values[constant]);
+	printf("'\n");
+	return offset + 4;
+}
+
+/**
+ * opcodeName - looks up the printable name of an opcode.
+ * @opcode: the opcode.
+ * Return: the opcode's name, or "OP_UNKNOWN" for an invalid opcode.
+*/
+const char* opcodeName(uint8_t opcode)
+{
+	static const char* names[UINT8_COUNT] = {
+		[OP_CONSTANT]			= "OP_CONSTANT",
+		[OP_CONSTANT_LONG]		= "OP_CONSTANT_LONG",
+		[OP_NIL]				= "OP_NIL",
+		[OP_TRUE]				= "OP_TRUE",
+		[OP_FALSE]				= "OP_FALSE",
+		[OP_EQUAL]				= "OP_EQUAL",
+		[OP_NOT_EQUAL]			= "OP_NOT_EQUAL",
+		[OP_GREATER]			= "OP_GREATER",
+		[OP_GREATER_EQUAL]		= "OP_GREATER_EQUAL",
+		[OP_LESS]				= "OP_LESS",
+		[OP_LESS_EQUAL]		= "OP_LESS_EQUAL",
+		[OP_ADD]				= "OP_ADD",
+		[OP_SUBTRACT]			= "OP_SUBTRACT",
+		[OP_MULTIPLY]			= "OP_MULTIPLY",
+		[OP_DIVIDE]			= "OP_DIVIDE",
+		[OP_NOT]				= "OP_NOT",
+		[OP_NEGATE]			= "OP_NEGATE",
+		[OP_PRINT]				= "OP_PRINT",
+		[OP_JUMP]				= "OP_JUMP",
+		[OP_JUMP_IF_FALSE]		= "OP_JUMP_IF_FALSE",
+		[OP_LOOP]				= "OP_LOOP",
+		[OP_POP]				= "OP_POP",
+		[OP_POPN]				= "OP_POPN",
+		[OP_GET_LOCAL]			= "OP_GET_LOCAL",
+		[OP_SET_LOCAL]			= "OP_SET_LOCAL",
+		[OP_GET_GLOBAL]		= "OP_GET_GLOBAL",
+		[OP_DEFINE_GLOBAL]		= "OP_DEFINE_GLOBAL",
+		[OP_SET_GLOBAL]		= "OP_SET_GLOBAL",
+		[OP_GET_PROPERTY]		= "OP_GET_PROPERTY",
+		[OP_SET_PROPERTY]		= "OP_SET_PROPERTY",
+		[OP_GET_SUPER]			= "OP_GET_SUPER",
+		[OP_GET_UPVALUE]		= "OP_GET_UPVALUE",
+		[OP_SET_UPVALUE]		= "OP_SET_UPVALUE",
+		[OP_CALL]				= "OP_CALL",
+		[OP_INVOKE]			= "OP_INVOKE",
+		[OP_SUPER_INVOKE]		= "OP_SUPER_INVOKE",
+		[OP_TAIL_CALL]			= "OP_TAIL_CALL",
+		[OP_TAIL_INVOKE]		= "OP_TAIL_INVOKE",
+		[OP_CLOSURE]			= "OP_CLOSURE",
+		[OP_CLOSE_UPVALUE]		= "OP_CLOSE_UPVALUE",
+		[OP_CLASS]				= "OP_CLASS",
+		[OP_INHERIT]			= "OP_INHERIT",
+		[OP_METHOD]			= "OP_METHOD",
+		[OP_RETURN]			= "OP_RETURN",
+		[OP_ADD_NUM]			= "OP_ADD_NUM",
+		[OP_ADD_STR]			= "OP_ADD_STR",
+		[OP_SUBTRACT_NUM]		= "OP_SUBTRACT_NUM",
+		[OP_MULTIPLY_NUM]		= "OP_MULTIPLY_NUM",
+		[OP_DIVIDE_NUM]		= "OP_DIVIDE_NUM",
+		[OP_GREATER_NUM]		= "OP_GREATER_NUM",
+		[OP_GREATER_EQUAL_NUM]	= "OP_GREATER_EQUAL_NUM",
+		[OP_LESS_NUM]			= "OP_LESS_NUM",
+		[OP_LESS_EQUAL_NUM]	= "OP_LESS_EQUAL_NUM",
+	};
+
+	return names[opcode] != NULL ? names[opcode] : "OP_UNKNOWN";
+}
+
 /**
  * disassembleChunk - disassembles all the instructions in the
  * entire chunk. It is implemented in terms of another function.
@@ -78,12 +264,13 @@ int disassembleInstruction(Chunk *chunk, int offset)
 	u_int8_t instruction = chunk->code[offset];
 
 	printf("%04d ", offset);
-	if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1])
+	int line = getLine(chunk, offset);
+	if (offset > 0 && line == getLine(chunk, offset - 1))
 	{
 		printf("   | ");
 	} else
 	{
-		printf("%4d ", chunk->lines[offset]);
+		printf("%4d ", line);
 	}
 
 	switch (instruction)
@@ -91,6 +278,9 @@ int disassembleInstruction(Chunk *chunk, int offset)
 		case OP_CONSTANT:
 			return constantInstruction("OP_CONSTANT", chunk, offset);
 
+		case OP_CONSTANT_LONG:
+			return constantLongInstruction("OP_CONSTANT_LONG", chunk, offset);
+
 		case OP_NIL:
 			return simpleInstruction("OP_NIL", offset);
 		
@@ -103,12 +293,21 @@ int disassembleInstruction(Chunk *chunk, int offset)
 		case OP_EQUAL:
 			return simpleInstruction("OP_EQUAL", offset);
 
+		case OP_NOT_EQUAL:
+			return simpleInstruction("OP_NOT_EQUAL", offset);
+
 		case OP_GREATER:
 			return simpleInstruction("OP_GREATER", offset);
 
+		case OP_GREATER_EQUAL:
+			return simpleInstruction("OP_GREATER_EQUAL", offset);
+
 		case OP_LESS:
 			return simpleInstruction("OP_LESS", offset);
 
+		case OP_LESS_EQUAL:
+			return simpleInstruction("OP_LESS_EQUAL", offset);
+
 		case OP_ADD:
 			return simpleInstruction("OP_ADD", offset);
 
@@ -129,6 +328,9 @@ int disassembleInstruction(Chunk *chunk, int offset)
 
 		case OP_POP:
 			return simpleInstruction("OP_POP", offset);
+
+		case OP_POPN:
+			return byteInstruction("OP_POPN", chunk, offset);
 		
 		case OP_GET_LOCAL:
 			return byteInstruction("OP_GET_LOCAL", chunk, offset);
@@ -137,13 +339,13 @@ int disassembleInstruction(Chunk *chunk, int offset)
 			return byteInstruction("OP_SET_LOCAL", chunk, offset);
 
 		case OP_GET_GLOBAL:
-			return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+			return globalInstruction("OP_GET_GLOBAL", chunk, offset);
 
 		case OP_DEFINE_GLOBAL:
-			return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+			return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
 
 		case OP_SET_GLOBAL:
-			return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+			return globalInstruction("OP_SET_GLOBAL", chunk, offset);
 
 		case OP_PRINT:
 			return simpleInstruction("OP_PRINT", offset);
@@ -154,11 +356,284 @@ int disassembleInstruction(Chunk *chunk, int offset)
 		case OP_JUMP_IF_FALSE:
 			return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
 
+		case OP_LOOP:
+			return loopInstruction(chunk, offset);
+
+		case OP_GET_PROPERTY:
+			return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
+
+		case OP_SET_PROPERTY:
+			return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
+
+		case OP_GET_SUPER:
+			return propertyInstruction("OP_GET_SUPER", chunk, offset);
+
+		case OP_GET_UPVALUE:
+			return byteInstruction("OP_GET_UPVALUE", chunk, offset);
+
+		case OP_SET_UPVALUE:
+			return byteInstruction("OP_SET_UPVALUE", chunk, offset);
+
+		case OP_CALL:
+			return byteInstruction("OP_CALL", chunk, offset);
+
+		case OP_INVOKE:
+			return invokeInstruction("OP_INVOKE", chunk, offset);
+
+		case OP_SUPER_INVOKE:
+			return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
+
+		case OP_TAIL_CALL:
+			return byteInstruction("OP_TAIL_CALL", chunk, offset);
+
+		case OP_TAIL_INVOKE:
+			return invokeInstruction("OP_TAIL_INVOKE", chunk, offset);
+
+		case OP_CLOSURE:
+			return closureInstruction(chunk, offset);
+
+		case OP_CLOSE_UPVALUE:
+			return simpleInstruction("OP_CLOSE_UPVALUE", offset);
+
+		case OP_CLASS:
+			return constantLongInstruction("OP_CLASS", chunk, offset);
+
+		case OP_INHERIT:
+			return simpleInstruction("OP_INHERIT", offset);
+
+		case OP_METHOD:
+			return constantLongInstruction("OP_METHOD", chunk, offset);
+
 		case OP_RETURN:
 			return simpleInstruction("OP_RETURN", offset);
 
+		case OP_ADD_NUM:
+		case OP_ADD_STR:
+		case OP_SUBTRACT_NUM:
+		case OP_MULTIPLY_NUM:
+		case OP_DIVIDE_NUM:
+		case OP_GREATER_NUM:
+		case OP_GREATER_EQUAL_NUM:
+		case OP_LESS_NUM:
+		case OP_LESS_EQUAL_NUM:
+			return simpleInstruction(opcodeName(instruction), offset);
+
 		default:
 			printf("Unknown opcode %d\n", instruction);
 			return offset + 1;
 	}
 }
+
+/**
+ * printOperand - prints an `RK` operand of a register instruction as
+ * either `rN` or the constant it names.
+ * @chunk: the register chunk holding the constants.
+ * @operand: the operand.
+*/
+static void printOperand(RegChunk* chunk, uint16_t operand)
+{
+	if (!(operand & RK_CONSTANT))
+	{
+		printf("r%d", operand);
+		return;
+	}
+
+	printf("'");
+	printValue(chunk->constants.values[operand & RK_MAX_CONSTANT]);
+	printf("'");
+}
+
+/**
+ * disassembleRegChunk - disassembles all the instructions of a chunk
+ * translated for the register VM.
+ * @chunk: the register chunk.
+ * @name: header to show which chunk is being examined.
+ * Return: void.
+*/
+void disassembleRegChunk(RegChunk* chunk, const char* name)
+{
+	printf("== %s (%d registers) ==\n", name, chunk->registerCount);
+
+	for (int index = 0; index < chunk->count; index++)
+		disassembleRegInstruction(chunk, index);
+}
+
+/**
+ * disassembleRegInstruction - prints a single register instruction along
+ * with the offset of the stack instruction it was translated from.
+ * @chunk: the register chunk.
+ * @index: index of the instruction.
+ * Return: the index of the next instruction.
+*/
+int disassembleRegInstruction(RegChunk* chunk, int index)
+{
+	static const char* names[] = {
+		[ROP_MOVE]				= "ROP_MOVE",
+		[ROP_LOAD_LONG]			= "ROP_LOAD_LONG",
+		[ROP_GET_GLOBAL]		= "ROP_GET_GLOBAL",
+		[ROP_DEFINE_GLOBAL]		= "ROP_DEFINE_GLOBAL",
+		[ROP_SET_GLOBAL]		= "ROP_SET_GLOBAL",
+		[ROP_EQUAL]				= "ROP_EQUAL",
+		[ROP_NOT_EQUAL]			= "ROP_NOT_EQUAL",
+		[ROP_GREATER]			= "ROP_GREATER",
+		[ROP_GREATER_EQUAL]		= "ROP_GREATER_EQUAL",
+		[ROP_LESS]				= "ROP_LESS",
+		[ROP_LESS_EQUAL]		= "ROP_LESS_EQUAL",
+		[ROP_ADD]				= "ROP_ADD",
+		[ROP_SUBTRACT]			= "ROP_SUBTRACT",
+		[ROP_MULTIPLY]			= "ROP_MULTIPLY",
+		[ROP_DIVIDE]			= "ROP_DIVIDE",
+		[ROP_NOT]				= "ROP_NOT",
+		[ROP_NEGATE]			= "ROP_NEGATE",
+		[ROP_PRINT]				= "ROP_PRINT",
+		[ROP_JUMP]				= "ROP_JUMP",
+		[ROP_JUMP_IF_FALSE]		= "ROP_JUMP_IF_FALSE",
+		[ROP_LOOP]				= "ROP_LOOP",
+		[ROP_CALL]				= "ROP_CALL",
+		[ROP_TAIL_CALL]			= "ROP_TAIL_CALL",
+		[ROP_RETURN]			= "ROP_RETURN",
+	};
+	RegInstruction* instruction = &chunk->code[index];
+
+	printf("%04d [%04d] %-18s ", index, chunk->origins[index],
+		   names[instruction->op]);
+
+	switch (instruction->op)
+	{
+		case ROP_MOVE:
+		case ROP_NOT:
+		case ROP_NEGATE:
+			printf("r%d, ", instruction->a);
+			printOperand(chunk, instruction->b);
+			break;
+
+		case ROP_LOAD_LONG:
+			printf("r%d, '", instruction->a);
+			printValue(chunk->source->constants.values[
+				(instruction->b << 16) | instruction->c]);
+			printf("'");
+			break;
+
+		case ROP_GET_GLOBAL:
+			printf("r%d, '", instruction->a);
+			printValue(vm.globalNames.values[instruction->b]);
+			printf("'");
+			break;
+
+		case ROP_DEFINE_GLOBAL:
+		case ROP_SET_GLOBAL:
+			printf("'");
+			printValue(vm.globalNames.values[instruction->a]);
+			printf("', ");
+			printOperand(chunk, instruction->b);
+			break;
+
+		case ROP_PRINT:
+			printOperand(chunk, instruction->a);
+			break;
+
+		case ROP_JUMP:
+			printf("-> %d", (instruction->b << 16) | instruction->c);
+			break;
+
+		case ROP_JUMP_IF_FALSE:
+			printf("r%d -> %d", instruction->a,
+				   (instruction->b << 16) | instruction->c);
+			break;
+
+		case ROP_LOOP:
+			printf("-> %d (loop %d)", (instruction->b << 16) | instruction->c,
+				   instruction->a);
+			break;
+
+		case ROP_CALL:
+		case ROP_TAIL_CALL:
+			printf("r%d, %d args", instruction->a, instruction->b);
+			break;
+
+		case ROP_RETURN:
+			printOperand(chunk, instruction->a);
+			break;
+
+		default:
+			printf("r%d, ", instruction->a);
+			printOperand(chunk, instruction->b);
+			printf(", ");
+			printOperand(chunk, instruction->c);
+			break;
+	}
+	printf("\n");
+	return index + 1;
+}
+
+/**
+ * compareLoopLines - orders loops by their source line for qsort.
+ * @a: pointer to the first loop.
+ * @b: pointer to the second loop.
+ * Return: negative, zero or positive as `a` comes before, with or after `b`.
+*/
+static int compareLoopLines(const void* a, const void* b)
+{
+	return ((const Loop*)a)->line - ((const Loop*)b)->line;
+}
+
+/**
+ * collectLoops - appends the loops of a chunk and of every function it
+ * defines to a growing array.
+ * @chunk: the chunk to scan.
+ * @loops: pointer to the array of loops.
+ * @count: pointer to the number of loops in the array.
+ * @capacity: pointer to the allocated size of the array.
+*/
+static void collectLoops(Chunk* chunk, Loop** loops, int* count, int* capacity)
+{
+	for (int i = 0; i < chunk->loopCount; i++)
+	{
+		if (*capacity < *count + 1)
+		{
+			*capacity = *capacity < 8 ? 8 : *capacity * 2;
+			*loops = realloc(*loops, sizeof(Loop) * *capacity);
+			if (*loops == NULL) exit(EXIT_FAILURE);
+		}
+		(*loops)[(*count)++] = chunk->loops[i];
+	}
+
+	for (int i = 0; i < chunk->constants.count; i++)
+	{
+		Value constant = chunk->constants.values[i];
+		if (!IS_FUNCTION(constant)) continue;
+		collectLoops(&AS_FUNCTION(constant)->chunk, loops, count, capacity);
+	}
+}
+
+/**
+ * printLoopProfile - prints how many times the loops of a chunk and of
+ * the functions it defines jumped back to their headers, one row per
+ * source line in line order. Loops sharing a line are added together.
+ * @chunk: the chunk whose loop counters to report.
+*/
+void printLoopProfile(Chunk* chunk)
+{
+	// keep the report after the program's own output.
+	fflush(stdout);
+	fprintf(stderr, "== loop profile ==\n");
+	fprintf(stderr, "%-8s %14s\n", "line", "iterations");
+
+	Loop* loops = NULL;
+	int count = 0;
+	int capacity = 0;
+	collectLoops(chunk, &loops, &count, &capacity);
+	if (count > 0) qsort(loops, count, sizeof(Loop), compareLoopLines);
+
+	for (int i = 0; i < count;)
+	{
+		int line = loops[i].line;
+		uint64_t iterations = 0;
+		for (; i < count && loops[i].line == line; i++)
+		{
+			iterations += loops[i].iterations;
+		}
+		fprintf(stderr, "%-8d %14llu\n", line, (unsigned long long)iterations);
+	}
+	free(loops);
+}
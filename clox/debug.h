@@ -2,8 +2,13 @@
 #define clox_debug_h
 
 #include "chunk.h"
+#include "regchunk.h"
 
 void disassembleChunk(Chunk *chunk, const char *name);
 int disassembleInstruction(Chunk *chunk, int offset);
+const char* opcodeName(uint8_t opcode);
+void disassembleRegChunk(RegChunk* chunk, const char* name);
+int disassembleRegInstruction(RegChunk* chunk, int index);
+void printLoopProfile(Chunk* chunk);
 
 #endif // clox_debug_h
\ No newline at end of file
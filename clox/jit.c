@@ -0,0 +1,717 @@
+#include "jit.h"
+
+#if defined(JIT)
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/**
+ * The JIT is a baseline compiler: each instruction of a chunk becomes a
+ * fixed sequence of x86-64 code working on the same `Value` stack the
+ * interpreter uses, so control can pass between the two at any
+ * instruction. Machine code keeps the top of the stack in r12 and the
+ * frame's first slot in r13, and handles constants, locals, globals,
+ * arithmetic and comparisons on numbers, jumps, loops and `print`. It
+ * leaves everything else, calls and returns included, to the interpreter
+ * by exiting at that instruction; so does an instruction whose operands
+ * turn out to need the slow path, such as adding two strings. The
+ * interpreter enters the machine code again when it calls into a
+ * compiled chunk, returns into one or jumps back to one of its loops.
+*/
+
+// the registers the generated code uses.
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RSI 6
+#define RDI 7
+#define R8 8
+#define R12 12
+#define R13 13
+
+// REX prefix selecting 64-bit operands.
+#define REX_W 0x48
+
+/**
+ * enum fixupKind - what the 32-bit displacement of a jump refers to.
+ * @FIXUP_INSTRUCTION: the machine code of the bytecode instruction at the
+ * fixup's offset.
+ * @FIXUP_EXIT: an exit to the interpreter at the fixup's offset.
+ * @FIXUP_EPILOGUE: the code that returns to the interpreter.
+*/
+typedef enum fixupKind
+{
+	FIXUP_INSTRUCTION,
+	FIXUP_EXIT,
+	FIXUP_EPILOGUE
+} FixupKind;
+
+/**
+ * struct fixup - a jump whose target was not known when it was emitted.
+ * @at: position of the jump's displacement in the code.
+ * @kind: what the jump lands on.
+ * @offset: bytecode offset the target belongs to.
+*/
+typedef struct fixup
+{
+	int at;
+	FixupKind kind;
+	int offset;
+} Fixup;
+
+/**
+ * struct assembler - the machine code of a chunk being compiled.
+ * @code: the code emitted so far.
+ * @count: number of bytes emitted.
+ * @capacity: allocated size of `code`.
+ * @fixups: the jumps still to be patched.
+ * @fixupCount: number of entries in `fixups`.
+ * @fixupCapacity: allocated size of `fixups`.
+ * @starts: position in `code` of each bytecode instruction, by offset.
+*/
+typedef struct assembler
+{
+	uint8_t* code;
+	int count;
+	int capacity;
+	Fixup* fixups;
+	int fixupCount;
+	int fixupCapacity;
+	int* starts;
+} Assembler;
+
+/**
+ * JitEntry - the signature of the code at the start of every compiled
+ * chunk, which enters the machine code of one of its instructions. It
+ * returns the bytecode offset of the instruction to resume interpreting
+ * at, having stored the top of the stack in `vm.stackTop`.
+*/
+typedef int (*JitEntry)(Value* slots, Value* stackTop, uint8_t* target);
+
+/**
+ * emitBytes - appends machine code.
+ * @a: the assembler.
+ * @bytes: the bytes to append.
+ * @count: number of bytes.
+*/
+static void emitBytes(Assembler* a, const uint8_t* bytes, int count)
+{
+	if (a->capacity < a->count + count)
+	{
+		while (a->capacity < a->count + count)
+		{
+			a->capacity = a->capacity < 256 ? 256 : a->capacity * 2;
+		}
+		a->code = realloc(a->code, a->capacity);
+		if (a->code == NULL) exit(EXIT_FAILURE);
+	}
+	memcpy(a->code + a->count, bytes, count);
+	a->count += count;
+}
+
+#define EMIT(...) \
+	emitBytes(a, (const uint8_t[]){ __VA_ARGS__ }, \
+			  sizeof((const uint8_t[]){ __VA_ARGS__ }))
+
+/**
+ * emit32 - appends a little-endian 32-bit immediate or displacement.
+ * @a: the assembler.
+ * @value: the value.
+*/
+static void emit32(Assembler* a, int32_t value)
+{
+	emitBytes(a, (const uint8_t*)&value, 4);
+}
+
+/**
+ * emitMoveImmediate - emits `movabs reg, imm64`.
+ * @a: the assembler.
+ * @reg: the destination register.
+ * @value: the 64-bit immediate.
+*/
+static void emitMoveImmediate(Assembler* a, int reg, uint64_t value)
+{
+	EMIT(REX_W | (reg >= 8 ? 0x01 : 0), 0xb8 + (reg & 7));
+	emitBytes(a, (const uint8_t*)&value, 8);
+}
+
+/**
+ * emitMemory - emits an instruction between a register and the memory
+ * operand `[base + disp]`, always with a 32-bit displacement.
+ * @a: the assembler.
+ * @rex: REX_W for 64-bit operands, otherwise zero.
+ * @opcode: the instruction's opcode, 0x8b to load and 0x89 to store.
+ * @reg: the register operand.
+ * @base: the base register of the memory operand.
+ * @disp: the displacement of the memory operand.
+*/
+static void emitMemory(Assembler* a, uint8_t rex, uint8_t opcode, int reg,
+					   int base, int32_t disp)
+{
+	rex |= (reg >= 8 ? 0x44 : 0) | (base >= 8 ? 0x41 : 0);
+	if (rex != 0) EMIT(rex);
+	EMIT(opcode, 0x80 | (reg & 7) << 3 | (base & 7));
+	// rsp and r12 can only be a base through a SIB byte.
+	if ((base & 7) == 4) EMIT(0x24);
+	emit32(a, disp);
+}
+
+/**
+ * emitLoad - emits `mov reg, [base + disp]`.
+ * @a: the assembler.
+ * @reg: the destination register.
+ * @base: the base register.
+ * @disp: the displacement.
+*/
+static void emitLoad(Assembler* a, int reg, int base, int32_t disp)
+{
+	emitMemory(a, REX_W, 0x8b, reg, base, disp);
+}
+
+/**
+ * emitStore - emits `mov [base + disp], reg`.
+ * @a: the assembler.
+ * @reg: the source register.
+ * @base: the base register.
+ * @disp: the displacement.
+*/
+static void emitStore(Assembler* a, int reg, int base, int32_t disp)
+{
+	emitMemory(a, REX_W, 0x89, reg, base, disp);
+}
+
+/**
+ * emitAdjustStack - emits `add r12, bytes`, moving the top of the stack
+ * by a number of slots.
+ * @a: the assembler.
+ * @slots: number of slots to push (positive) or pop (negative).
+*/
+static void emitAdjustStack(Assembler* a, int slots)
+{
+	EMIT(0x49, 0x81, 0xc4);
+	emit32(a, slots * (int)sizeof(Value));
+}
+
+/**
+ * emitJump - emits a jump, or a conditional jump, to a target that is
+ * patched in once the code is complete.
+ * @a: the assembler.
+ * @condition: the condition code of a `jcc`, or -1 for `jmp`.
+ * @kind: what the jump lands on.
+ * @offset: bytecode offset the target belongs to.
+*/
+static void emitJump(Assembler* a, int condition, FixupKind kind, int offset)
+{
+	if (condition == -1)
+	{
+		EMIT(0xe9);
+	} else
+	{
+		EMIT(0x0f, 0x80 | condition);
+	}
+
+	if (a->fixupCapacity < a->fixupCount + 1)
+	{
+		a->fixupCapacity = a->fixupCapacity < 8 ? 8 : a->fixupCapacity * 2;
+		a->fixups = realloc(a->fixups, sizeof(Fixup) * a->fixupCapacity);
+		if (a->fixups == NULL) exit(EXIT_FAILURE);
+	}
+	a->fixups[a->fixupCount++] = (Fixup){ a->count, kind, offset };
+	emit32(a, 0);
+}
+
+// condition codes of `jcc` and `setcc`.
+#define CC_E 0x4
+#define CC_BE 0x6
+#define CC_A 0x7
+
+/**
+ * patch - points the 32-bit displacement of a jump at its target.
+ * @a: the assembler.
+ * @at: position of the displacement.
+ * @target: position the jump lands on.
+*/
+static void patch(Assembler* a, int at, int target)
+{
+	int32_t displacement = target - (at + 4);
+	memcpy(a->code + at, &displacement, 4);
+}
+
+/**
+ * emitCall - emits a call to a C function with the top of the stack
+ * stored in `vm.stackTop`, so a collection the function triggers sees
+ * every value, and reloaded afterwards.
+ * @a: the assembler.
+ * @function: the function, whose arguments are already in place.
+*/
+static void emitCall(Assembler* a, void* function)
+{
+	emitMoveImmediate(a, RCX, (uint64_t)(uintptr_t)&vm.stackTop);
+	emitStore(a, R12, RCX, 0);
+	emitMoveImmediate(a, RAX, (uint64_t)(uintptr_t)function);
+	EMIT(0xff, 0xd0);	// call rax
+	emitMoveImmediate(a, RCX, (uint64_t)(uintptr_t)&vm.stackTop);
+	emitLoad(a, R12, RCX, 0);
+}
+
+/**
+ * emitCheckNumber - emits an exit to the interpreter unless a register
+ * holds a number. r8 must hold `QNAN`.
+ * @a: the assembler.
+ * @reg: the register holding the value, rax or rcx.
+ * @offset: bytecode offset of the instruction, where the exit resumes.
+*/
+static void emitCheckNumber(Assembler* a, int reg, int offset)
+{
+	EMIT(REX_W, 0x89, 0xc0 | reg << 3 | RDX);	// mov rdx, reg
+	EMIT(0x4c, 0x21, 0xc2);						// and rdx, r8
+	EMIT(0x4c, 0x39, 0xc2);						// cmp rdx, r8
+	emitJump(a, CC_E, FIXUP_EXIT, offset);
+}
+
+/**
+ * emitNumberOperands - emits the loads of the two operands of a binary
+ * instruction into xmm0 and xmm1, exiting to the interpreter unless both
+ * are numbers.
+ * @a: the assembler.
+ * @offset: bytecode offset of the instruction.
+*/
+static void emitNumberOperands(Assembler* a, int offset)
+{
+	emitLoad(a, RAX, R12, -2 * (int)sizeof(Value));
+	emitLoad(a, RCX, R12, -(int)sizeof(Value));
+	emitMoveImmediate(a, R8, QNAN);
+	emitCheckNumber(a, RAX, offset);
+	emitCheckNumber(a, RCX, offset);
+	EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc0);	// movq xmm0, rax
+	EMIT(0x66, 0x48, 0x0f, 0x6e, 0xc9);	// movq xmm1, rcx
+}
+
+/**
+ * emitBoolResult - turns the byte in al into `TRUE_VAL` or `FALSE_VAL`
+ * and replaces the two operands of a binary instruction with it.
+ * @a: the assembler.
+*/
+static void emitBoolResult(Assembler* a)
+{
+	EMIT(0x0f, 0xb6, 0xc0);		// movzx eax, al
+	emitMoveImmediate(a, RCX, FALSE_VAL);
+	EMIT(REX_W, 0x01, 0xc8);	// add rax, rcx
+	emitStore(a, RAX, R12, -2 * (int)sizeof(Value));
+	emitAdjustStack(a, -1);
+}
+
+/**
+ * emitArithmetic - emits a binary arithmetic instruction on numbers.
+ * @a: the assembler.
+ * @operation: the SSE2 opcode: addsd, subsd, mulsd or divsd.
+ * @offset: bytecode offset of the instruction.
+*/
+static void emitArithmetic(Assembler* a, uint8_t operation, int offset)
+{
+	emitNumberOperands(a, offset);
+	EMIT(0xf2, 0x0f, operation, 0xc1);		// op xmm0, xmm1
+	EMIT(0x66, 0x48, 0x0f, 0x7e, 0xc0);	// movq rax, xmm0
+	emitStore(a, RAX, R12, -2 * (int)sizeof(Value));
+	emitAdjustStack(a, -1);
+}
+
+/**
+ * emitComparison - emits a comparison of numbers. `ucomisd` leaves an
+ * unordered result (a NaN operand) looking below and equal. Like the
+ * interpreter, `>` and `<` test for above, with `<` swapping its
+ * operands, so NaN compares false, while `>=` and `<=` are `!(a < b)` and
+ * `!(a > b)` and test the opposite operands for below or equal, so NaN
+ * compares true.
+ * @a: the assembler.
+ * @swap: compare the second operand with the first.
+ * @condition: CC_A or CC_BE.
+ * @offset: bytecode offset of the instruction.
+*/
+static void emitComparison(Assembler* a, bool swap, int condition,
+						   int offset)
+{
+	emitNumberOperands(a, offset);
+	if (swap)
+	{
+		EMIT(0x66, 0x0f, 0x2e, 0xc8);	// ucomisd xmm1, xmm0
+	} else
+	{
+		EMIT(0x66, 0x0f, 0x2e, 0xc1);	// ucomisd xmm0, xmm1
+	}
+	EMIT(0x0f, 0x90 | condition, 0xc0);	// setcc al
+	emitBoolResult(a);
+}
+
+/**
+ * emitJumpIfFalsey - emits a jump taken when the value in rax is nil or
+ * false.
+ * @a: the assembler.
+ * @kind: what a falsey value jumps to.
+ * @offset: bytecode offset the target belongs to.
+*/
+static void emitJumpIfFalsey(Assembler* a, FixupKind kind, int offset)
+{
+	emitMoveImmediate(a, RCX, NIL_VAL);
+	EMIT(REX_W, 0x39, 0xc8);	// cmp rax, rcx
+	emitJump(a, CC_E, kind, offset);
+	emitMoveImmediate(a, RCX, FALSE_VAL);
+	EMIT(REX_W, 0x39, 0xc8);	// cmp rax, rcx
+	emitJump(a, CC_E, kind, offset);
+}
+
+/**
+ * emitPush - emits a push of the value in rax.
+ * @a: the assembler.
+*/
+static void emitPush(Assembler* a)
+{
+	emitStore(a, RAX, R12, 0);
+	emitAdjustStack(a, 1);
+}
+
+/**
+ * emitGlobalValues - emits a load of the address of the global values
+ * into rdx. It is read at run time as the array moves when globals are
+ * added.
+ * @a: the assembler.
+*/
+static void emitGlobalValues(Assembler* a)
+{
+	emitMoveImmediate(a, RDX, (uint64_t)(uintptr_t)&vm.globalValues.values);
+	emitLoad(a, RDX, RDX, 0);
+}
+
+/**
+ * emitCheckDefined - emits an exit to the interpreter, which reports the
+ * error, if the value in rax is `UNDEFINED_VAL`.
+ * @a: the assembler.
+ * @offset: bytecode offset of the instruction.
+*/
+static void emitCheckDefined(Assembler* a, int offset)
+{
+	emitMoveImmediate(a, RCX, UNDEFINED_VAL);
+	EMIT(REX_W, 0x39, 0xc8);	// cmp rax, rcx
+	emitJump(a, CC_E, FIXUP_EXIT, offset);
+}
+
+/**
+ * emitExit - emits a return to the interpreter, which resumes at the
+ * given instruction.
+ * @a: the assembler.
+ * @offset: bytecode offset of the instruction.
+*/
+static void emitExit(Assembler* a, int offset)
+{
+	EMIT(0xb8);	// mov eax, offset
+	emit32(a, offset);
+	emitJump(a, -1, FIXUP_EPILOGUE, 0);
+}
+
+/**
+ * printHelper - the machine code's `print`.
+ * @value: the value to print.
+*/
+static void printHelper(Value value)
+{
+	printValue(value);
+	printf("\n");
+}
+
+/**
+ * readShort - decodes a 16-bit operand.
+ * @code: pointer to the operand.
+ * Return: the operand.
+*/
+static int readShort(uint8_t* code)
+{
+	return (code[0] << 8) | code[1];
+}
+
+/**
+ * emitInstruction - emits the machine code of one instruction.
+ * @a: the assembler.
+ * @chunk: the chunk being compiled.
+ * @offset: bytecode offset of the instruction.
+ * Return: false if the instruction is left to the interpreter, in which
+ * case only an exit was emitted.
+*/
+static bool emitInstruction(Assembler* a, Chunk* chunk, int offset)
+{
+	uint8_t* code = &chunk->code[offset];
+	const int slot = (int)sizeof(Value);
+
+	switch (code[0])
+	{
+		case OP_CONSTANT:
+			emitMoveImmediate(a, RAX, chunk->constants.values[code[1]]);
+			emitPush(a);
+			return true;
+		case OP_CONSTANT_LONG:
+			emitMoveImmediate(a, RAX, chunk->constants.values[
+				(code[1] << 16) | (code[2] << 8) | code[3]]);
+			emitPush(a);
+			return true;
+		case OP_NIL:
+		case OP_TRUE:
+		case OP_FALSE:
+			emitMoveImmediate(a, RAX, code[0] == OP_NIL ? NIL_VAL :
+									  BOOL_VAL(code[0] == OP_TRUE));
+			emitPush(a);
+			return true;
+		case OP_EQUAL:
+		case OP_NOT_EQUAL:
+			emitLoad(a, RDI, R12, -2 * slot);
+			emitLoad(a, RSI, R12, -slot);
+			emitCall(a, (void*)valuesEqual);
+			if (code[0] == OP_NOT_EQUAL) EMIT(0x34, 0x01);	// xor al, 1
+			emitBoolResult(a);
+			return true;
+		case OP_GREATER:
+		case OP_GREATER_NUM:
+			emitComparison(a, false, CC_A, offset);
+			return true;
+		case OP_GREATER_EQUAL:
+		case OP_GREATER_EQUAL_NUM:
+			emitComparison(a, true, CC_BE, offset);
+			return true;
+		case OP_LESS:
+		case OP_LESS_NUM:
+			emitComparison(a, true, CC_A, offset);
+			return true;
+		case OP_LESS_EQUAL:
+		case OP_LESS_EQUAL_NUM:
+			emitComparison(a, false, CC_BE, offset);
+			return true;
+		case OP_ADD:
+		case OP_ADD_NUM:
+			emitArithmetic(a, 0x58, offset);
+			return true;
+		case OP_SUBTRACT:
+		case OP_SUBTRACT_NUM:
+			emitArithmetic(a, 0x5c, offset);
+			return true;
+		case OP_MULTIPLY:
+		case OP_MULTIPLY_NUM:
+			emitArithmetic(a, 0x59, offset);
+			return true;
+		case OP_DIVIDE:
+		case OP_DIVIDE_NUM:
+			emitArithmetic(a, 0x5e, offset);
+			return true;
+		case OP_NOT:
+			emitLoad(a, RAX, R12, -slot);
+			emitMoveImmediate(a, RCX, NIL_VAL);
+			EMIT(REX_W, 0x39, 0xc8);	// cmp rax, rcx
+			EMIT(0x0f, 0x94, 0xc2);		// sete dl
+			emitMoveImmediate(a, RCX, FALSE_VAL);
+			EMIT(REX_W, 0x39, 0xc8);	// cmp rax, rcx
+			EMIT(0x0f, 0x94, 0xc0);		// sete al
+			EMIT(0x08, 0xd0);			// or al, dl
+			EMIT(0x0f, 0xb6, 0xc0);		// movzx eax, al
+			emitMoveImmediate(a, RCX, FALSE_VAL);
+			EMIT(REX_W, 0x01, 0xc8);	// add rax, rcx
+			emitStore(a, RAX, R12, -slot);
+			return true;
+		case OP_NEGATE:
+			emitLoad(a, RAX, R12, -slot);
+			emitMoveImmediate(a, R8, QNAN);
+			emitCheckNumber(a, RAX, offset);
+			EMIT(REX_W, 0x0f, 0xba, 0xf8, 0x3f);	// btc rax, 63
+			emitStore(a, RAX, R12, -slot);
+			return true;
+		case OP_PRINT:
+			emitLoad(a, RDI, R12, -slot);
+			emitAdjustStack(a, -1);
+			emitCall(a, (void*)printHelper);
+			return true;
+		case OP_JUMP:
+			emitJump(a, -1, FIXUP_INSTRUCTION,
+					 offset + 3 + readShort(code + 1));
+			return true;
+		case OP_JUMP_IF_FALSE:
+			emitLoad(a, RAX, R12, -slot);
+			emitJumpIfFalsey(a, FIXUP_INSTRUCTION,
+							 offset + 3 + readShort(code + 1));
+			return true;
+		case OP_LOOP:
+			emitMoveImmediate(a, RAX, (uint64_t)(uintptr_t)
+							  &chunk->loops[readShort(code + 3)].iterations);
+			EMIT(REX_W, 0xff, 0x00);	// inc qword [rax]
+			emitJump(a, -1, FIXUP_INSTRUCTION,
+					 offset + 5 - readShort(code + 1));
+			return true;
+		case OP_POP:
+			emitAdjustStack(a, -1);
+			return true;
+		case OP_POPN:
+			emitAdjustStack(a, -code[1]);
+			return true;
+		case OP_GET_LOCAL:
+			emitLoad(a, RAX, R13, code[1] * slot);
+			emitPush(a);
+			return true;
+		case OP_SET_LOCAL:
+			emitLoad(a, RAX, R12, -slot);
+			emitStore(a, RAX, R13, code[1] * slot);
+			return true;
+		case OP_GET_GLOBAL:
+			emitGlobalValues(a);
+			emitLoad(a, RAX, RDX, readShort(code + 1) * slot);
+			emitCheckDefined(a, offset);
+			emitPush(a);
+			return true;
+		case OP_SET_GLOBAL:
+			emitGlobalValues(a);
+			emitLoad(a, RAX, RDX, readShort(code + 1) * slot);
+			emitCheckDefined(a, offset);
+			emitLoad(a, RAX, R12, -slot);
+			emitStore(a, RAX, RDX, readShort(code + 1) * slot);
+			return true;
+		case OP_DEFINE_GLOBAL:
+			emitGlobalValues(a);
+			emitLoad(a, RAX, R12, -slot);
+			emitStore(a, RAX, RDX, readShort(code + 1) * slot);
+			emitAdjustStack(a, -1);
+			return true;
+		default:
+			emitExit(a, offset);
+			return false;
+	}
+}
+
+/**
+ * compileChunk - compiles a chunk to machine code. The code starts with
+ * the `JitEntry` that enters it, followed by the code of every
+ * instruction in order, the exits jumped to when an instruction's
+ * operands need the interpreter, and the epilogue every exit ends in.
+ * @chunk: the chunk, already verified.
+ * Return: the compiled code, or NULL if no executable memory was to be
+ * had.
+*/
+static JitCode* compileChunk(Chunk* chunk)
+{
+	Assembler assembler = { NULL, 0, 0, NULL, 0, 0, NULL };
+	Assembler* a = &assembler;
+	int* entries = malloc(sizeof(int) * chunk->count);
+	a->starts = malloc(sizeof(int) * chunk->count);
+	if (entries == NULL || a->starts == NULL) exit(EXIT_FAILURE);
+	for (int i = 0; i < chunk->count; i++) entries[i] = -1;
+
+	EMIT(0x53, 0x41, 0x54, 0x41, 0x55);	// push rbx; push r12; push r13
+	EMIT(0x49, 0x89, 0xfd);				// mov r13, rdi
+	EMIT(0x49, 0x89, 0xf4);				// mov r12, rsi
+	EMIT(0xff, 0xe2);					// jmp rdx
+
+	for (int offset = 0; offset < chunk->count;
+		 offset += instructionLength(chunk, offset))
+	{
+		a->starts[offset] = a->count;
+		if (emitInstruction(a, chunk, offset))
+		{
+			entries[offset] = a->starts[offset];
+		}
+	}
+
+	// exits emit jumps to the epilogue of their own, so only go as far
+	// as the jumps emitted by the instructions.
+	int fixupCount = a->fixupCount;
+	for (int i = 0; i < fixupCount; i++)
+	{
+		if (a->fixups[i].kind == FIXUP_INSTRUCTION)
+		{
+			patch(a, a->fixups[i].at, a->starts[a->fixups[i].offset]);
+		} else if (a->fixups[i].kind == FIXUP_EXIT)
+		{
+			patch(a, a->fixups[i].at, a->count);
+			emitExit(a, a->fixups[i].offset);
+		}
+	}
+
+	int epilogue = a->count;
+	emitMoveImmediate(a, RCX, (uint64_t)(uintptr_t)&vm.stackTop);
+	emitStore(a, R12, RCX, 0);
+	EMIT(0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);	// pop r13/r12/rbx; ret
+	for (int i = 0; i < a->fixupCount; i++)
+	{
+		if (a->fixups[i].kind == FIXUP_EPILOGUE)
+		{
+			patch(a, a->fixups[i].at, epilogue);
+		}
+	}
+
+	JitCode* jit = NULL;
+	uint8_t* code = mmap(NULL, a->count, PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code != MAP_FAILED)
+	{
+		memcpy(code, a->code, a->count);
+	}
+	if (code != MAP_FAILED &&
+		mprotect(code, a->count, PROT_READ | PROT_EXEC) != 0)
+	{
+		munmap(code, a->count);
+		code = MAP_FAILED;
+	}
+
+	if (code != MAP_FAILED)
+	{
+		jit = malloc(sizeof(JitCode));
+		if (jit == NULL) exit(EXIT_FAILURE);
+		jit->code = code;
+		jit->size = a->count;
+		jit->entries = entries;
+	} else
+	{
+		free(entries);
+	}
+
+	free(a->code);
+	free(a->fixups);
+	free(a->starts);
+	return jit;
+}
+
+/**
+ * runJit - counts an entry into the chunk of the current frame, compiling
+ * it once it is hot, and runs its machine code from the frame's next
+ * instruction if there is any. Returns when the machine code reaches an
+ * instruction it leaves to the interpreter, with the frame's `ip`
+ * pointing at that instruction.
+ * @frame: the current frame.
+*/
+void runJit(CallFrame* frame)
+{
+	Chunk* chunk = frame->chunk;
+	if (chunk->jit == NULL)
+	{
+		// a chunk that failed to compile stays past the threshold.
+		if (chunk->hotness > JIT_THRESHOLD) return;
+		if (chunk->hotness++ < JIT_THRESHOLD) return;
+		chunk->jit = compileChunk(chunk);
+		if (chunk->jit == NULL) return;
+	}
+
+	int offset = (int)(frame->ip - chunk->code);
+	if (chunk->jit->entries[offset] == -1) return;
+
+	JitEntry enter = (JitEntry)(uintptr_t)chunk->jit->code;
+	offset = enter(frame->slots, vm.stackTop,
+				   chunk->jit->code + chunk->jit->entries[offset]);
+	frame->ip = chunk->code + offset;
+}
+
+/**
+ * freeJit - releases the machine code of a chunk.
+ * @jit: the machine code, or NULL.
+*/
+void freeJit(JitCode* jit)
+{
+	if (jit == NULL) return;
+	munmap(jit->code, jit->size);
+	free(jit->entries);
+	free(jit);
+}
+
+#endif // JIT
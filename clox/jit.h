@@ -0,0 +1,32 @@
+#if !defined(clox_jit_h)
+#define clox_jit_h
+
+#include "vm.h"
+
+#if defined(JIT)
+
+// number of times a chunk is entered, by a call, a return into it or a
+// loop jumping back, before it is compiled to machine code.
+#define JIT_THRESHOLD 100
+
+/**
+ * struct jitCode - the machine code compiled from a chunk.
+ * @code: executable mapping holding the code.
+ * @size: size of the mapping in bytes.
+ * @entries: offset in `code` of the machine code of each instruction,
+ * indexed by the instruction's offset in the bytecode, or -1 where there
+ * is no machine code worth entering.
+*/
+typedef struct jitCode
+{
+	uint8_t* code;
+	size_t size;
+	int* entries;
+} JitCode;
+
+void runJit(CallFrame* frame);
+void freeJit(JitCode* jit);
+
+#endif // JIT
+
+#endif // clox_jit_h
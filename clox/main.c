@@ -1,7 +1,11 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
+#include "aot.h"
+#include "bytecode.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
 #include "vm.h"
 
@@ -122,15 +126,39 @@ static char* readFile(const char* path)
 	return buffer;
 }
 
+/**
+ * runBytecode - maps a serialized chunk produced by `--compile` and
+ * executes it without scanning or compiling anything.
+ * @path: Path to the bytecode file.
+ * Return: void.
+*/
+static void runBytecode(const char* path)
+{
+	Chunk chunk;
+	if (!loadBytecode(path, &chunk)) exit(65);
+
+	InterpretResult result = interpretChunk(&chunk);
+	unloadBytecode(&chunk);
+
+	if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
 /**
  * runFile - reads a file and executes the resulting string.
  * Based on the result of the execution, the appropriate exit
- * code is set.
+ * code is set. Files starting with the bytecode magic are loaded
+ * as precompiled chunks instead.
  * @path: Path to file that is to be executed.
  * Return: void.
 */
 static void runFile(const char* path)
 {
+	if (isBytecodeFile(path))
+	{
+		runBytecode(path);
+		return;
+	}
+
 	char* source = readFile(path);
 	InterpretResult result = interpret(source);
 	free(source);
@@ -140,22 +168,160 @@ static void runFile(const char* path)
 	
 }
 
+/**
+ * compileFile - compiles a source file and serializes the resulting
+ * chunk so that later runs can skip scanning and compiling, or turns it
+ * into a C program.
+ * @path: Path to the source file.
+ * @output: Path of the bytecode or C file to write.
+ * @emitC: write C instead of bytecode.
+ * Return: void.
+*/
+static void compileFile(const char* path, const char* output, bool emitC)
+{
+	char* source = readFile(path);
+	Chunk chunk;
+	initChunk(&chunk);
+	bool compiled = compile(source, &chunk);
+	free(source);
+
+	if (!compiled)
+	{
+		freeChunk(&chunk);
+		exit(65);
+	}
+
+	bool written = emitC ? writeC(&chunk, output)
+						 : writeBytecode(&chunk, output);
+	freeChunk(&chunk);
+	if (!written) exit(74);
+}
+
+/**
+ * usage - prints how to invoke clox and exits.
+*/
+static void usage()
+{
+	fprintf(stderr, "Usage: clox [options] [path]\n");
+	fprintf(stderr, "       clox [options] --compile path [-o output]\n");
+	fprintf(stderr, "       clox [options] --emit-c path [-o output]\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --no-optimize   skip constant folding and the peephole optimizer\n");
+	fprintf(stderr, "  --opt-report    print opcode counts before and after optimizing\n");
+	fprintf(stderr, "  --regvm         run what translates on the register-based VM\n");
+	fprintf(stderr, "  --profile-loops print the iterations of each loop by source line\n");
+	fprintf(stderr, "  --stack-limit n grow the VM stack to at most n slots\n");
+	fprintf(stderr, "  --jit           compile hot code to machine code\n");
+	fprintf(stderr, "  --profile file  print time per line, write stacks to file\n");
+	fprintf(stderr, "  --profile-rate n take n profile samples per second\n");
+	fprintf(stderr, "  --stats         print how often each opcode and pair ran\n");
+	fprintf(stderr, "  --stats-cycles  with --stats, also time each opcode\n");
+	fprintf(stderr, "  --stats-json f  with --stats, also write the counts to f\n");
+	exit(64);
+}
+
 int main(int argc, char **argv)
 {
+	const char* path = NULL;
+	const char* output = NULL;
+	bool compileOnly = false;
+	bool emitC = false;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--compile") == 0)
+		{
+			compileOnly = true;
+		} else if (strcmp(argv[i], "--emit-c") == 0)
+		{
+			emitC = true;
+		} else if (strcmp(argv[i], "--no-optimize") == 0)
+		{
+			compilerOptions.optimize = false;
+		} else if (strcmp(argv[i], "--opt-report") == 0)
+		{
+			compilerOptions.optimizerReport = true;
+		} else if (strcmp(argv[i], "--regvm") == 0)
+		{
+			vmOptions.registerMode = true;
+		} else if (strcmp(argv[i], "--profile-loops") == 0)
+		{
+			vmOptions.profileLoops = true;
+		} else if (strcmp(argv[i], "--stack-limit") == 0 && i + 1 < argc)
+		{
+			vmOptions.stackLimit = atoi(argv[++i]);
+			if (vmOptions.stackLimit < FRAME_SLOTS) usage();
+		} else if (strcmp(argv[i], "--jit") == 0)
+		{
+			vmOptions.jit = true;
+		} else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+		{
+			vmOptions.profilePath = argv[++i];
+		} else if (strcmp(argv[i], "--profile-rate") == 0 && i + 1 < argc)
+		{
+			vmOptions.profileRate = atoi(argv[++i]);
+			if (vmOptions.profileRate <= 0) usage();
+		} else if (strcmp(argv[i], "--stats") == 0)
+		{
+			vmOptions.stats = true;
+		} else if (strcmp(argv[i], "--stats-cycles") == 0)
+		{
+			vmOptions.statsCycles = true;
+		} else if (strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc)
+		{
+			vmOptions.statsPath = argv[++i];
+		} else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+		{
+			output = argv[++i];
+		} else if (argv[i][0] == '-' || path != NULL)
+		{
+			usage();
+		} else
+		{
+			path = argv[i];
+		}
+	}
+
+	#if !defined(OPCODE_STATS)
+	if (vmOptions.stats)
+	{
+		fprintf(stderr, "Note: built without OPCODE_STATS, --stats does "
+						"nothing.\n");
+	}
+	#endif // OPCODE_STATS
+
 	initVM();
 
-	// if no arguments are passed, drop into REPL mode.
-	if (argc == 1)
+	if (compileOnly || emitC)
 	{
-		repl();
-	} else if (argc == 2)
+		if (path == NULL) usage();
+
+		char defaultOutput[1024];
+		size_t length = strlen(path);
+		if (output == NULL && emitC)
+		{
+			// foo.lox -> foo.c
+			if (length > 4 && strcmp(path + length - 4, ".lox") == 0)
+			{
+				length -= 4;
+			}
+			snprintf(defaultOutput, sizeof(defaultOutput), "%.*s.c",
+					 (int)length, path);
+			output = defaultOutput;
+		} else if (output == NULL)
+		{
+			// foo.lox -> foo.loxc
+			snprintf(defaultOutput, sizeof(defaultOutput), "%sc", path);
+			output = defaultOutput;
+		}
+		compileFile(path, output, emitC);
+	} else if (path == NULL)
 	{
-		// A single line command line argument for the filepath to run.
-		runFile(argv[1]);
+		// if no arguments are passed, drop into REPL mode.
+		repl();
 	} else
 	{
-		fprintf(stderr, "Usage: clox [path]\n");
-		exit(64);
+		runFile(path);
 	}
 	
 	freeVM();
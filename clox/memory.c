@@ -1,8 +1,20 @@
 #include <stdlib.h>
 
+#include "compiler.h"
 #include "memory.h"
+#include "profiler.h"
 #include "vm.h"
 
+#if defined(DEBUG_LOG_GC)
+#include "debug.h"
+#endif // DEBUG_LOG_GC
+
+// how much the heap may grow past the live data of the last collection
+// before the next one is triggered. Override with `-DGC_HEAP_GROW_FACTOR=n`.
+#if !defined(GC_HEAP_GROW_FACTOR)
+#define GC_HEAP_GROW_FACTOR 2
+#endif // GC_HEAP_GROW_FACTOR
+
 /**
  * reallocate - performs the needed dynamic memory management.
  * This entails allocating memory, freeing it and changing the size
@@ -12,6 +24,9 @@
  * Free an allocation when `oldSize` > 0 && `newSize` == 0.
  * Shrink an allocation when 0 < `newSize` < `oldSize`.
  * Grow an allocation when 0 < `oldSize` < `newSize`.
+ * Every allocation goes through here which makes it the place to keep
+ * count of the live bytes and to kick off a collection once the heap
+ * grows past the `nextGC` threshold.
  * @pointer: pointer to memory to manage.
  * @oldSize: old size of memory pointed to by pointer.
  * @newSize: new desired size of memory pointed to by pointer.
@@ -21,6 +36,19 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize)
 {
 	void *result = NULL;
 
+	vm.bytesAllocated += newSize - oldSize;
+	if (newSize > oldSize)
+	{
+		#if defined(DEBUG_STRESS_GC)
+		collectGarbage();
+		#endif // DEBUG_STRESS_GC
+
+		if (vm.bytesAllocated > vm.nextGC)
+		{
+			collectGarbage();
+		}
+	}
+
 	if (newSize == 0)
 	{
 		free(pointer);
@@ -40,20 +68,352 @@ void *reallocate(void *pointer, size_t oldSize, size_t newSize)
 */
 static void freeObject(Obj* object)
 {
+	#if defined(DEBUG_LOG_GC)
+	printf("%p free type %d\n", (void*)object, object->type);
+	#endif // DEBUG_LOG_GC
+
 	switch (object->type)
 	{
 		case OBJ_STRING: {
 			ObjStringVec* string = (ObjStringVec*)object;
-			// FREE_ARRAY(char, string->chars, string->length + 1);
-			FREE(ObjStringVec, object);
+			reallocate(object, STRING_VEC_SIZE(string->length), 0);
+			break;
+		}
+
+		case OBJ_BUFFER: {
+			ObjBuffer* buffer = (ObjBuffer*)object;
+			FREE_ARRAY(char, buffer->chars, buffer->capacity);
+			FREE(ObjBuffer, object);
+			break;
+		}
+
+		case OBJ_CONCAT:
+			FREE(ObjConcat, object);
+			break;
+
+		case OBJ_FUNCTION: {
+			ObjFunction* function = (ObjFunction*)object;
+			freeChunk(&function->chunk);
+			FREE(ObjFunction, object);
+			break;
+		}
+
+		case OBJ_NATIVE:
+			FREE(ObjNative, object);
+			break;
+
+		case OBJ_CLOSURE: {
+			ObjClosure* closure = (ObjClosure*)object;
+			FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
+			FREE(ObjClosure, object);
+			break;
+		}
+
+		case OBJ_UPVALUE:
+			FREE(ObjUpvalue, object);
+			break;
+
+		case OBJ_SHAPE: {
+			ObjShape* shape = (ObjShape*)object;
+			freeTable(&shape->fields);
+			freeTable(&shape->transitions);
+			FREE(ObjShape, object);
+			break;
+		}
+
+		case OBJ_CLASS:
+			freeTable(&((ObjClass*)object)->methods);
+			FREE(ObjClass, object);
+			break;
+
+		case OBJ_BOUND_METHOD:
+			FREE(ObjBoundMethod, object);
+			break;
+
+		case OBJ_INSTANCE: {
+			ObjInstance* instance = (ObjInstance*)object;
+			#if defined(HIDDEN_CLASSES)
+			FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+			#else
+			freeTable(&instance->table);
+			#endif // HIDDEN_CLASSES
+			FREE(ObjInstance, object);
+			break;
+		}
+
+		default:
+			break;
+	}
+}
+
+/**
+ * markObject - marks a reachable object and pushes it onto the gray stack
+ * so that the objects it references get traced later on. The gray stack
+ * is allocated with the system `realloc` so that growing it can never
+ * recursively start another collection.
+ * @object: pointer to the reachable object.
+*/
+void markObject(Obj* object)
+{
+	if (object == NULL) return;
+	if (object->isMarked) return;
+
+	#if defined(DEBUG_LOG_GC)
+	printf("%p mark ", (void*)object);
+	printValue(OBJ_VAL(object));
+	printf("\n");
+	#endif // DEBUG_LOG_GC
+
+	object->isMarked = true;
+
+	if (vm.grayCapacity < vm.grayCount + 1)
+	{
+		vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
+		vm.grayStack = (Obj**)realloc(vm.grayStack,
+									  sizeof(Obj*) * vm.grayCapacity);
+		if (vm.grayStack == NULL) exit(EXIT_FAILURE);
+	}
+	vm.grayStack[vm.grayCount++] = object;
+}
+
+/**
+ * markValue - marks the value if it is a heap-allocated object. Numbers,
+ * booleans and nil live inline and need no tracing.
+ * @value: the reachable value.
+*/
+void markValue(Value value)
+{
+	if (IS_OBJ(value)) markObject(AS_OBJ(value));
+}
+
+/**
+ * markArray - marks every value in a dynamic array of values.
+ * @array: pointer to the array.
+*/
+static void markArray(ValueArray* array)
+{
+	for (int i = 0; i < array->count; i++)
+	{
+		markValue(array->values[i]);
+	}
+}
+
+/**
+ * markChunk - marks the constants of a chunk and the shapes and methods
+ * its property caches remember. A cached shape must stay alive, otherwise a new shape
+ * allocated at the same address would hit the stale entry.
+ * @chunk: pointer to the chunk.
+*/
+static void markChunk(Chunk* chunk)
+{
+	markArray(&chunk->constants);
+	for (int i = 0; i < chunk->cacheCount; i++)
+	{
+		PropertyCache* cache = &chunk->caches[i];
+		for (int way = 0; way < cache->count; way++)
+		{
+			markObject((Obj*)cache->shapes[way]);
+			markObject((Obj*)cache->transitions[way]);
+			if (cache->slots[way] == -1) markValue(cache->methods[way]);
+		}
+	}
+}
+
+/**
+ * blackenObject - traces the references held by a gray object, turning
+ * it black. Plain strings, buffers and natives hold no references to other
+ * objects.
+ * @object: pointer to the gray object.
+*/
+static void blackenObject(Obj* object)
+{
+	#if defined(DEBUG_LOG_GC)
+	printf("%p blacken ", (void*)object);
+	printValue(OBJ_VAL(object));
+	printf("\n");
+	#endif // DEBUG_LOG_GC
+
+	switch (object->type)
+	{
+		case OBJ_CONCAT:
+			markObject((Obj*)((ObjConcat*)object)->buffer);
+			break;
+
+		case OBJ_FUNCTION: {
+			ObjFunction* function = (ObjFunction*)object;
+			markObject((Obj*)function->name);
+			markChunk(&function->chunk);
+			break;
+		}
+
+		case OBJ_CLOSURE: {
+			ObjClosure* closure = (ObjClosure*)object;
+			markObject((Obj*)closure->function);
+			for (int i = 0; i < closure->upvalueCount; i++)
+			{
+				markObject((Obj*)closure->upvalues[i]);
+			}
+			break;
+		}
+
+		case OBJ_UPVALUE:
+			markValue(((ObjUpvalue*)object)->closed);
+			break;
+
+		case OBJ_SHAPE: {
+			ObjShape* shape = (ObjShape*)object;
+			markTable(&shape->fields);
+			markTable(&shape->transitions);
 			break;
 		}
 
+		case OBJ_CLASS: {
+			ObjClass* klass = (ObjClass*)object;
+			markObject((Obj*)klass->name);
+			markObject((Obj*)klass->shape);
+			markTable(&klass->methods);
+			markValue(klass->initializer);
+			break;
+		}
+
+		case OBJ_BOUND_METHOD: {
+			ObjBoundMethod* bound = (ObjBoundMethod*)object;
+			markValue(bound->receiver);
+			markValue(bound->method);
+			break;
+		}
+
+		case OBJ_INSTANCE: {
+			ObjInstance* instance = (ObjInstance*)object;
+			markObject((Obj*)instance->klass);
+			#if defined(HIDDEN_CLASSES)
+			markObject((Obj*)instance->shape);
+			for (int i = 0; i < instance->shape->fieldCount; i++)
+			{
+				markValue(instance->fields[i]);
+			}
+			#else
+			markTable(&instance->table);
+			#endif // HIDDEN_CLASSES
+			break;
+		}
+
+		case OBJ_STRING:
+		case OBJ_BUFFER:
+		case OBJ_NATIVE:
+			break;
+
 		default:
 			break;
 	}
 }
 
+/**
+ * markRoots - marks every object the VM can reach directly: the values
+ * on the stack, the closures of the active call frames, the open
+ * upvalues, the global variables and their names, the constants of the
+ * executing chunk and whatever the compiler is holding on to.
+*/
+static void markRoots()
+{
+	for (Value* slot = vm.stack; slot < vm.stackTop; slot++)
+	{
+		markValue(*slot);
+	}
+
+	for (int i = 0; i < vm.frameCount; i++)
+	{
+		markObject((Obj*)vm.frames[i].closure);
+	}
+
+	for (ObjUpvalue* upvalue = vm.openUpvalues;
+		 upvalue != NULL;
+		 upvalue = upvalue->next)
+	{
+		markObject((Obj*)upvalue);
+	}
+
+	markTable(&vm.globals);
+	markArray(&vm.globalValues);
+	markArray(&vm.globalNames);
+	if (vm.chunk != NULL) markChunk(vm.chunk);
+	markCompilerRoots();
+	markProfile();
+}
+
+/**
+ * traceReferences - keeps blackening gray objects until the gray stack
+ * is empty, at which point every reachable object has been marked.
+*/
+static void traceReferences()
+{
+	while (vm.grayCount > 0)
+	{
+		Obj* object = vm.grayStack[--vm.grayCount];
+		blackenObject(object);
+	}
+}
+
+/**
+ * sweep - walks the list of every allocated object, unlinking and freeing
+ * the ones left unmarked and clearing the mark on the survivors ready for
+ * the next collection.
+*/
+static void sweep()
+{
+	Obj* previous = NULL;
+	Obj* object = vm.objects;
+	while (object != NULL)
+	{
+		if (object->isMarked)
+		{
+			object->isMarked = false;
+			previous = object;
+			object = object->next;
+		} else
+		{
+			Obj* unreached = object;
+			object = object->next;
+			if (previous != NULL)
+			{
+				previous->next = object;
+			} else
+			{
+				vm.objects = object;
+			}
+			freeObject(unreached);
+		}
+	}
+}
+
+/**
+ * collectGarbage - performs a full mark-sweep collection. The string
+ * intern table holds its keys weakly, so strings only referenced from it
+ * are removed from it before they are swept. The next collection is
+ * scheduled once the heap grows by `GC_HEAP_GROW_FACTOR` over what
+ * survived this one.
+*/
+void collectGarbage()
+{
+	#if defined(DEBUG_LOG_GC)
+	printf("-- gc begin\n");
+	size_t before = vm.bytesAllocated;
+	#endif // DEBUG_LOG_GC
+
+	markRoots();
+	traceReferences();
+	tableRemoveWhite(&vm.strings);
+	sweep();
+
+	vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+
+	#if defined(DEBUG_LOG_GC)
+	printf("-- gc end\n");
+	printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+		   before - vm.bytesAllocated, before, vm.bytesAllocated, vm.nextGC);
+	#endif // DEBUG_LOG_GC
+}
+
 /**
  * freeObjects - walks the linked list and frees its nodes.
 */
@@ -66,5 +426,6 @@ void freeObjects()
 		freeObject(object);
 		object = next;
 	}
-	
+
+	free(vm.grayStack);
 }
\ No newline at end of file
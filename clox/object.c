@@ -9,8 +9,12 @@
 #define ALLOCATE_OBJ(type, objectType) \
 	(type*)allocateObject(sizeof(type), objectType)
 
+// results shorter than this are copied into a fresh interned string.
+// Anything longer goes into a growable buffer.
+#define CONCAT_MIN_LENGTH 32
+
 #define ALLOCATE_OBJ_VEC(type, length, objectType) \
-	(type*)allocateObject(sizeof(type) + length * sizeof(char) + 1, objectType)
+	(type*)allocateObject(STRING_VEC_SIZE(length), objectType)
 
 /**
  * allocateObject - allocates an object of the given size on the heap. Size
@@ -23,8 +27,14 @@ static Obj* allocateObject(size_t size, ObjType type)
 {
 	Obj* object = (Obj*)reallocate(NULL, 0, size);
 	object->type = type;
+	object->isMarked = false;
 	object->next = vm.objects;
 	vm.objects = object;
+
+	#if defined(DEBUG_LOG_GC)
+	printf("%p allocate %zu for %d\n", (void*)object, size, type);
+	#endif // DEBUG_LOG_GC
+
 	return object;
 }
 
@@ -82,14 +92,117 @@ ObjStringVec* takeStringVec(ObjStringVec* a, ObjStringVec* b)
 
 	ObjStringVec* interned = tableFindString(&vm.strings, string->chars, length, hash);
 	if (interned != NULL) {
-		FREE(ObjStringVec, string);
+		// the fresh string is still the head of the object list.
+		vm.objects = string->obj.next;
+		reallocate(string, STRING_VEC_SIZE(length), 0);
 		return interned;
 	}
 
+	// keep the string reachable in case growing the table triggers a GC.
+	push(OBJ_VAL(string));
 	tableSet(&vm.strings, string, NIL_VAL);
+	pop();
+	return string;
+}
+
+/**
+ * appendBuffer - copies the characters of a string onto the end of a
+ * buffer, growing it first if need be. The string's characters are looked
+ * up only after the buffer has grown since the string may live in it.
+ * @buffer: pointer to the buffer to append to.
+ * @string: pointer to the string being appended.
+*/
+static void appendBuffer(ObjBuffer* buffer, Obj* string)
+{
+	int length = stringLength(string);
+	if (buffer->capacity < buffer->length + length)
+	{
+		int oldCapacity = buffer->capacity;
+		int capacity = GROW_CAPACITY(oldCapacity);
+		if (capacity < buffer->length + length)
+		{
+			capacity = buffer->length + length;
+		}
+		buffer->chars = GROW_ARRAY(char, buffer->chars, oldCapacity, capacity);
+		buffer->capacity = capacity;
+	}
+
+	memcpy(buffer->chars + buffer->length, stringChars(string), length);
+	buffer->length += length;
+}
+
+/**
+ * newConcat - creates a string made of the first `length` characters of
+ * the given buffer.
+ * @buffer: pointer to the buffer holding the characters.
+ * @length: number of characters in the string.
+ * Return: pointer to the new string.
+*/
+static ObjConcat* newConcat(ObjBuffer* buffer, int length)
+{
+	ObjConcat* string = ALLOCATE_OBJ(ObjConcat, OBJ_CONCAT);
+	string->length = length;
+	string->buffer = buffer;
 	return string;
 }
 
+/**
+ * concatStrings - joins two strings. Short results are built eagerly as
+ * interned strings. Longer ones are written to a growable buffer. When the
+ * left operand already ends at the end of its buffer, the right operand is
+ * appended to that buffer in place, so building a string piece by piece
+ * costs amortised O(1) per step instead of copying the whole prefix (and
+ * hashing it) every time. Both operands must be reachable by the garbage
+ * collector for the duration of the call.
+ * @a: left operand, an `ObjStringVec` or an `ObjConcat`.
+ * @b: right operand, an `ObjStringVec` or an `ObjConcat`.
+ * Return: pointer to the resulting string object.
+*/
+Obj* concatStrings(Obj* a, Obj* b)
+{
+	int length = stringLength(a) + stringLength(b);
+
+	if (a->type == OBJ_CONCAT &&
+		((ObjConcat*)a)->length == ((ObjConcat*)a)->buffer->length)
+	{
+		ObjBuffer* buffer = ((ObjConcat*)a)->buffer;
+		appendBuffer(buffer, b);
+		return (Obj*)newConcat(buffer, length);
+	}
+
+	// a concatenated string is never shorter than the threshold, so both
+	// operands are plain strings here.
+	if (length < CONCAT_MIN_LENGTH)
+	{
+		return (Obj*)takeStringVec((ObjStringVec*)a, (ObjStringVec*)b);
+	}
+
+	ObjBuffer* buffer = ALLOCATE_OBJ(ObjBuffer, OBJ_BUFFER);
+	buffer->length = 0;
+	buffer->capacity = 0;
+	buffer->chars = NULL;
+
+	push(OBJ_VAL(buffer));
+	appendBuffer(buffer, a);
+	appendBuffer(buffer, b);
+	ObjConcat* string = newConcat(buffer, length);
+	pop();
+	return (Obj*)string;
+}
+
+/**
+ * stringsEqual - compares the characters of two strings of any kind.
+ * @a: pointer to the first string.
+ * @b: pointer to the second string.
+ * Return: true if both strings hold the same characters.
+*/
+bool stringsEqual(Obj* a, Obj* b)
+{
+	int length = stringLength(a);
+	if (length != stringLength(b)) return false;
+	return memcmp(stringChars(a), stringChars(b), length) == 0;
+}
+
 ObjStringVec* copyStringVec(const char* chars, int length)
 {
 	uint32_t hash = hashString(chars, length);
@@ -102,7 +215,9 @@ ObjStringVec* copyStringVec(const char* chars, int length)
 	string->chars[length] = '\0';
 	string->hash = hash;
 
+	push(OBJ_VAL(string));
 	tableSet(&vm.strings, string, NIL_VAL);
+	pop();
 	return string;
 }
 
@@ -124,6 +239,171 @@ ObjString* copyString(const char* chars, int length)
 	return allocateString(heapChars, length, hash);
 }
 
+/**
+ * newFunction - creates a function with no parameters, no name and an
+ * empty chunk for the compiler to fill in.
+ * Return: pointer to the new function.
+*/
+ObjFunction* newFunction()
+{
+	ObjFunction* function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
+	function->arity = 0;
+	function->upvalueCount = 0;
+	function->name = NULL;
+	initChunk(&function->chunk);
+	return function;
+}
+
+/**
+ * newNative - wraps a C function in an object Lox code can call.
+ * @function: the C function.
+ * Return: pointer to the new native function.
+*/
+ObjNative* newNative(NativeFn function)
+{
+	ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
+	native->function = function;
+	return native;
+}
+
+/**
+ * newClosure - wraps a function in a closure with room for each of the
+ * variables it captures. The slots start out empty so that a collection
+ * triggered while the VM fills them in finds nothing dangling.
+ * @function: the function.
+ * Return: pointer to the new closure.
+*/
+ObjClosure* newClosure(ObjFunction* function)
+{
+	ObjUpvalue** upvalues = ALLOCATE(ObjUpvalue*, function->upvalueCount);
+	for (int i = 0; i < function->upvalueCount; i++)
+	{
+		upvalues[i] = NULL;
+	}
+
+	ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
+	closure->function = function;
+	closure->upvalues = upvalues;
+	closure->upvalueCount = function->upvalueCount;
+	return closure;
+}
+
+/**
+ * newUpvalue - creates an open upvalue for the variable in the given slot.
+ * @slot: pointer to the variable's slot on the VM's stack.
+ * Return: pointer to the new upvalue.
+*/
+ObjUpvalue* newUpvalue(Value* slot)
+{
+	ObjUpvalue* upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
+	upvalue->location = slot;
+	upvalue->closed = NIL_VAL;
+	upvalue->next = NULL;
+	return upvalue;
+}
+
+/**
+ * newShape - creates a shape with no fields and no transitions.
+ * Return: pointer to the new shape.
+*/
+ObjShape* newShape()
+{
+	ObjShape* shape = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+	initTable(&shape->fields);
+	initTable(&shape->transitions);
+	shape->fieldCount = 0;
+	return shape;
+}
+
+/**
+ * shapeTransition - finds the shape an instance moves to when the given
+ * field is added to it, creating the shape the first time any instance of
+ * the shape gains that field.
+ * @shape: the instance's current shape, which must not have the field.
+ * @name: name of the field being added.
+ * Return: pointer to the shape with the field appended.
+*/
+ObjShape* shapeTransition(ObjShape* shape, ObjStringVec* name)
+{
+	Value next;
+	if (tableGet(&shape->transitions, name, &next)) return (ObjShape*)AS_OBJ(next);
+
+	ObjShape* child = newShape();
+	push(OBJ_VAL(child));
+	tableAddAll(&shape->fields, &child->fields);
+	tableSet(&child->fields, name, NUMBER_VAL(shape->fieldCount));
+	child->fieldCount = shape->fieldCount + 1;
+	tableSet(&shape->transitions, name, OBJ_VAL(child));
+	pop();
+	return child;
+}
+
+/**
+ * newClass - creates a class along with the empty shape its instances
+ * start out with.
+ * @name: name of the class.
+ * Return: pointer to the new class.
+*/
+ObjClass* newClass(ObjStringVec* name)
+{
+	ObjClass* klass = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
+	klass->name = name;
+	klass->shape = NULL;
+	initTable(&klass->methods);
+	klass->initializer = NIL_VAL;
+	push(OBJ_VAL(klass));
+	klass->shape = newShape();
+	pop();
+	return klass;
+}
+
+/**
+ * newInstance - creates an instance of a class with no fields.
+ * @klass: the class.
+ * Return: pointer to the new instance.
+*/
+ObjInstance* newInstance(ObjClass* klass)
+{
+	ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
+	instance->klass = klass;
+	#if defined(HIDDEN_CLASSES)
+	instance->shape = klass->shape;
+	instance->fields = NULL;
+	instance->fieldCapacity = 0;
+	#else
+	initTable(&instance->table);
+	#endif // HIDDEN_CLASSES
+	return instance;
+}
+
+/**
+ * newBoundMethod - binds a method to the instance it was read from.
+ * @receiver: the instance.
+ * @method: the method's function or closure.
+ * Return: pointer to the new bound method.
+*/
+ObjBoundMethod* newBoundMethod(Value receiver, Value method)
+{
+	ObjBoundMethod* bound = ALLOCATE_OBJ(ObjBoundMethod, OBJ_BOUND_METHOD);
+	bound->receiver = receiver;
+	bound->method = method;
+	return bound;
+}
+
+/**
+ * printFunction - prints a function by its name.
+ * @function: pointer to the function.
+*/
+static void printFunction(ObjFunction* function)
+{
+	if (function->name == NULL)
+	{
+		printf("<script>");
+		return;
+	}
+	printf("<fn %s>", function->name->chars);
+}
+
 void printObject(Value value)
 {
 	switch (OBJ_TYPE(value))
@@ -131,6 +411,47 @@ void printObject(Value value)
 		case OBJ_STRING:
 			printf("%s", AS_CSTRING(value));
 			break;
+
+		case OBJ_CONCAT:
+			printf("%.*s", AS_CONCAT(value)->length,
+				   AS_CONCAT(value)->buffer->chars);
+			break;
+
+		case OBJ_BUFFER:
+			printf("<buffer>");
+			break;
+
+		case OBJ_FUNCTION:
+			printFunction(AS_FUNCTION(value));
+			break;
+
+		case OBJ_NATIVE:
+			printf("<native fn>");
+			break;
+
+		case OBJ_CLOSURE:
+			printFunction(AS_CLOSURE(value)->function);
+			break;
+
+		case OBJ_UPVALUE:
+			printf("upvalue");
+			break;
+
+		case OBJ_SHAPE:
+			printf("<shape>");
+			break;
+
+		case OBJ_CLASS:
+			printf("%s", AS_CLASS(value)->name->chars);
+			break;
+
+		case OBJ_INSTANCE:
+			printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
+			break;
+
+		case OBJ_BOUND_METHOD:
+			printObject(AS_BOUND_METHOD(value)->method);
+			break;
 		
 		default:
 			break;
@@ -1,32 +1,65 @@
 #if !defined(clox_object_h)
 #define clox_object_h
 
+#include "chunk.h"
 #include "common.h"
+#include "table.h"
 #include "value.h"
 
 #define OBJ_TYPE(value)			(AS_OBJ(value)->type)
-#define IS_STRING(value)		isObjType(value, OBJ_STRING)
+#define IS_BOUND_METHOD(value)	isObjType(value, OBJ_BOUND_METHOD)
+#define IS_CLASS(value)			isObjType(value, OBJ_CLASS)
+#define IS_CLOSURE(value)		isObjType(value, OBJ_CLOSURE)
+#define IS_CONCAT(value)		isObjType(value, OBJ_CONCAT)
+#define IS_FUNCTION(value)		isObjType(value, OBJ_FUNCTION)
+#define IS_INSTANCE(value)		isObjType(value, OBJ_INSTANCE)
+#define IS_NATIVE(value)		isObjType(value, OBJ_NATIVE)
+#define IS_STRING(value) \
+	(isObjType(value, OBJ_STRING) || IS_CONCAT(value))
 
+#define AS_BOUND_METHOD(value)	((ObjBoundMethod*)AS_OBJ(value))
+#define AS_CLASS(value)			((ObjClass*)AS_OBJ(value))
+#define AS_CLOSURE(value)		((ObjClosure*)AS_OBJ(value))
+#define AS_CONCAT(value)		((ObjConcat*)AS_OBJ(value))
+#define AS_FUNCTION(value)		((ObjFunction*)AS_OBJ(value))
+#define AS_INSTANCE(value)		((ObjInstance*)AS_OBJ(value))
+#define AS_NATIVE(value)		(((ObjNative*)AS_OBJ(value))->function)
 #define AS_STRING(value)		((ObjStringVec*)AS_OBJ(value))
 #define AS_CSTRING(value)		(((ObjStringVec*)AS_OBJ(value))->chars)
 
+// size of the allocation backing an `ObjStringVec` of the given length.
+#define STRING_VEC_SIZE(length)	(sizeof(ObjStringVec) + (length) + 1)
+
 /**
  * enum _obj_type - defines the supported object types.
 */
 typedef enum _obj_type
 {
 	OBJ_STRING,
+	OBJ_BUFFER,
+	OBJ_CONCAT,
+	OBJ_FUNCTION,
+	OBJ_NATIVE,
+	OBJ_CLOSURE,
+	OBJ_UPVALUE,
+	OBJ_SHAPE,
+	OBJ_CLASS,
+	OBJ_INSTANCE,
+	OBJ_BOUND_METHOD,
 } ObjType;
 
 /**
  * struct Obj - contains the state shared across all object
  * types. Acts like a 'base class' for objects.
  * @type: the `type` tag of the object.
+ * @isMarked: whether the garbage collector reached the object during the
+ * current mark phase.
  * @next: pointer to the next `Obj` in the chain.
 */
 struct Obj
 {
 	ObjType type;
+	bool isMarked;
 	struct Obj* next;
 };
 
@@ -64,15 +97,228 @@ struct ObjStringVec
 	char chars[];
 };
 
+/**
+ * struct ObjBuffer - a growable array of characters that strings built up
+ * with `+` append to in place. Never visible to user code on its own.
+ * @obj: common state shared by all `object` types.
+ * @length: number of characters written to the buffer.
+ * @capacity: allocated size of the buffer.
+ * @chars: pointer to the heap-allocated characters. Not null-terminated.
+*/
+typedef struct ObjBuffer
+{
+	Obj obj;
+	int length;
+	int capacity;
+	char* chars;
+} ObjBuffer;
+
+/**
+ * struct ObjConcat - a string produced by concatenation. Its characters are
+ * the first `length` characters of a shared `ObjBuffer`, which lets the
+ * next `+` append to the buffer instead of copying the whole string again.
+ * Unlike `ObjStringVec`, it is neither hashed nor interned.
+ * @obj: common state shared by all `object` types.
+ * @length: number of characters in the string.
+ * @buffer: pointer to the buffer holding the characters.
+*/
+typedef struct ObjConcat
+{
+	Obj obj;
+	int length;
+	ObjBuffer* buffer;
+} ObjConcat;
+
+/**
+ * struct ObjFunction - a function compiled to its own chunk of bytecode.
+ * @obj: common state shared by all `object` types.
+ * @arity: number of parameters the function expects.
+ * @upvalueCount: number of variables of enclosing functions it captures.
+ * @chunk: the function's bytecode.
+ * @name: name of the function.
+*/
+typedef struct ObjFunction
+{
+	Obj obj;
+	int arity;
+	int upvalueCount;
+	Chunk chunk;
+	ObjStringVec* name;
+} ObjFunction;
+
+/**
+ * NativeFn - signature of a function implemented in C.
+ * @argCount: number of arguments passed.
+ * @args: pointer to the first argument on the VM's stack.
+ * Return: the value of the call.
+*/
+typedef Value (*NativeFn)(int argCount, Value* args);
+
+/**
+ * struct ObjNative - wraps a C function so Lox code can call it.
+ * @obj: common state shared by all `object` types.
+ * @function: the C function.
+*/
+typedef struct ObjNative
+{
+	Obj obj;
+	NativeFn function;
+} ObjNative;
+
+/**
+ * struct ObjUpvalue - a variable captured by a closure. While the
+ * variable's frame is live the upvalue is open and points at the
+ * variable's slot on the VM's stack; when the frame exits the value is
+ * copied into the upvalue itself and `location` points at that copy.
+ * @obj: common state shared by all `object` types.
+ * @location: pointer to the captured variable.
+ * @closed: holds the variable once it is closed over.
+ * @next: next open upvalue, ordered by decreasing stack slot.
+*/
+typedef struct ObjUpvalue
+{
+	Obj obj;
+	Value* location;
+	Value closed;
+	struct ObjUpvalue* next;
+} ObjUpvalue;
+
+/**
+ * struct ObjClosure - a function paired with the variables it captures.
+ * Only functions that capture something are wrapped in a closure.
+ * @obj: common state shared by all `object` types.
+ * @function: the function.
+ * @upvalues: array of the captured variables.
+ * @upvalueCount: number of captured variables.
+*/
+typedef struct ObjClosure
+{
+	Obj obj;
+	ObjFunction* function;
+	ObjUpvalue** upvalues;
+	int upvalueCount;
+} ObjClosure;
+
+/**
+ * struct ObjShape - the layout shared by every instance that was given
+ * the same fields in the same order (a hidden class). Adding a field moves
+ * an instance along a transition to the shape with that field appended,
+ * so instances built the same way end up sharing shapes and a property
+ * access site can cache a field's slot per shape.
+ * @obj: common state shared by all `object` types.
+ * @fields: maps each field name to its index in the instance's fields.
+ * @transitions: maps a field name to the shape reached by adding it.
+ * @fieldCount: number of fields an instance of this shape has.
+*/
+struct ObjShape
+{
+	Obj obj;
+	Table fields;
+	Table transitions;
+	int fieldCount;
+};
+
+/**
+ * struct ObjClass - a class. Each class has its own tree of shapes rooted
+ * at the empty shape its new instances start out with. A class's methods
+ * never change once its declaration has run, so a shape also stands for
+ * the methods its instances respond to.
+ * @obj: common state shared by all `object` types.
+ * @name: name of the class.
+ * @shape: shape of an instance with no fields.
+ * @methods: maps each method name to its function or closure, inherited
+ * methods included.
+ * @initializer: the `init` method, kept out of `methods` lookups since
+ * every instantiation needs it, or nil if the class has none.
+*/
+typedef struct ObjClass
+{
+	Obj obj;
+	ObjStringVec* name;
+	ObjShape* shape;
+	Table methods;
+	Value initializer;
+} ObjClass;
+
+/**
+ * struct ObjInstance - an instance of a class.
+ * @obj: common state shared by all `object` types.
+ * @klass: the instance's class.
+ * @shape: describes which field lives in which slot of `fields`.
+ * @fields: the values of the fields, in the order they were added.
+ * @fieldCapacity: allocated size of `fields`.
+ * @table: the fields keyed by name when `HIDDEN_CLASSES` is off.
+*/
+typedef struct ObjInstance
+{
+	Obj obj;
+	ObjClass* klass;
+	#if defined(HIDDEN_CLASSES)
+	ObjShape* shape;
+	Value* fields;
+	int fieldCapacity;
+	#else
+	Table table;
+	#endif // HIDDEN_CLASSES
+} ObjInstance;
+
+/**
+ * struct ObjBoundMethod - a method read off an instance without calling
+ * it, which remembers the instance to use as `this`.
+ * @obj: common state shared by all `object` types.
+ * @receiver: the instance.
+ * @method: the method's function or closure.
+*/
+typedef struct ObjBoundMethod
+{
+	Obj obj;
+	Value receiver;
+	Value method;
+} ObjBoundMethod;
+
 static inline bool isObjType(Value value, ObjType type)
 {
 	return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+/**
+ * stringChars - gets the characters of any kind of string object.
+ * @string: pointer to an `ObjStringVec` or an `ObjConcat`.
+ * Return: pointer to the first character. Only `ObjStringVec` characters
+ * are null-terminated.
+*/
+static inline const char* stringChars(Obj* string)
+{
+	if (string->type == OBJ_CONCAT) return ((ObjConcat*)string)->buffer->chars;
+	return ((ObjStringVec*)string)->chars;
+}
+
+/**
+ * stringLength - gets the length of any kind of string object.
+ * @string: pointer to an `ObjStringVec` or an `ObjConcat`.
+ * Return: number of characters in the string.
+*/
+static inline int stringLength(Obj* string)
+{
+	if (string->type == OBJ_CONCAT) return ((ObjConcat*)string)->length;
+	return ((ObjStringVec*)string)->length;
+}
+
 ObjString* takeString(char* chars, int length);
 ObjString* copyString(const char* chars, int length);
 ObjStringVec* takeStringVec(ObjStringVec* a, ObjStringVec* b);
 ObjStringVec* copyStringVec(const char* chars, int length);
+Obj* concatStrings(Obj* a, Obj* b);
+bool stringsEqual(Obj* a, Obj* b);
+ObjFunction* newFunction();
+ObjNative* newNative(NativeFn function);
+ObjClosure* newClosure(ObjFunction* function);
+ObjUpvalue* newUpvalue(Value* slot);
+ObjShape* newShape();
+ObjShape* shapeTransition(ObjShape* shape, ObjStringVec* name);
+ObjClass* newClass(ObjStringVec* name);
+ObjInstance* newInstance(ObjClass* klass);
+ObjBoundMethod* newBoundMethod(Value receiver, Value method);
 void printObject(Value value);
 
 
@@ -0,0 +1,311 @@
+#include <stdlib.h>
+
+#include "debug.h"
+#include "memory.h"
+#include "optimizer.h"
+
+// a chain of jumps longer than this is assumed to be a cycle.
+#define MAX_THREADING 16
+
+/**
+ * isJump - tests whether an opcode is a forward jump with a 16-bit offset.
+ * @opcode: the opcode.
+ * Return: true for the jump instructions.
+*/
+static bool isJump(uint8_t opcode)
+{
+	return opcode == OP_JUMP || opcode == OP_JUMP_IF_FALSE;
+}
+
+/**
+ * isBranch - tests whether an opcode transfers control elsewhere, either
+ * forward or back to a loop header.
+ * @opcode: the opcode.
+ * Return: true for the jump and loop instructions.
+*/
+static bool isBranch(uint8_t opcode)
+{
+	return isJump(opcode) || opcode == OP_LOOP;
+}
+
+/**
+ * jumpTarget - decodes the offset a jump or loop instruction lands on.
+ * @chunk: the chunk holding the jump.
+ * @offset: offset of the jump instruction.
+ * Return: offset of the jump's destination.
+*/
+static int jumpTarget(Chunk* chunk, int offset)
+{
+	uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+	jump |= chunk->code[offset + 2];
+	if (chunk->code[offset] == OP_LOOP) return offset + 5 - jump;
+	return offset + 3 + jump;
+}
+
+/**
+ * threadJump - follows a chain of jumps to its final destination. Any
+ * jump landing on an `OP_JUMP` can go straight to where that one goes.
+ * `OP_JUMP_IF_FALSE` leaves its condition on the stack, so one that lands
+ * on another `OP_JUMP_IF_FALSE` would take that jump as well. Threading
+ * stops before the jump's offset would no longer fit in 16 bits.
+ * @chunk: the chunk holding the jump.
+ * @offset: offset of the jump instruction.
+ * Return: offset of the final destination.
+*/
+static int threadJump(Chunk* chunk, int offset)
+{
+	uint8_t opcode = chunk->code[offset];
+	int target = jumpTarget(chunk, offset);
+	// a loop's jump back is where its iterations are counted.
+	if (opcode == OP_LOOP) return target;
+
+	for (int i = 0; i < MAX_THREADING && target < chunk->count; i++)
+	{
+		uint8_t next = chunk->code[target];
+		if (next != OP_JUMP &&
+			!(opcode == OP_JUMP_IF_FALSE && next == OP_JUMP_IF_FALSE))
+		{
+			break;
+		}
+
+		int destination = jumpTarget(chunk, target);
+		if (destination - (offset + 3) > UINT16_MAX) break;
+		target = destination;
+	}
+	return target;
+}
+
+/**
+ * fusedOpcode - gets the single opcode that does the work of the given
+ * opcode followed by `OP_NOT`.
+ * @opcode: the opcode preceding an `OP_NOT`.
+ * Return: the fused opcode, or -1 if there is none.
+*/
+static int fusedOpcode(uint8_t opcode)
+{
+	switch (opcode)
+	{
+		case OP_EQUAL: return OP_NOT_EQUAL;
+		case OP_LESS: return OP_GREATER_EQUAL;
+		case OP_GREATER: return OP_LESS_EQUAL;
+		default: return -1;
+	}
+}
+
+/**
+ * movedOffset - looks up where an instruction ended up after rewriting.
+ * @moves: pairs of old and new offsets, sorted by the old offset.
+ * @count: number of pairs.
+ * @offset: old offset of a jump or jump target.
+ * Return: the instruction's new offset.
+*/
+static int movedOffset(int* moves, int count, int offset)
+{
+	int low = 0;
+	int high = count - 1;
+	while (low < high)
+	{
+		int mid = low + (high - low) / 2;
+		if (moves[mid * 2] < offset) low = mid + 1;
+		else high = mid;
+	}
+	return moves[low * 2 + 1];
+}
+
+/**
+ * countOpcodes - tallies how many times each opcode occurs in a chunk.
+ * @chunk: the chunk to scan.
+ * @counts: array of `UINT8_COUNT` counters to fill in.
+ * Return: the total number of instructions.
+*/
+static int countOpcodes(Chunk* chunk, int* counts)
+{
+	int total = 0;
+	for (int offset = 0; offset < chunk->count;
+		 offset += instructionLength(chunk, offset))
+	{
+		counts[chunk->code[offset]]++;
+		total++;
+	}
+	return total;
+}
+
+/**
+ * printReport - prints the number of instructions of each opcode before
+ * and after optimizing along with the size of the code.
+ * @before: opcode counts of the unoptimized chunk.
+ * @after: opcode counts of the optimized chunk.
+ * @totals: total instructions before and after.
+ * @sizes: code size in bytes before and after.
+*/
+static void printReport(int* before, int* after, int* totals, int* sizes)
+{
+	fprintf(stderr, "== optimizer report ==\n");
+	fprintf(stderr, "%-18s %8s %8s\n", "opcode", "before", "after");
+	for (int i = 0; i < UINT8_COUNT; i++)
+	{
+		if (before[i] == 0 && after[i] == 0) continue;
+		fprintf(stderr, "%-18s %8d %8d\n", opcodeName(i), before[i], after[i]);
+	}
+	fprintf(stderr, "%-18s %8d %8d\n", "instructions", totals[0], totals[1]);
+	fprintf(stderr, "%-18s %8d %8d\n", "bytes", sizes[0], sizes[1]);
+}
+
+/**
+ * optimizeChunk - peephole optimizer run over a finished chunk. It
+ * rewrites the bytecode into a fresh buffer, applying these rewrites:
+ * - forward jumps to jumps are threaded straight to their final
+ *   destination and an `OP_JUMP` to the very next instruction is dropped.
+ * - `OP_EQUAL`, `OP_LESS` or `OP_GREATER` followed by `OP_NOT` become
+ *   `OP_NOT_EQUAL`, `OP_GREATER_EQUAL` and `OP_LESS_EQUAL`.
+ * - runs of `OP_POP` become a single `OP_POPN`.
+ * No rewrite spans an instruction that some jump or loop lands on.
+ * Afterwards every jump and loop offset is recomputed for the new layout and each instruction
+ * keeps the source line of the instruction it came from.
+ * @chunk: the chunk to optimize in place. Its constants are untouched.
+ * @report: whether to print the opcode counts before and after.
+*/
+void optimizeChunk(Chunk* chunk, bool report)
+{
+	int count = chunk->count;
+	int jumpCount = 0;
+	for (int offset = 0; offset < count;
+		 offset += instructionLength(chunk, offset))
+	{
+		if (isBranch(chunk->code[offset])) jumpCount++;
+	}
+
+	// each jump is recorded as a pair of its old offset and destination.
+	int* jumps = malloc(sizeof(int) * 2 * (jumpCount + 1));
+	bool* isTarget = calloc(count + 1, sizeof(bool));
+	int* moves = malloc(sizeof(int) * 2 * (jumpCount * 2 + 1));
+	if (jumps == NULL || isTarget == NULL || moves == NULL)
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	for (int offset = 0, jump = 0; offset < count;
+		 offset += instructionLength(chunk, offset))
+	{
+		if (!isBranch(chunk->code[offset])) continue;
+		jumps[jump * 2] = offset;
+		jumps[jump * 2 + 1] = threadJump(chunk, offset);
+		isTarget[jumps[jump * 2 + 1]] = true;
+		jump++;
+	}
+
+	// the result is never longer than the original.
+	Chunk optimized;
+	initChunk(&optimized);
+	optimized.code = GROW_ARRAY(uint8_t, NULL, 0, count);
+	optimized.capacity = count;
+	int jump = 0;
+	int moveCount = 0;
+	int lineIndex = 0;
+
+	for (int offset = 0; offset < count;)
+	{
+		// the old offsets only increase so the line table is walked in step.
+		while (lineIndex + 1 < chunk->lineCount &&
+			   chunk->lines[lineIndex + 1].offset <= offset)
+		{
+			lineIndex++;
+		}
+
+		uint8_t opcode = chunk->code[offset];
+		int line = chunk->lines[lineIndex].line;
+		int next = offset + instructionLength(chunk, offset);
+		if (isTarget[offset] || isBranch(opcode))
+		{
+			moves[moveCount * 2] = offset;
+			moves[moveCount * 2 + 1] = optimized.count;
+			moveCount++;
+		}
+
+		if (opcode == OP_JUMP && jumps[jump * 2 + 1] == next)
+		{
+			// keep the pair but mark it dropped so it is not patched.
+			jumps[jump * 2] = -1;
+			jump++;
+			offset = next;
+			continue;
+		}
+
+		if (next < count && chunk->code[next] == OP_NOT &&
+			!isTarget[next] && fusedOpcode(opcode) != -1)
+		{
+			writeChunk(&optimized, (uint8_t)fusedOpcode(opcode), line);
+			offset = next + 1;
+			continue;
+		}
+
+		if (opcode == OP_POP)
+		{
+			int pops = 1;
+			while (next < count && chunk->code[next] == OP_POP &&
+				   !isTarget[next] && pops < UINT8_MAX)
+			{
+				pops++;
+				next++;
+			}
+
+			if (pops > 1)
+			{
+				writeChunk(&optimized, OP_POPN, line);
+				writeChunk(&optimized, (uint8_t)pops, line);
+			} else
+			{
+				writeChunk(&optimized, OP_POP, line);
+			}
+			offset = next;
+			continue;
+		}
+
+		// jump offsets are patched once every instruction has moved.
+		if (isBranch(opcode)) jump++;
+
+		for (int i = offset; i < next; i++)
+		{
+			writeChunk(&optimized, chunk->code[i], line);
+		}
+		offset = next;
+	}
+	moves[moveCount * 2] = count;
+	moves[moveCount * 2 + 1] = optimized.count;
+	moveCount++;
+
+	for (int i = 0; i < jumpCount; i++)
+	{
+		if (jumps[i * 2] == -1) continue;
+		int from = movedOffset(moves, moveCount, jumps[i * 2]);
+		int to = movedOffset(moves, moveCount, jumps[i * 2 + 1]);
+		int distance = optimized.code[from] == OP_LOOP
+			? (from + 5) - to
+			: to - (from + 3);
+		optimized.code[from + 1] = (distance >> 8) & 0xff;
+		optimized.code[from + 2] = distance & 0xff;
+	}
+
+	if (report)
+	{
+		int before[UINT8_COUNT] = { 0 };
+		int after[UINT8_COUNT] = { 0 };
+		int totals[2] = { countOpcodes(chunk, before),
+						  countOpcodes(&optimized, after) };
+		int sizes[2] = { chunk->count, optimized.count };
+		printReport(before, after, totals, sizes);
+	}
+
+	FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+	FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
+	chunk->code = optimized.code;
+	chunk->count = optimized.count;
+	chunk->capacity = optimized.capacity;
+	chunk->lines = optimized.lines;
+	chunk->lineCount = optimized.lineCount;
+	chunk->lineCapacity = optimized.lineCapacity;
+
+	free(jumps);
+	free(isTarget);
+	free(moves);
+}
@@ -0,0 +1,8 @@
+#if !defined(clox_optimizer_h)
+#define clox_optimizer_h
+
+#include "chunk.h"
+
+void optimizeChunk(Chunk* chunk, bool report);
+
+#endif // clox_optimizer_h
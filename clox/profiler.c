@@ -0,0 +1,346 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "memory.h"
+#include "object.h"
+#include "profiler.h"
+#include "vm.h"
+
+/**
+ * The profiler samples the call stack from a `SIGPROF` handler, which
+ * `setitimer` raises at a fixed rate of CPU time. Each sample walks the
+ * frames from the outermost in, mapping every frame's `ip` to a source
+ * line through the chunk's line table, and counts one hit against the
+ * node of a calling context tree for that stack. The handler cannot
+ * allocate, so the tree lives in arrays sized up front and is found
+ * through an open-addressed hash table. The VM publishes a frame only
+ * once it is filled in and pauses the profiler while it moves the frame
+ * array, which is all the handler needs to see a consistent stack.
+ * Frames running JIT or `--emit-c` code keep the `ip` they were entered
+ * at, and frames on the register VM the `ip` of their last call, so their
+ * samples land on that line.
+*/
+
+/**
+ * struct profileNode - one frame of a sampled stack, under the node of
+ * the frames that called it.
+ * @parent: index of the caller's node, or -1 for the root.
+ * @chunk: chunk the frame runs, or NULL for the stand-in of the frames
+ * cut off from a deep stack.
+ * @function: function of the frame, or NULL for the script.
+ * @line: source line the frame is at.
+ * @samples: samples taken with this node innermost.
+*/
+typedef struct profileNode
+{
+	int parent;
+	Chunk* chunk;
+	ObjFunction* function;
+	int line;
+	uint64_t samples;
+} ProfileNode;
+
+/**
+ * struct profiler - the profile being collected.
+ * @nodes: the calling context tree. Node 0 is its root.
+ * @nodeCount: number of nodes in use.
+ * @buckets: hash table of node indices, -1 where empty.
+ * @samples: samples recorded.
+ * @dropped: samples that could not be recorded.
+ * @previous: the `SIGPROF` action before profiling started.
+*/
+typedef struct profiler
+{
+	ProfileNode* nodes;
+	int nodeCount;
+	int* buckets;
+	uint64_t samples;
+	uint64_t dropped;
+	struct sigaction previous;
+} Profiler;
+
+#define PROFILE_BUCKETS (PROFILE_NODES * 2)
+
+static Profiler profiler;
+volatile sig_atomic_t profilerPaused = 0;
+
+/**
+ * findNode - looks up the child of a node for a frame, adding it if it is
+ * new. Safe to call from a signal handler.
+ * @parent: index of the caller's node.
+ * @chunk: chunk the frame runs.
+ * @function: function of the frame.
+ * @line: source line the frame is at.
+ * Return: index of the node, or -1 if the profile is full.
+*/
+static int findNode(int parent, Chunk* chunk, ObjFunction* function, int line)
+{
+	uint32_t hash = (uint32_t)parent * 31u +
+					(uint32_t)((uintptr_t)chunk >> 4) * 17u + (uint32_t)line;
+	hash *= 2654435761u;
+
+	for (uint32_t index = hash & (PROFILE_BUCKETS - 1);;
+		 index = (index + 1) & (PROFILE_BUCKETS - 1))
+	{
+		int node = profiler.buckets[index];
+		if (node == -1)
+		{
+			if (profiler.nodeCount == PROFILE_NODES) return -1;
+			node = profiler.nodeCount++;
+			profiler.nodes[node] =
+				(ProfileNode){ parent, chunk, function, line, 0 };
+			profiler.buckets[index] = node;
+			return node;
+		}
+
+		ProfileNode* candidate = &profiler.nodes[node];
+		if (candidate->parent == parent && candidate->chunk == chunk &&
+			candidate->line == line)
+		{
+			return node;
+		}
+	}
+}
+
+/**
+ * sampleHandler - records the current call stack.
+ * @signal: SIGPROF.
+*/
+static void sampleHandler(int signal)
+{
+	(void)signal;
+	if (profilerPaused)
+	{
+		profiler.dropped++;
+		return;
+	}
+
+	int frameCount = vm.frameCount;
+	int first = frameCount > PROFILE_DEPTH ? frameCount - PROFILE_DEPTH : 0;
+	int node = 0;
+	if (first > 0) node = findNode(node, NULL, NULL, 0);
+
+	for (int i = first; i < frameCount && node != -1; i++)
+	{
+		CallFrame* frame = &vm.frames[i];
+		// `ip` is already past the instruction being run, or past the
+		// call a caller waits on.
+		int offset = (int)(frame->ip - frame->chunk->code);
+		int line = getLine(frame->chunk, offset > 0 ? offset - 1 : 0);
+		node = findNode(node, frame->chunk, frame->function, line);
+	}
+
+	if (node == -1)
+	{
+		profiler.dropped++;
+		return;
+	}
+	profiler.nodes[node].samples++;
+	profiler.samples++;
+}
+
+/**
+ * startProfiler - starts sampling the call stack.
+ * @rate: samples per second of CPU time.
+*/
+void startProfiler(int rate)
+{
+	profiler.nodes = malloc(sizeof(ProfileNode) * PROFILE_NODES);
+	profiler.buckets = malloc(sizeof(int) * PROFILE_BUCKETS);
+	if (profiler.nodes == NULL || profiler.buckets == NULL)
+	{
+		exit(EXIT_FAILURE);
+	}
+	memset(profiler.buckets, -1, sizeof(int) * PROFILE_BUCKETS);
+	profiler.nodes[0] = (ProfileNode){ -1, NULL, NULL, 0, 0 };
+	profiler.nodeCount = 1;
+	profiler.samples = 0;
+	profiler.dropped = 0;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sampleHandler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPROF, &action, &profiler.previous);
+
+	long interval = 1000000L / rate;
+	if (interval < 1) interval = 1;
+	struct itimerval timer;
+	timer.it_interval.tv_sec = interval / 1000000L;
+	timer.it_interval.tv_usec = interval % 1000000L;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/**
+ * frameName - writes the name of a node's frame, as "function:line".
+ * @file: the output file.
+ * @node: the node.
+*/
+static void frameName(FILE* file, ProfileNode* node)
+{
+	if (node->chunk == NULL)
+	{
+		fprintf(file, "...");
+	} else if (node->function == NULL)
+	{
+		fprintf(file, "<script>:%d", node->line);
+	} else
+	{
+		fprintf(file, "%s:%d", node->function->name->chars, node->line);
+	}
+}
+
+/**
+ * compareLines - orders nodes by chunk and line for qsort.
+ * @a: pointer to the first node.
+ * @b: pointer to the second node.
+ * Return: negative, zero or positive as `a` comes before, with or after `b`.
+*/
+static int compareLines(const void* a, const void* b)
+{
+	const ProfileNode* x = a;
+	const ProfileNode* y = b;
+	if (x->chunk != y->chunk)
+	{
+		return (uintptr_t)x->chunk < (uintptr_t)y->chunk ? -1 : 1;
+	}
+	return x->line - y->line;
+}
+
+/**
+ * compareSamples - orders nodes by samples, most first, for qsort.
+ * @a: pointer to the first node.
+ * @b: pointer to the second node.
+ * Return: negative, zero or positive as `a` comes before, with or after `b`.
+*/
+static int compareSamples(const void* a, const void* b)
+{
+	uint64_t x = ((const ProfileNode*)a)->samples;
+	uint64_t y = ((const ProfileNode*)b)->samples;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/**
+ * printFlatProfile - prints the samples taken on each source line,
+ * whatever called it, busiest line first.
+*/
+static void printFlatProfile()
+{
+	ProfileNode* lines = malloc(sizeof(ProfileNode) * profiler.nodeCount);
+	if (lines == NULL) exit(EXIT_FAILURE);
+	int count = 0;
+	for (int i = 1; i < profiler.nodeCount; i++)
+	{
+		if (profiler.nodes[i].samples > 0) lines[count++] = profiler.nodes[i];
+	}
+
+	// add together the nodes of each line across its callers.
+	if (count > 0) qsort(lines, count, sizeof(ProfileNode), compareLines);
+	int merged = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (merged > 0 && compareLines(&lines[merged - 1], &lines[i]) == 0)
+		{
+			lines[merged - 1].samples += lines[i].samples;
+		} else
+		{
+			lines[merged++] = lines[i];
+		}
+	}
+	if (merged > 0) qsort(lines, merged, sizeof(ProfileNode), compareSamples);
+
+	// keep the report after the program's own output.
+	fflush(stdout);
+	fprintf(stderr, "== profile ==\n");
+	fprintf(stderr, "%10s %7s  %s\n", "samples", "percent", "line");
+	for (int i = 0; i < merged; i++)
+	{
+		fprintf(stderr, "%10llu %6.2f%%  ",
+				(unsigned long long)lines[i].samples,
+				100.0 * lines[i].samples / profiler.samples);
+		frameName(stderr, &lines[i]);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "%llu samples, %llu dropped\n",
+			(unsigned long long)profiler.samples,
+			(unsigned long long)profiler.dropped);
+	free(lines);
+}
+
+/**
+ * writeCollapsedStacks - writes each sampled stack with its samples, one
+ * line per stack with the frames outermost first and separated by
+ * semicolons: the collapsed format flamegraph tools read.
+ * @path: path of the file to write.
+*/
+static void writeCollapsedStacks(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Error: Could not open file \"%s\".\n", path);
+		return;
+	}
+
+	int stack[PROFILE_DEPTH + 1];
+	for (int i = 1; i < profiler.nodeCount; i++)
+	{
+		if (profiler.nodes[i].samples == 0) continue;
+
+		int depth = 0;
+		for (int node = i; node > 0; node = profiler.nodes[node].parent)
+		{
+			stack[depth++] = node;
+		}
+		while (depth > 0)
+		{
+			frameName(file, &profiler.nodes[stack[--depth]]);
+			fprintf(file, "%s", depth > 0 ? ";" : "");
+		}
+		fprintf(file, " %llu\n", (unsigned long long)profiler.nodes[i].samples);
+	}
+
+	if (fclose(file) != 0)
+	{
+		fprintf(stderr, "Error: Could not write file \"%s\".\n", path);
+	}
+}
+
+/**
+ * stopProfiler - stops sampling, prints the flat profile and writes the
+ * collapsed stacks.
+ * @path: path of the file to write the collapsed stacks to.
+*/
+void stopProfiler(const char* path)
+{
+	struct itimerval timer;
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+	// a signal still pending must not kill the process.
+	signal(SIGPROF, SIG_IGN);
+
+	printFlatProfile();
+	writeCollapsedStacks(path);
+
+	sigaction(SIGPROF, &profiler.previous, NULL);
+	free(profiler.nodes);
+	free(profiler.buckets);
+	profiler.nodes = NULL;
+	profiler.buckets = NULL;
+	profiler.nodeCount = 0;
+}
+
+/**
+ * markProfile - marks the functions the profile refers to, so that they
+ * live until it is reported.
+*/
+void markProfile()
+{
+	for (int i = 0; i < profiler.nodeCount; i++)
+	{
+		markObject((Obj*)profiler.nodes[i].function);
+	}
+}
@@ -0,0 +1,24 @@
+#if !defined(clox_profiler_h)
+#define clox_profiler_h
+
+#include <signal.h>
+
+#include "common.h"
+
+// samples taken per second of CPU time unless `--profile-rate` says
+// otherwise. The kernel may deliver fewer, as few as one per timer tick.
+#define PROFILE_RATE_DEFAULT 1000
+// innermost frames recorded per sample. Deeper stacks are cut off and
+// rooted at a frame named "...".
+#define PROFILE_DEPTH 128
+// distinct (caller stack, function, line) nodes the profile can hold.
+// Samples that would need more are counted as dropped.
+#define PROFILE_NODES (1 << 16)
+
+extern volatile sig_atomic_t profilerPaused;
+
+void startProfiler(int rate);
+void stopProfiler(const char* path);
+void markProfile();
+
+#endif // clox_profiler_h
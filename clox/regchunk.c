@@ -0,0 +1,673 @@
+#include <stdlib.h>
+
+#include "memory.h"
+#include "regchunk.h"
+#include "vm.h"
+
+/**
+ * struct translator - state of the translation of one chunk. The value
+ * stack of the stack-based code is simulated at compile time: every value
+ * on it is described by an `RK` operand saying where the value lives
+ * right now. A value only gets copied into its own stack slot (its
+ * "home" register) once something would otherwise overwrite it or
+ * control flow merges, which is what turns loads of locals and
+ * constants into plain operands instead of instructions.
+ * @chunk: the stack-based chunk being translated.
+ * @out: the register chunk being written.
+ * @operands: where each value on the simulated stack lives.
+ * @depth: number of values on the simulated stack.
+ * @origin: offset of the stack instruction being translated.
+ * @failure: why the instruction at `origin` stopped the translation, or
+ * NULL.
+*/
+typedef struct translator
+{
+	Chunk* chunk;
+	RegChunk* out;
+	uint16_t operands[STACK_INITIAL];
+	int depth;
+	int origin;
+	const char* failure;
+} Translator;
+
+void initRegChunk(RegChunk* chunk)
+{
+	chunk->source = NULL;
+	chunk->count = 0;
+	chunk->capacity = 0;
+	chunk->code = NULL;
+	chunk->origins = NULL;
+	chunk->registerCount = 0;
+	initValueArray(&chunk->constants);
+}
+
+void freeRegChunk(RegChunk* chunk)
+{
+	FREE_ARRAY(RegInstruction, chunk->code, chunk->capacity);
+	FREE_ARRAY(int, chunk->origins, chunk->capacity);
+	freeValueArray(&chunk->constants);
+	initRegChunk(chunk);
+}
+
+/**
+ * deleteRegChunk - frees a register chunk made for a `Chunk` along with
+ * its contents.
+ * @chunk: the register chunk, or NULL.
+*/
+void deleteRegChunk(RegChunk* chunk)
+{
+	if (chunk == NULL) return;
+	freeRegChunk(chunk);
+	FREE(RegChunk, chunk);
+}
+
+/**
+ * fail - stops the translation at the instruction being translated.
+ * @t: the translator.
+ * @reason: what keeps the instruction from being translated.
+ * Return: false, for the caller to pass on.
+*/
+static bool fail(Translator* t, const char* reason)
+{
+	t->failure = reason;
+	return false;
+}
+
+/**
+ * emit - appends an instruction to the register chunk.
+ * @t: the translator.
+ * @op: the `RegOpcode`.
+ * @a: the destination or first operand.
+ * @b: the first source operand.
+ * @c: the second source operand.
+ * Return: index of the instruction.
+*/
+static int emit(Translator* t, RegOpcode op, int a, int b, int c)
+{
+	RegChunk* out = t->out;
+	if (out->capacity < out->count + 1)
+	{
+		int oldCapacity = out->capacity;
+		out->capacity = GROW_CAPACITY(oldCapacity);
+		out->code = GROW_ARRAY(RegInstruction, out->code,
+							   oldCapacity, out->capacity);
+		out->origins = GROW_ARRAY(int, out->origins,
+								  oldCapacity, out->capacity);
+	}
+
+	RegInstruction* instruction = &out->code[out->count];
+	instruction->op = (uint16_t)op;
+	instruction->a = (uint16_t)a;
+	instruction->b = (uint16_t)b;
+	instruction->c = (uint16_t)c;
+	out->origins[out->count] = t->origin;
+	return out->count++;
+}
+
+/**
+ * release - copies every value that lives in the given register into its
+ * home register, so that the register can be overwritten.
+ * @t: the translator.
+ * @reg: the register about to be written.
+*/
+static void release(Translator* t, int reg)
+{
+	for (int i = 0; i < t->depth; i++)
+	{
+		if (i != reg && t->operands[i] == reg)
+		{
+			emit(t, ROP_MOVE, i, reg, 0);
+			t->operands[i] = (uint16_t)i;
+		}
+	}
+}
+
+/**
+ * flushFrom - copies the values on the simulated stack from the given
+ * slot up into their home registers.
+ * @t: the translator.
+ * @from: the lowest slot to copy.
+*/
+static void flushFrom(Translator* t, int from)
+{
+	for (int i = from; i < t->depth; i++)
+	{
+		if (t->operands[i] != i)
+		{
+			emit(t, ROP_MOVE, i, t->operands[i], 0);
+			t->operands[i] = (uint16_t)i;
+		}
+	}
+}
+
+/**
+ * flush - copies every value on the simulated stack into its home
+ * register. Done wherever control flow splits or merges, so that all the
+ * paths into an instruction agree on where the values are.
+ * @t: the translator.
+*/
+static void flush(Translator* t)
+{
+	flushFrom(t, 0);
+}
+
+/**
+ * pushOperand - pushes a value onto the simulated stack.
+ * @t: the translator.
+ * @operand: where the value lives.
+*/
+static void pushOperand(Translator* t, uint16_t operand)
+{
+	t->operands[t->depth++] = operand;
+	if (t->depth > t->out->registerCount) t->out->registerCount = t->depth;
+}
+
+/**
+ * target - gets the register a value pushed onto the simulated stack is
+ * computed into, making sure nothing else still lives there.
+ * @t: the translator.
+ * Return: the home register of the next stack slot.
+*/
+static int target(Translator* t)
+{
+	release(t, t->depth);
+	return t->depth;
+}
+
+/**
+ * pushConstant - pushes one of the source chunk's constants, loading it
+ * into a register first if its index is out of reach of an operand.
+ * @t: the translator.
+ * @index: index of the constant in the source chunk.
+*/
+static void pushConstant(Translator* t, int index)
+{
+	if (index + 3 <= RK_MAX_CONSTANT)
+	{
+		pushOperand(t, (uint16_t)(RK_CONSTANT | (index + 3)));
+		return;
+	}
+
+	int reg = target(t);
+	emit(t, ROP_LOAD_LONG, reg, index >> 16, index & 0xffff);
+	pushOperand(t, (uint16_t)reg);
+}
+
+/**
+ * binaryOpcode - maps a binary stack opcode to its register counterpart.
+ * Quickened opcodes map to the counterpart of their generic form.
+ * @opcode: the stack opcode.
+ * Return: the register opcode, or -1 if the opcode is not binary.
+*/
+static int binaryOpcode(uint8_t opcode)
+{
+	switch (opcode)
+	{
+		case OP_EQUAL: return ROP_EQUAL;
+		case OP_NOT_EQUAL: return ROP_NOT_EQUAL;
+		case OP_GREATER:
+		case OP_GREATER_NUM: return ROP_GREATER;
+		case OP_GREATER_EQUAL:
+		case OP_GREATER_EQUAL_NUM: return ROP_GREATER_EQUAL;
+		case OP_LESS:
+		case OP_LESS_NUM: return ROP_LESS;
+		case OP_LESS_EQUAL:
+		case OP_LESS_EQUAL_NUM: return ROP_LESS_EQUAL;
+		case OP_ADD:
+		case OP_ADD_NUM:
+		case OP_ADD_STR: return ROP_ADD;
+		case OP_SUBTRACT:
+		case OP_SUBTRACT_NUM: return ROP_SUBTRACT;
+		case OP_MULTIPLY:
+		case OP_MULTIPLY_NUM: return ROP_MULTIPLY;
+		case OP_DIVIDE:
+		case OP_DIVIDE_NUM: return ROP_DIVIDE;
+		default: return -1;
+	}
+}
+
+/**
+ * stackEffect - gets how many values an instruction pops and pushes.
+ * @code: pointer to the instruction.
+ * @pops: where to store the number of values popped.
+ * @pushes: where to store the number of values pushed.
+ * Return: false if the instruction cannot be translated.
+*/
+static bool stackEffect(uint8_t* code, int* pops, int* pushes)
+{
+	*pops = 0;
+	*pushes = 0;
+	switch (code[0])
+	{
+		case OP_CONSTANT:
+		case OP_CONSTANT_LONG:
+		case OP_NIL:
+		case OP_TRUE:
+		case OP_FALSE:
+		case OP_GET_LOCAL:
+		case OP_GET_GLOBAL:
+			*pushes = 1;
+			return true;
+		case OP_NOT:
+		case OP_NEGATE:
+		case OP_SET_LOCAL:
+		case OP_SET_GLOBAL:
+		case OP_JUMP_IF_FALSE:
+			*pops = 1;
+			*pushes = 1;
+			return true;
+		case OP_POP:
+		case OP_PRINT:
+		case OP_DEFINE_GLOBAL:
+			*pops = 1;
+			return true;
+		case OP_POPN:
+			*pops = code[1];
+			return true;
+		case OP_CALL:
+		case OP_TAIL_CALL:
+			*pops = code[1] + 1;
+			*pushes = 1;
+			return true;
+		case OP_RETURN:
+			*pops = 1;
+			return true;
+		case OP_JUMP:
+		case OP_LOOP:
+			return true;
+		default:
+			if (binaryOpcode(code[0]) == -1) return false;
+			*pops = 2;
+			*pushes = 1;
+			return true;
+	}
+}
+
+/**
+ * isBranch - tests whether a stack opcode is a jump or a loop.
+ * @opcode: the opcode.
+ * Return: true for the instructions that land somewhere else.
+*/
+static bool isBranch(uint8_t opcode)
+{
+	return opcode == OP_JUMP || opcode == OP_JUMP_IF_FALSE ||
+		   opcode == OP_LOOP;
+}
+
+/**
+ * jumpTarget - decodes the offset a stack jump or loop instruction lands
+ * on.
+ * @chunk: the chunk holding the jump.
+ * @offset: offset of the jump instruction.
+ * Return: offset of the jump's destination.
+*/
+static int jumpTarget(Chunk* chunk, int offset)
+{
+	uint16_t jump = (uint16_t)(chunk->code[offset + 1] << 8);
+	jump |= chunk->code[offset + 2];
+	if (chunk->code[offset] == OP_LOOP) return offset + 5 - jump;
+	return offset + 3 + jump;
+}
+
+/**
+ * translateInstruction - translates a single stack instruction.
+ * @t: the translator.
+ * @offset: offset of the instruction.
+ * @jumps: list of register jumps whose destinations still need patching.
+ * Their operands hold the stack offset they jump to in the meantime.
+ * @jumpCount: number of entries in `jumps`.
+*/
+static void translateInstruction(Translator* t, int offset,
+								 int* jumps, int* jumpCount)
+{
+	uint8_t* code = &t->chunk->code[offset];
+	int top = t->depth - 1;
+
+	switch (code[0])
+	{
+		case OP_CONSTANT: pushConstant(t, code[1]); return;
+		case OP_CONSTANT_LONG:
+			pushConstant(t, (code[1] << 16) | (code[2] << 8) | code[3]);
+			return;
+		case OP_NIL: pushOperand(t, RK_NIL); return;
+		case OP_TRUE: pushOperand(t, RK_TRUE); return;
+		case OP_FALSE: pushOperand(t, RK_FALSE); return;
+
+		case OP_GET_LOCAL:
+			// the value of the local is wherever the local lives.
+			pushOperand(t, t->operands[code[1]]);
+			return;
+		case OP_SET_LOCAL: {
+			int slot = code[1];
+			if (t->operands[top] == slot) return;
+			release(t, slot);
+			emit(t, ROP_MOVE, slot, t->operands[top], 0);
+			t->operands[slot] = (uint16_t)slot;
+			return;
+		}
+		case OP_GET_GLOBAL: {
+			int reg = target(t);
+			emit(t, ROP_GET_GLOBAL, reg, (code[1] << 8) | code[2], 0);
+			pushOperand(t, (uint16_t)reg);
+			return;
+		}
+		case OP_DEFINE_GLOBAL:
+		case OP_SET_GLOBAL:
+			emit(t, code[0] == OP_SET_GLOBAL ? ROP_SET_GLOBAL : ROP_DEFINE_GLOBAL,
+				 (code[1] << 8) | code[2], t->operands[top], 0);
+			if (code[0] == OP_DEFINE_GLOBAL) t->depth--;
+			return;
+
+		case OP_NOT:
+		case OP_NEGATE: {
+			uint16_t operand = t->operands[top];
+			t->depth--;
+			int reg = target(t);
+			emit(t, code[0] == OP_NOT ? ROP_NOT : ROP_NEGATE, reg, operand, 0);
+			pushOperand(t, (uint16_t)reg);
+			return;
+		}
+
+		case OP_PRINT:
+			emit(t, ROP_PRINT, t->operands[top], 0, 0);
+			t->depth--;
+			return;
+		case OP_POP: t->depth--; return;
+		case OP_POPN: t->depth -= code[1]; return;
+
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE: {
+			flush(t);
+			int destination = jumpTarget(t->chunk, offset);
+			jumps[(*jumpCount)++] = code[0] == OP_JUMP
+				? emit(t, ROP_JUMP, 0, destination >> 16, destination & 0xffff)
+				: emit(t, ROP_JUMP_IF_FALSE, t->depth - 1,
+					   destination >> 16, destination & 0xffff);
+			return;
+		}
+		case OP_LOOP: {
+			flush(t);
+			int destination = jumpTarget(t->chunk, offset);
+			jumps[(*jumpCount)++] = emit(t, ROP_LOOP, (code[3] << 8) | code[4],
+										 destination >> 16,
+										 destination & 0xffff);
+			return;
+		}
+
+		case OP_CALL:
+		case OP_TAIL_CALL: {
+			// the callee's frame starts at the callee, so the callee and
+			// arguments must be in their home registers. Nothing below
+			// lives up there, as a value never lives above its own slot.
+			int callee = t->depth - code[1] - 1;
+			flushFrom(t, callee);
+			emit(t, code[0] == OP_CALL ? ROP_CALL : ROP_TAIL_CALL,
+				 callee, code[1], 0);
+			t->depth = callee;
+			pushOperand(t, (uint16_t)callee);
+			return;
+		}
+		case OP_RETURN:
+			emit(t, ROP_RETURN, t->operands[top], 0, 0);
+			t->depth--;
+			return;
+
+		default: {
+			uint16_t right = t->operands[t->depth - 1];
+			uint16_t left = t->operands[t->depth - 2];
+			t->depth -= 2;
+			int reg = target(t);
+			emit(t, (RegOpcode)binaryOpcode(code[0]), reg, left, right);
+			pushOperand(t, (uint16_t)reg);
+			return;
+		}
+	}
+}
+
+/**
+ * struct jumpTarget - an instruction some jump lands on.
+ * @offset: offset of the instruction in the stack-based chunk.
+ * @depth: stack depth on entry to the instruction, or -1 until a jump to
+ * it has been seen or, for a loop header, it has been reached.
+ * @start: index of the first register instruction translated from it, or
+ * -1 until it has been translated.
+*/
+typedef struct jumpTarget
+{
+	int offset;
+	int depth;
+	int start;
+} JumpTarget;
+
+static int compareTargets(const void* a, const void* b)
+{
+	return ((const JumpTarget*)a)->offset - ((const JumpTarget*)b)->offset;
+}
+
+/**
+ * findTarget - looks up the jump target at the given offset.
+ * @targets: jump targets sorted by offset.
+ * @count: number of jump targets.
+ * @offset: offset of the instruction.
+ * Return: pointer to the target.
+*/
+static JumpTarget* findTarget(JumpTarget* targets, int count, int offset)
+{
+	JumpTarget key = { offset, -1, -1 };
+	return bsearch(&key, targets, count, sizeof(JumpTarget), compareTargets);
+}
+
+/**
+ * collectTargets - lists the distinct instructions jumps land on.
+ * @chunk: the stack-based chunk.
+ * @targets: where to store the allocated, sorted array of targets.
+ * @targetCount: where to store the number of distinct targets.
+ * Return: the number of jump instructions in the chunk. The number of
+ * targets can be smaller as several jumps may share one.
+*/
+static int collectTargets(Chunk* chunk, JumpTarget** targets, int* targetCount)
+{
+	int count = 0;
+	int capacity = 0;
+	*targets = NULL;
+
+	for (int offset = 0; offset < chunk->count;
+		 offset += instructionLength(chunk, offset))
+	{
+		uint8_t opcode = chunk->code[offset];
+		if (!isBranch(opcode)) continue;
+
+		if (capacity < count + 1)
+		{
+			capacity = GROW_CAPACITY(capacity);
+			*targets = realloc(*targets, sizeof(JumpTarget) * capacity);
+			if (*targets == NULL) exit(EXIT_FAILURE);
+		}
+		JumpTarget* target = &(*targets)[count++];
+		target->offset = jumpTarget(chunk, offset);
+		target->depth = -1;
+		target->start = -1;
+	}
+
+	if (count > 0)
+	{
+		qsort(*targets, count, sizeof(JumpTarget), compareTargets);
+	}
+	int unique = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if (unique > 0 && (*targets)[unique - 1].offset == (*targets)[i].offset)
+		{
+			continue;
+		}
+		(*targets)[unique++] = (*targets)[i];
+	}
+	*targetCount = unique;
+	return count;
+}
+
+/**
+ * translateChunk - translates stack-based bytecode into the register-based
+ * instruction set. Stack slot `n` becomes register `n`, so locals keep
+ * their slots and temporaries land where the stack code would have put
+ * them, while loads of locals and constants disappear into the operands
+ * of the instructions that use them. Like the verifier, it follows the
+ * paths through the chunk, leaving out code that none of them reach.
+ * @chunk: the chunk to translate. Must belong to the script or to a
+ * function being called, so its constants stay reachable while the
+ * translation allocates.
+ * @depth: number of slots in use on entry: the callee and its arguments
+ * for a function, none for the script.
+ * @out: an initialized register chunk to write the translation to.
+ * @blocked: where to store the offset of the instruction that stopped the
+ * translation.
+ * @reason: where to store what stopped it.
+ * Return: false if the chunk uses an instruction without a register
+ * counterpart or more registers than the `stackSize` the VM makes room
+ * for, in which case `out` is left empty and the chunk has to run on the
+ * stack VM.
+*/
+bool translateChunk(Chunk* chunk, int depth, RegChunk* out, int* blocked,
+					const char** reason)
+{
+	int count = chunk->count;
+	JumpTarget* targets;
+	int targetCount;
+	int* jumps = malloc(sizeof(int) *
+						(collectTargets(chunk, &targets, &targetCount) + 1));
+	if (jumps == NULL) exit(EXIT_FAILURE);
+
+	writeValueArray(&out->constants, NIL_VAL);
+	writeValueArray(&out->constants, BOOL_VAL(true));
+	writeValueArray(&out->constants, BOOL_VAL(false));
+	for (int i = 0; i < chunk->constants.count && i + 3 <= RK_MAX_CONSTANT; i++)
+	{
+		writeValueArray(&out->constants, chunk->constants.values[i]);
+	}
+
+	// most stack instructions are two bytes and many of them (loads of
+	// locals and constants) translate to nothing, so this rarely grows.
+	out->capacity = count / 2 + 8;
+	out->code = GROW_ARRAY(RegInstruction, NULL, 0, out->capacity);
+	out->origins = GROW_ARRAY(int, NULL, 0, out->capacity);
+
+	out->source = chunk;
+	out->registerCount = depth;
+
+	Translator t;
+	t.chunk = chunk;
+	t.out = out;
+	t.depth = depth;
+	t.failure = NULL;
+	for (int i = 0; i < depth; i++) t.operands[i] = (uint16_t)i;
+	int jumpCount = 0;
+	int nextTarget = 0;
+	bool reachable = true;
+	bool translated = true;
+
+	for (int offset = 0; offset <= count && translated;
+		 offset += instructionLength(chunk, offset))
+	{
+		// targets passed over land inside an instruction and keep a
+		// start of -1, which fails the translation below.
+		while (nextTarget < targetCount && targets[nextTarget].offset < offset)
+		{
+			nextTarget++;
+		}
+
+		t.origin = offset;
+		if (nextTarget < targetCount && targets[nextTarget].offset == offset)
+		{
+			JumpTarget* target = &targets[nextTarget];
+			if (reachable && target->depth != -1 && target->depth != t.depth)
+			{
+				translated = fail(&t, "is reached at different stack depths");
+				break;
+			}
+			if (reachable)
+			{
+				flush(&t);
+				target->depth = t.depth;
+			}
+			// a target only jumped to from unreachable code stays so.
+			if (target->depth != -1)
+			{
+				t.depth = target->depth;
+				for (int i = 0; i < t.depth; i++) t.operands[i] = (uint16_t)i;
+				target->start = out->count;
+				reachable = true;
+			}
+		}
+		if (offset == count) break;
+		// the stack depth is unknown here, and the code never runs.
+		if (!reachable) continue;
+
+		uint8_t* code = &chunk->code[offset];
+		int pops, pushes;
+		bool isLocal = code[0] == OP_GET_LOCAL || code[0] == OP_SET_LOCAL;
+		if (!stackEffect(code, &pops, &pushes))
+		{
+			translated = fail(&t, "has no register form");
+			break;
+		}
+		if (pops > t.depth || (isLocal && code[1] >= t.depth))
+		{
+			translated = fail(&t, "reaches below the stack");
+			break;
+		}
+		// the VM makes room for `stackSize` slots, which registers never
+		// exceed as they are the same slots.
+		if (t.depth - pops + pushes > chunk->stackSize ||
+			t.depth - pops + pushes >= STACK_INITIAL)
+		{
+			translated = fail(&t, "needs more registers than the stack "
+								  "size the verifier found");
+			break;
+		}
+
+		translateInstruction(&t, offset, jumps, &jumpCount);
+
+		if (isBranch(code[0]))
+		{
+			JumpTarget* target = findTarget(targets, targetCount,
+											jumpTarget(chunk, offset));
+			if (target->offset > count ||
+				(target->depth != -1 && target->depth != t.depth))
+			{
+				translated = fail(&t, "jumps to a different stack depth");
+				break;
+			}
+			target->depth = t.depth;
+		}
+		if (code[0] == OP_JUMP || code[0] == OP_LOOP || code[0] == OP_RETURN)
+		{
+			reachable = false;
+		}
+	}
+
+	for (int i = 0; i < jumpCount && translated; i++)
+	{
+		RegInstruction* jump = &out->code[jumps[i]];
+		JumpTarget* target = findTarget(targets, targetCount,
+										(jump->b << 16) | jump->c);
+		if (target->start == -1)
+		{
+			t.origin = out->origins[jumps[i]];
+			translated = fail(&t, "jumps into the middle of an instruction");
+			break;
+		}
+		jump->b = (uint16_t)(target->start >> 16);
+		jump->c = (uint16_t)(target->start & 0xffff);
+	}
+
+	free(targets);
+	free(jumps);
+
+	if (!translated)
+	{
+		*blocked = t.origin;
+		*reason = t.failure;
+		freeRegChunk(out);
+	}
+	return translated;
+}
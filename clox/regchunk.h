@@ -0,0 +1,116 @@
+#if !defined(clox_regchunk_h)
+#define clox_regchunk_h
+
+#include "chunk.h"
+#include "common.h"
+#include "value.h"
+
+// set on an operand that names a constant instead of a register.
+#define RK_CONSTANT		0x8000
+// the constants every register chunk starts with.
+#define RK_NIL			(RK_CONSTANT | 0)
+#define RK_TRUE			(RK_CONSTANT | 1)
+#define RK_FALSE		(RK_CONSTANT | 2)
+// largest constant index an operand can hold.
+#define RK_MAX_CONSTANT	0x7fff
+
+/**
+ * enum regOpcode - defines the opcodes of the register-based instruction
+ * set. Operands marked `RK` name either a register (a slot of the frame's
+ * window into `vm.stack`)
+ * or, when `RK_CONSTANT` is set, an entry of the chunk's constants.
+ * @ROP_MOVE: A = RK(B).
+ * @ROP_LOAD_LONG: A = the chunk constant at index (B << 16 | C), for
+ * constants beyond the reach of an `RK` operand.
+ * @ROP_GET_GLOBAL: A = the global in slot B.
+ * @ROP_DEFINE_GLOBAL: the global in slot A = RK(B).
+ * @ROP_SET_GLOBAL: the already defined global in slot A = RK(B).
+ * @ROP_EQUAL..ROP_DIVIDE: A = RK(B) op RK(C).
+ * @ROP_NOT, ROP_NEGATE: A = op RK(B).
+ * @ROP_PRINT: prints RK(A).
+ * @ROP_JUMP: continues at instruction (B << 16 | C).
+ * @ROP_JUMP_IF_FALSE: jumps like `ROP_JUMP` if register A is falsey.
+ * @ROP_LOOP: counts an iteration of the loop with index A, then jumps
+ * back like `ROP_JUMP`.
+ * @ROP_CALL: calls register A with the B arguments in the registers
+ * after it. The callee's frame starts at register A, where the result is
+ * left.
+ * @ROP_TAIL_CALL: ends the frame in favor of a call like `ROP_CALL`.
+ * @ROP_RETURN: ends the frame, returning RK(A) to the caller.
+*/
+typedef enum regOpcode
+{
+	ROP_MOVE,
+	ROP_LOAD_LONG,
+	ROP_GET_GLOBAL,
+	ROP_DEFINE_GLOBAL,
+	ROP_SET_GLOBAL,
+	ROP_EQUAL,
+	ROP_NOT_EQUAL,
+	ROP_GREATER,
+	ROP_GREATER_EQUAL,
+	ROP_LESS,
+	ROP_LESS_EQUAL,
+	ROP_ADD,
+	ROP_SUBTRACT,
+	ROP_MULTIPLY,
+	ROP_DIVIDE,
+	ROP_NOT,
+	ROP_NEGATE,
+	ROP_PRINT,
+	ROP_JUMP,
+	ROP_JUMP_IF_FALSE,
+	ROP_LOOP,
+	ROP_CALL,
+	ROP_TAIL_CALL,
+	ROP_RETURN
+} RegOpcode;
+
+/**
+ * struct regInstruction - a single three-address instruction.
+ * @op: the `RegOpcode`.
+ * @a: destination register, or the first operand of instructions that
+ * write nothing.
+ * @b: first source operand.
+ * @c: second source operand.
+*/
+typedef struct regInstruction
+{
+	uint16_t op;
+	uint16_t a;
+	uint16_t b;
+	uint16_t c;
+} RegInstruction;
+
+/**
+ * struct regChunk - register-based translation of a `Chunk`. Empty when
+ * the chunk could not be translated.
+ * @source: the stack-based chunk it was translated from.
+ * @count: number of instructions.
+ * @capacity: allocated size of `code`.
+ * @code: the instructions.
+ * @origins: offset of the stack instruction each instruction was
+ * translated from, used to find source lines.
+ * @constants: nil, true and false followed by the first constants of the
+ * source chunk, addressed by `RK` operands.
+ * @registerCount: number of registers (stack slots) the code uses,
+ * counting from the frame's first slot.
+*/
+typedef struct regChunk
+{
+	Chunk* source;
+	int count;
+	int capacity;
+	RegInstruction* code;
+	int* origins;
+	ValueArray constants;
+	int registerCount;
+} RegChunk;
+
+void initRegChunk(RegChunk* chunk);
+void freeRegChunk(RegChunk* chunk);
+void deleteRegChunk(RegChunk* chunk);
+bool translateChunk(Chunk* chunk, int depth, RegChunk* out, int* blocked,
+					const char** reason);
+
+#endif // clox_regchunk_h
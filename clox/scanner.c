@@ -313,6 +313,7 @@ Token scanToken()
 		case '{': return makeToken(TOKEN_LEFT_BRACE);
 		case '}': return makeToken(TOKEN_RIGHT_BRACE);
 		case ';': return makeToken(TOKEN_SEMICOLON);
+		case ',': return makeToken(TOKEN_COMMA);
 		case '.': return makeToken(TOKEN_DOT);
 		case '-': return makeToken(TOKEN_MINUS);
 		case '+': return makeToken(TOKEN_PLUS);
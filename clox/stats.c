@@ -0,0 +1,240 @@
+#include "stats.h"
+
+#if defined(OPCODE_STATS)
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAS_RDTSC
+#endif // __x86_64__ || __i386__
+
+#include "debug.h"
+#include "vm.h"
+
+/**
+ * struct opcodeStats - what `run()` has executed since the last report.
+ * @counts: executions of each opcode.
+ * @cycles: time stamp counter ticks from the dispatch of each opcode to
+ * the dispatch of the next one, so the time spent counting is included.
+ * @pairs: executions of each opcode, the first index, directly followed
+ * by each opcode, the second index.
+ * @previous: the last opcode dispatched, or -1 before the first.
+ * @start: time stamp counter when `previous` was dispatched.
+*/
+typedef struct opcodeStats
+{
+	uint64_t counts[UINT8_COUNT];
+	uint64_t cycles[UINT8_COUNT];
+	uint64_t pairs[UINT8_COUNT][UINT8_COUNT];
+	int previous;
+	uint64_t start;
+} OpcodeStats;
+
+/**
+ * struct statsRow - an opcode or pair of opcodes and its count, for
+ * sorting.
+ * @first: the opcode, or the first of the pair.
+ * @second: the second opcode of the pair, or -1.
+ * @count: executions.
+*/
+typedef struct statsRow
+{
+	int first;
+	int second;
+	uint64_t count;
+} StatsRow;
+
+static OpcodeStats stats = { .previous = -1 };
+
+/**
+ * recordOpcode - counts the dispatch of an opcode, called by `run()` for
+ * every instruction while `--stats` is on.
+ * @opcode: the opcode about to run.
+*/
+void recordOpcode(uint8_t opcode)
+{
+	stats.counts[opcode]++;
+	if (stats.previous != -1) stats.pairs[stats.previous][opcode]++;
+
+	#if defined(HAS_RDTSC)
+	if (vmOptions.statsCycles)
+	{
+		uint64_t now = __rdtsc();
+		if (stats.previous != -1)
+		{
+			stats.cycles[stats.previous] += now - stats.start;
+		}
+		stats.start = now;
+	}
+	#endif // HAS_RDTSC
+
+	stats.previous = opcode;
+}
+
+/**
+ * compareRows - orders rows by count, most first, for qsort.
+ * @a: pointer to the first row.
+ * @b: pointer to the second row.
+ * Return: negative, zero or positive as `a` comes before, with or after `b`.
+*/
+static int compareRows(const void* a, const void* b)
+{
+	uint64_t x = ((const StatsRow*)a)->count;
+	uint64_t y = ((const StatsRow*)b)->count;
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/**
+ * collectRows - gathers the opcodes or pairs that ran, most frequent
+ * first.
+ * @pairs: collect pairs instead of single opcodes.
+ * @count: set to the number of rows.
+ * Return: the rows, which the caller frees.
+*/
+static StatsRow* collectRows(bool pairs, int* count)
+{
+	StatsRow* rows = malloc(sizeof(StatsRow) *
+							(pairs ? UINT8_COUNT * UINT8_COUNT : UINT8_COUNT));
+	if (rows == NULL) exit(EXIT_FAILURE);
+
+	*count = 0;
+	for (int first = 0; first < UINT8_COUNT; first++)
+	{
+		if (!pairs)
+		{
+			if (stats.counts[first] == 0) continue;
+			rows[(*count)++] = (StatsRow){ first, -1, stats.counts[first] };
+			continue;
+		}
+		for (int second = 0; second < UINT8_COUNT; second++)
+		{
+			uint64_t executions = stats.pairs[first][second];
+			if (executions == 0) continue;
+			rows[(*count)++] = (StatsRow){ first, second, executions };
+		}
+	}
+	if (*count > 0) qsort(rows, *count, sizeof(StatsRow), compareRows);
+	return rows;
+}
+
+/**
+ * printTable - prints the opcodes by executions, with their share of all
+ * instructions and, with `--stats-cycles`, the ticks they took, then the
+ * most frequent pairs.
+ * @total: number of instructions executed.
+*/
+static void printTable(uint64_t total)
+{
+	// keep the report after the program's own output.
+	fflush(stdout);
+	fprintf(stderr, "== opcode stats ==\n");
+	fprintf(stderr, "%-22s %14s %7s", "opcode", "count", "percent");
+	if (vmOptions.statsCycles)
+	{
+		fprintf(stderr, " %16s %10s", "cycles", "per op");
+	}
+	fprintf(stderr, "\n");
+
+	int count;
+	StatsRow* rows = collectRows(false, &count);
+	for (int i = 0; i < count; i++)
+	{
+		fprintf(stderr, "%-22s %14llu %6.2f%%", opcodeName(rows[i].first),
+				(unsigned long long)rows[i].count,
+				100.0 * rows[i].count / total);
+		if (vmOptions.statsCycles)
+		{
+			uint64_t cycles = stats.cycles[rows[i].first];
+			fprintf(stderr, " %16llu %10.1f", (unsigned long long)cycles,
+					(double)cycles / rows[i].count);
+		}
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "%-22s %14llu\n", "instructions",
+			(unsigned long long)total);
+	free(rows);
+
+	fprintf(stderr, "== top opcode pairs ==\n");
+	fprintf(stderr, "%-22s %-22s %14s %7s\n", "first", "second", "count",
+			"percent");
+	rows = collectRows(true, &count);
+	for (int i = 0; i < count && i < STATS_TOP_PAIRS; i++)
+	{
+		fprintf(stderr, "%-22s %-22s %14llu %6.2f%%\n",
+				opcodeName(rows[i].first), opcodeName(rows[i].second),
+				(unsigned long long)rows[i].count,
+				100.0 * rows[i].count / total);
+	}
+	free(rows);
+}
+
+/**
+ * writeJson - writes the counts as JSON: the total, every opcode and
+ * every pair that ran, each list most frequent first.
+ * @path: path of the file to write.
+ * @total: number of instructions executed.
+*/
+static void writeJson(const char* path, uint64_t total)
+{
+	FILE* file = fopen(path, "w");
+	if (file == NULL)
+	{
+		fprintf(stderr, "Error: Could not open file \"%s\".\n", path);
+		return;
+	}
+
+	fprintf(file, "{\n  \"instructions\": %llu,\n  \"opcodes\": [",
+			(unsigned long long)total);
+	int count;
+	StatsRow* rows = collectRows(false, &count);
+	for (int i = 0; i < count; i++)
+	{
+		fprintf(file, "%s\n    {\"opcode\": \"%s\", \"count\": %llu",
+				i > 0 ? "," : "", opcodeName(rows[i].first),
+				(unsigned long long)rows[i].count);
+		if (vmOptions.statsCycles)
+		{
+			fprintf(file, ", \"cycles\": %llu",
+					(unsigned long long)stats.cycles[rows[i].first]);
+		}
+		fprintf(file, "}");
+	}
+	free(rows);
+
+	fprintf(file, "\n  ],\n  \"pairs\": [");
+	rows = collectRows(true, &count);
+	for (int i = 0; i < count; i++)
+	{
+		fprintf(file, "%s\n    {\"first\": \"%s\", \"second\": \"%s\", "
+					  "\"count\": %llu}",
+				i > 0 ? "," : "", opcodeName(rows[i].first),
+				opcodeName(rows[i].second), (unsigned long long)rows[i].count);
+	}
+	free(rows);
+	fprintf(file, "\n  ]\n}\n");
+
+	if (fclose(file) != 0)
+	{
+		fprintf(stderr, "Error: Could not write file \"%s\".\n", path);
+	}
+}
+
+/**
+ * reportStats - prints the table, writes the JSON if `--stats-json` asked
+ * for it and starts counting afresh.
+*/
+void reportStats()
+{
+	uint64_t total = 0;
+	for (int i = 0; i < UINT8_COUNT; i++) total += stats.counts[i];
+
+	printTable(total);
+	if (vmOptions.statsPath != NULL) writeJson(vmOptions.statsPath, total);
+
+	memset(&stats, 0, sizeof(stats));
+	stats.previous = -1;
+}
+
+#endif // OPCODE_STATS
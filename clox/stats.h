@@ -0,0 +1,16 @@
+#if !defined(clox_stats_h)
+#define clox_stats_h
+
+#include "common.h"
+
+#if defined(OPCODE_STATS)
+
+// opcode pairs listed in the table. The JSON lists them all.
+#define STATS_TOP_PAIRS 20
+
+void recordOpcode(uint8_t opcode);
+void reportStats();
+
+#endif // OPCODE_STATS
+
+#endif // clox_stats_h
@@ -207,4 +207,38 @@ ObjStringVec* tableFindString(Table* table, const char* chars, int length, uint3
 	}
 	
 	
-}
\ No newline at end of file
+}
+
+/**
+ * tableRemoveWhite - deletes every entry whose key string was not marked
+ * during the current collection. Used on the intern table which must not
+ * keep otherwise unreachable strings alive.
+ * @table: pointer to the hash table.
+ * Return: void.
+*/
+void tableRemoveWhite(Table* table)
+{
+	for (int i = 0; i < table->capacity; i++)
+	{
+		Entry* entry = &table->entries[i];
+		if (entry->key != NULL && !entry->key->obj.isMarked)
+		{
+			tableDelete(table, entry->key);
+		}
+	}
+}
+
+/**
+ * markTable - marks every key string and value stored in the hash table.
+ * @table: pointer to the hash table.
+ * Return: void.
+*/
+void markTable(Table* table)
+{
+	for (int i = 0; i < table->capacity; i++)
+	{
+		Entry* entry = &table->entries[i];
+		markObject((Obj*)entry->key);
+		markValue(entry->value);
+	}
+}
@@ -42,5 +42,7 @@ bool tableSet(Table* table, ObjStringVec* key, Value value);
 bool tableDelete(Table* table, ObjStringVec* key);
 void tableAddAll(Table* from, Table* to);
 ObjStringVec* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
+void tableRemoveWhite(Table* table);
+void markTable(Table* table);
 
 #endif // clox_table_h
@@ -58,6 +58,24 @@ void freeValueArray(ValueArray* array)
 */
 void printValue(Value value)
 {
+	#if defined(NAN_BOXING)
+	if (IS_BOOL(value))
+	{
+		printf(AS_BOOL(value) ? "true" : "false");
+	} else if (IS_NIL(value))
+	{
+		printf("nil");
+	} else if (IS_NUMBER(value))
+	{
+		printf("%g", AS_NUMBER(value));
+	} else if (IS_OBJ(value))
+	{
+		printObject(value);
+	} else if (IS_UNDEFINED(value))
+	{
+		printf("undefined");
+	}
+	#else
 	switch (value.type)
 	{
 		case VAL_BOOL:
@@ -66,7 +84,9 @@ void printValue(Value value)
 		case VAL_NIL: printf("nil"); break;
 		case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
 		case VAL_OBJ: printObject(value); break;
+		case VAL_UNDEFINED: printf("undefined"); break;
 	}
+	#endif // NAN_BOXING
 }
 
 /**
@@ -77,6 +97,21 @@ void printValue(Value value)
 */
 bool valuesEqual(Value a, Value b)
 {
+	// concatenated strings are not interned so they compare by content.
+	if (IS_CONCAT(a) || IS_CONCAT(b))
+	{
+		return IS_STRING(a) && IS_STRING(b) &&
+			   stringsEqual(AS_OBJ(a), AS_OBJ(b));
+	}
+
+	#if defined(NAN_BOXING)
+	// keep IEEE semantics so that `NaN == NaN` stays false.
+	if (IS_NUMBER(a) && IS_NUMBER(b))
+	{
+		return AS_NUMBER(a) == AS_NUMBER(b);
+	}
+	return a == b;
+	#else
 	if (a.type != b.type) return false;
 
 	switch (a.type)
@@ -84,23 +119,9 @@ bool valuesEqual(Value a, Value b)
 		case VAL_BOOL: return AS_BOOL(a) == AS_BOOL(b);
 		case VAL_NUMBER: return AS_NUMBER(a) == AS_NUMBER(b);
 		case VAL_NIL: return true;
+		case VAL_UNDEFINED: return true;
 		case VAL_OBJ: return AS_OBJ(a) == AS_OBJ(b);
 		default: return false;
 	}
+	#endif // NAN_BOXING
 }
-
-/**
- * findConstant - looks for the value argument within the array of
- * constants. If found, the given index is returned, esle returns
- * -1.
- * @ar: pointer to an array of `values`.
- * @value: value to search for in the array.
- * Return: index of the value within the array or -1 if not found.
-*/
-int findValue(ValueArray* ar, Value value)
-{
-	for (int i = 0; i < ar->count; i++)
-		if (valuesEqual(value, ar->values[i]))
-			return i;
-	return -1;
-}
\ No newline at end of file
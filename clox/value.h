@@ -6,6 +6,76 @@
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 typedef struct ObjStringVec ObjStringVec;
+typedef struct ObjShape ObjShape;
+
+#if defined(NAN_BOXING)
+
+#include <string.h>
+
+/**
+ * A NaN-boxed `Value` is a single 64-bit word. Numbers are stored as plain
+ * doubles. Every other type hides in the unused payload bits of a quiet NaN:
+ * singletons (nil, true, false) use the low bits as a type tag while objects
+ * set the sign bit and store the 48-bit pointer in the mantissa.
+*/
+
+#define SIGN_BIT	((uint64_t)0x8000000000000000)
+#define QNAN		((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL		1 // 01.
+#define TAG_FALSE	2 // 10.
+#define TAG_TRUE	3 // 11.
+#define TAG_UNDEFINED	4 // 100.
+
+typedef uint64_t Value;
+
+#define IS_BOOL(value)		(((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)		((value) == NIL_VAL)
+#define IS_NUMBER(value)	(((value) & QNAN) != QNAN)
+#define IS_UNDEFINED(value)	((value) == UNDEFINED_VAL)
+#define IS_OBJ(value) \
+	(((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+#define AS_BOOL(value)		((value) == TRUE_VAL)
+#define AS_NUMBER(value)	valueToNum(value)
+#define AS_OBJ(value) \
+	((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VAL(b)			((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL			((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL			((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VAL				((Value)(uint64_t)(QNAN | TAG_NIL))
+#define UNDEFINED_VAL		((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define NUMBER_VAL(num)		numToValue(num)
+#define OBJ_VAL(obj) \
+	(Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+/**
+ * valueToNum - reinterprets the bits of a `Value` as a double. `memcpy`
+ * is the blessed way to type-pun and compiles down to a plain move.
+ * @value: NaN-boxed value holding a number.
+ * Return: the double stored in the value.
+*/
+static inline double valueToNum(Value value)
+{
+	double num;
+	memcpy(&num, &value, sizeof(Value));
+	return num;
+}
+
+/**
+ * numToValue - reinterprets the bits of a double as a `Value`.
+ * @num: the double to box.
+ * Return: the NaN-boxed value.
+*/
+static inline Value numToValue(double num)
+{
+	Value value;
+	memcpy(&value, &num, sizeof(double));
+	return value;
+}
+
+#else
 
 /**
  * enum _value_type - Describes a type "tag" for each of the
@@ -14,13 +84,16 @@ typedef struct ObjStringVec ObjStringVec;
  * @VAL_NIL: type "tag" for nil types.
  * @VAL_NUMBER: type "tag" for number types.
  * @VAL_OBJ: type "tag" for object types.
+ * @VAL_UNDEFINED: internal sentinel for a global slot that has been
+ * referenced but not yet defined. Never visible to user code.
 */
 typedef enum _value_type
 {
 	VAL_BOOL,
 	VAL_NIL,
 	VAL_NUMBER,
-	VAL_OBJ
+	VAL_OBJ,
+	VAL_UNDEFINED
 } ValueType;
 
 /**
@@ -48,6 +121,7 @@ typedef struct _value
 #define IS_NIL(value)		((value).type == VAL_NIL)
 #define IS_NUMBER(value)	((value).type == VAL_NUMBER)
 #define IS_OBJ(value)		((value).type == VAL_OBJ)
+#define IS_UNDEFINED(value)	((value).type == VAL_UNDEFINED)
 
 /**
  * Unpacks a clox Value to get the underlying C value.
@@ -69,6 +143,9 @@ typedef struct _value
 #define NIL_VAL			  ((Value){ VAL_NIL, .as.number = 0 })
 #define NUMBER_VAL(value) ((Value){ VAL_NUMBER, { .number = value } })
 #define OBJ_VAL(object)	  ((Value){ VAL_OBJ, { .obj = (Obj*)object }})
+#define UNDEFINED_VAL	  ((Value){ VAL_UNDEFINED, .as.number = 0 })
+
+#endif // NAN_BOXING
 
 /**
  * struct valAr - structure that wraps a pointer to an array
@@ -86,7 +163,6 @@ typedef struct valAr
 } ValueArray;
 
 bool valuesEqual(Value a, Value b);
-int findValue(ValueArray* ar, Value value);
 void initValueArray(ValueArray* array);
 void writeValueArray(ValueArray* array, Value value);
 void freeValueArray(ValueArray* array);
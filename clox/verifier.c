@@ -0,0 +1,443 @@
+#include <stdlib.h>
+
+#include "object.h"
+#include "verifier.h"
+#include "vm.h"
+
+/**
+ * struct verifier - state of the verification of one chunk.
+ * @chunk: the chunk being verified.
+ * @function: the function the chunk belongs to, or NULL for the script.
+ * @depths: the stack depth, counted from the frame's first slot, on entry
+ * to each offset a path has reached so far, or -1.
+ * @starts: whether an instruction starts at each offset.
+ * @offset: offset of the instruction being verified.
+*/
+typedef struct verifier
+{
+	Chunk* chunk;
+	ObjFunction* function;
+	int* depths;
+	bool* starts;
+	int offset;
+} Verifier;
+
+/**
+ * struct instruction - what the verifier needs to know about an
+ * instruction once its operands have been checked.
+ * @length: number of bytes the instruction takes.
+ * @pops: number of values it pops or otherwise needs on the stack.
+ * @pushes: number of values it leaves in their place.
+ * @local: highest frame slot it addresses, or -1.
+ * @target: offset it may jump to, or -1.
+ * @falls: whether execution can carry on with the next instruction.
+*/
+typedef struct instruction
+{
+	int length;
+	int pops;
+	int pushes;
+	int local;
+	int target;
+	bool falls;
+} Instruction;
+
+/**
+ * fail - reports why the chunk is invalid.
+ * @v: the verifier.
+ * @message: what is wrong with the instruction at `v->offset`.
+ * Return: false, for the caller to pass on.
+*/
+static bool fail(Verifier* v, const char* message)
+{
+	fprintf(stderr, "Error: Invalid bytecode at offset %d in %s%s: %s.\n",
+			v->offset,
+			v->function == NULL ? "script" : v->function->name->chars,
+			v->function == NULL ? "" : "()", message);
+	return false;
+}
+
+/**
+ * readShort - decodes a 16-bit operand.
+ * @code: pointer to the operand.
+ * Return: the operand.
+*/
+static int readShort(uint8_t* code)
+{
+	return (code[0] << 8) | code[1];
+}
+
+/**
+ * readLong - decodes a 24-bit operand.
+ * @code: pointer to the operand.
+ * Return: the operand.
+*/
+static int readLong(uint8_t* code)
+{
+	return (code[0] << 16) | (code[1] << 8) | code[2];
+}
+
+/**
+ * checkConstant - checks that an operand names a constant, and one of a
+ * given type if asked to.
+ * @v: the verifier.
+ * @index: the operand.
+ * @type: the type of object the constant must be, or -1 for any value.
+ * Return: false if the operand is invalid.
+*/
+static bool checkConstant(Verifier* v, int index, int type)
+{
+	if (index >= v->chunk->constants.count)
+	{
+		return fail(v, "constant out of range");
+	}
+	Value constant = v->chunk->constants.values[index];
+	if (type != -1 && !isObjType(constant, (ObjType)type))
+	{
+		return fail(v, "constant of the wrong type");
+	}
+	return true;
+}
+
+/**
+ * checkLoad - checks the operand of an instruction that loads a constant.
+ * Functions that capture variables may only be loaded as closures, as
+ * their code expects a closure to find the variables in.
+ * @v: the verifier.
+ * @index: the operand.
+ * Return: false if the operand is invalid.
+*/
+static bool checkLoad(Verifier* v, int index)
+{
+	if (!checkConstant(v, index, -1)) return false;
+	Value constant = v->chunk->constants.values[index];
+	if (IS_FUNCTION(constant) && AS_FUNCTION(constant)->upvalueCount > 0)
+	{
+		return fail(v, "function with upvalues outside a closure");
+	}
+	return true;
+}
+
+/**
+ * upvalueCount - gets how many upvalues the frame running the chunk has.
+ * @v: the verifier.
+ * Return: the function's upvalue count, zero for the script.
+*/
+static int upvalueCount(Verifier* v)
+{
+	return v->function == NULL ? 0 : v->function->upvalueCount;
+}
+
+/**
+ * decode - checks the operands of the instruction at `v->offset` that do
+ * not depend on the state of the stack and works out its length, its
+ * stack effect and where it can go next.
+ * @v: the verifier.
+ * @in: where to store what was found.
+ * Return: false if the instruction is malformed.
+*/
+static bool decode(Verifier* v, Instruction* in)
+{
+	Chunk* chunk = v->chunk;
+	uint8_t* code = &chunk->code[v->offset];
+	int remaining = chunk->count - v->offset;
+
+	// the length of a closure depends on its function constant.
+	if (code[0] == OP_CLOSURE)
+	{
+		if (remaining < 4) return fail(v, "truncated instruction");
+		if (!checkConstant(v, readLong(code + 1), OBJ_FUNCTION)) return false;
+	}
+
+	*in = (Instruction){ instructionLength(chunk, v->offset), 0, 0, -1, -1,
+						 true };
+	if (in->length > remaining) return fail(v, "truncated instruction");
+
+	switch (code[0])
+	{
+		case OP_CONSTANT:
+		case OP_CONSTANT_LONG:
+			in->pushes = 1;
+			return checkLoad(v, code[0] == OP_CONSTANT ? code[1]
+													   : readLong(code + 1));
+		case OP_NIL:
+		case OP_TRUE:
+		case OP_FALSE:
+			in->pushes = 1;
+			return true;
+		case OP_EQUAL:
+		case OP_NOT_EQUAL:
+		case OP_GREATER:
+		case OP_GREATER_EQUAL:
+		case OP_LESS:
+		case OP_LESS_EQUAL:
+		case OP_ADD:
+		case OP_SUBTRACT:
+		case OP_MULTIPLY:
+		case OP_DIVIDE:
+		case OP_ADD_NUM:
+		case OP_ADD_STR:
+		case OP_SUBTRACT_NUM:
+		case OP_MULTIPLY_NUM:
+		case OP_DIVIDE_NUM:
+		case OP_GREATER_NUM:
+		case OP_GREATER_EQUAL_NUM:
+		case OP_LESS_NUM:
+		case OP_LESS_EQUAL_NUM:
+			in->pops = 2;
+			in->pushes = 1;
+			return true;
+		case OP_NOT:
+		case OP_NEGATE:
+			in->pops = 1;
+			in->pushes = 1;
+			return true;
+		case OP_PRINT:
+		case OP_POP:
+		case OP_CLOSE_UPVALUE:
+			in->pops = 1;
+			return true;
+		case OP_POPN:
+			in->pops = code[1];
+			return true;
+		case OP_JUMP:
+		case OP_JUMP_IF_FALSE:
+			in->target = v->offset + 3 + readShort(code + 1);
+			if (in->target >= chunk->count)
+			{
+				return fail(v, "jump past the end of the code");
+			}
+			in->falls = code[0] == OP_JUMP_IF_FALSE;
+			in->pops = in->falls ? 1 : 0;
+			in->pushes = in->pops;
+			return true;
+		case OP_LOOP:
+			in->target = v->offset + 5 - readShort(code + 1);
+			if (in->target < 0)
+			{
+				return fail(v, "loop before the start of the code");
+			}
+			if (readShort(code + 3) >= chunk->loopCount)
+			{
+				return fail(v, "loop out of range");
+			}
+			in->falls = false;
+			return true;
+		case OP_GET_LOCAL:
+			in->local = code[1];
+			in->pushes = 1;
+			return true;
+		case OP_SET_LOCAL:
+			in->local = code[1];
+			in->pops = 1;
+			in->pushes = 1;
+			return true;
+		case OP_GET_GLOBAL:
+		case OP_DEFINE_GLOBAL:
+		case OP_SET_GLOBAL:
+			if (readShort(code + 1) >= vm.globalValues.count)
+			{
+				return fail(v, "global out of range");
+			}
+			in->pops = code[0] == OP_GET_GLOBAL ? 0 : 1;
+			in->pushes = code[0] == OP_DEFINE_GLOBAL ? 0 : 1;
+			return true;
+		case OP_GET_UPVALUE:
+		case OP_SET_UPVALUE:
+			if (code[1] >= upvalueCount(v))
+			{
+				return fail(v, "upvalue out of range");
+			}
+			in->pops = code[0] == OP_GET_UPVALUE ? 0 : 1;
+			in->pushes = 1;
+			return true;
+		case OP_GET_PROPERTY:
+		case OP_SET_PROPERTY:
+		case OP_GET_SUPER:
+			if (readShort(code + 1) >= chunk->cacheCount)
+			{
+				return fail(v, "property cache out of range");
+			}
+			in->pops = code[0] == OP_GET_PROPERTY ? 1 : 2;
+			in->pushes = 1;
+			return true;
+		case OP_CALL:
+		case OP_TAIL_CALL:
+			in->pops = code[1] + 1;
+			in->pushes = 1;
+			return true;
+		case OP_INVOKE:
+		case OP_SUPER_INVOKE:
+		case OP_TAIL_INVOKE:
+			if (readShort(code + 1) >= chunk->cacheCount)
+			{
+				return fail(v, "property cache out of range");
+			}
+			// a super invocation also pops the superclass.
+			in->pops = code[3] + (code[0] == OP_SUPER_INVOKE ? 2 : 1);
+			in->pushes = 1;
+			return true;
+		case OP_CLOSURE: {
+			ObjFunction* function =
+				AS_FUNCTION(chunk->constants.values[readLong(code + 1)]);
+			for (int i = 0; i < function->upvalueCount; i++)
+			{
+				uint8_t isLocal = code[4 + 2 * i];
+				uint8_t index = code[5 + 2 * i];
+				if (isLocal > 1) return fail(v, "malformed upvalue");
+				if (isLocal && index > in->local) in->local = index;
+				if (!isLocal && index >= upvalueCount(v))
+				{
+					return fail(v, "upvalue out of range");
+				}
+			}
+			in->pushes = 1;
+			return true;
+		}
+		case OP_CLASS:
+			if (!checkConstant(v, readLong(code + 1), OBJ_STRING))
+			{
+				return false;
+			}
+			in->pushes = 1;
+			return true;
+		case OP_INHERIT:
+			in->pops = 2;
+			in->pushes = 1;
+			return true;
+		case OP_METHOD:
+			if (!checkConstant(v, readLong(code + 1), OBJ_STRING))
+			{
+				return false;
+			}
+			in->pops = 2;
+			in->pushes = 1;
+			return true;
+		case OP_RETURN:
+			in->pops = 1;
+			in->falls = false;
+			return true;
+		default:
+			return fail(v, "unknown opcode");
+	}
+}
+
+/**
+ * verifyCode - walks the code in order, following the stack depth along
+ * every path. Forward jumps hand their depth to their target; a loop must
+ * find the depth its header was reached with. Code no path reaches has no
+ * depth and only gets its operands checked.
+ * @v: the verifier.
+ * @depth: stack depth on entry: the callee and its arguments for a
+ * function, nothing for the script.
+ * Return: false if the code is invalid.
+*/
+static bool verifyCode(Verifier* v, int depth)
+{
+	Chunk* chunk = v->chunk;
+	int maxDepth = depth;
+	bool reachable = true;
+	Instruction in = { 0 };
+
+	for (v->offset = 0; v->offset < chunk->count; v->offset += in.length)
+	{
+		int offset = v->offset;
+		v->starts[offset] = true;
+		if (v->depths[offset] != -1)
+		{
+			if (reachable && v->depths[offset] != depth)
+			{
+				return fail(v, "stack depths differ where paths meet");
+			}
+			depth = v->depths[offset];
+			reachable = true;
+		}
+
+		if (!decode(v, &in)) return false;
+		if (!reachable) continue;
+
+		v->depths[offset] = depth;
+		if (in.pops > depth) return fail(v, "stack underflow");
+		if (in.local >= depth) return fail(v, "local out of range");
+		depth += in.pushes - in.pops;
+		if (depth > maxDepth) maxDepth = depth;
+
+		if (in.target > offset)
+		{
+			if (v->depths[in.target] != -1 && v->depths[in.target] != depth)
+			{
+				return fail(v, "stack depths differ where paths meet");
+			}
+			v->depths[in.target] = depth;
+		} else if (in.target != -1 &&
+				   (!v->starts[in.target] || v->depths[in.target] != depth))
+		{
+			return fail(v, "loop to a bad target");
+		}
+		reachable = in.falls;
+	}
+
+	if (reachable) return fail(v, "execution runs off the end of the code");
+
+	for (v->offset = 0; v->offset < chunk->count; v->offset++)
+	{
+		if (v->depths[v->offset] != -1 && !v->starts[v->offset])
+		{
+			return fail(v, "jump into the middle of an instruction");
+		}
+	}
+
+	chunk->stackSize = maxDepth;
+	return true;
+}
+
+/**
+ * verify - verifies a chunk and then the functions among its constants.
+ * @chunk: the chunk.
+ * @function: the function the chunk belongs to, or NULL for the script.
+ * Return: false if any of the code is invalid.
+*/
+static bool verify(Chunk* chunk, ObjFunction* function)
+{
+	Verifier v = { chunk, function, NULL, NULL, 0 };
+	if (chunk->count == 0) return fail(&v, "empty code");
+
+	v.depths = malloc(sizeof(int) * chunk->count);
+	v.starts = calloc(chunk->count, sizeof(bool));
+	if (v.depths == NULL || v.starts == NULL) exit(EXIT_FAILURE);
+	for (int i = 0; i < chunk->count; i++) v.depths[i] = -1;
+
+	bool valid = verifyCode(&v, function == NULL ? 0 : function->arity + 1);
+	free(v.depths);
+	free(v.starts);
+
+	for (int i = 0; i < chunk->constants.count && valid; i++)
+	{
+		Value constant = chunk->constants.values[i];
+		if (!IS_FUNCTION(constant)) continue;
+		ObjFunction* nested = AS_FUNCTION(constant);
+		valid = verify(&nested->chunk, nested);
+	}
+	return valid;
+}
+
+/**
+ * verifyChunk - checks that a chunk and every function it contains is
+ * safe to run without the VM checking as it goes. Every instruction must
+ * be known and complete, name constants, globals, upvalues, locals and
+ * caches that exist, and jump to the start of an instruction; every path
+ * must end in a return and find the same stack depth wherever paths meet,
+ * without ever popping more than it pushed. Along the way each chunk's
+ * `stackSize` is set to the most slots its frame will use, which lets the
+ * VM reserve a frame's whole stack once per call and push and pop
+ * unchecked. The types of values are not tracked, so the VM checks them
+ * as it goes, down to `super` and the class under construction holding
+ * a class, which only the compiler guarantees. The first problem found
+ * is reported.
+ * @chunk: the script's chunk, freshly compiled or loaded from a file.
+ * Return: false if the bytecode is invalid.
+*/
+bool verifyChunk(Chunk* chunk)
+{
+	return verify(chunk, NULL);
+}
@@ -0,0 +1,8 @@
+#if !defined(clox_verifier_h)
+#define clox_verifier_h
+
+#include "chunk.h"
+
+bool verifyChunk(Chunk* chunk);
+
+#endif // clox_verifier_h
@@ -1,12 +1,51 @@
 #include <string.h>
 #include <stdarg.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <time.h>
 
+#include "aot.h"
 #include "debug.h"
 #include "compiler.h"
+#include "jit.h"
 #include "memory.h"
+#include "profiler.h"
+#include "stats.h"
 #include "vm.h"
 
+#if defined(STACK_GUARD_PAGE)
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif // STACK_GUARD_PAGE
+
 VM vm;
+VMOptions vmOptions = {
+	false, false, STACK_LIMIT_DEFAULT, false, NULL, PROFILE_RATE_DEFAULT,
+	false, false, NULL
+};
+
+// calls listed at either end of the stack trace of a runtime error.
+#define TRACE_FRAMES 16
+
+#if defined(STACK_GUARD_PAGE)
+// where a push into the guard page lands while a chunk is running.
+static sigjmp_buf stackOverflow;
+static volatile sig_atomic_t guardArmed = 0;
+#endif // STACK_GUARD_PAGE
+
+/**
+ * clockNative - the `clock()` native. Returns the processor time the
+ * program has used, in seconds.
+ * @argCount: number of arguments, unused.
+ * @args: the arguments, unused.
+ * Return: the elapsed time as a number.
+*/
+static Value clockNative(int argCount, Value* args)
+{
+	return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
+}
 
 /**
  * peek - Gets a `Value` from the stack but does not pop it.
@@ -25,35 +64,37 @@ static bool isFalsey(Value value)
 }
 
 /**
- * concatentate - joins together two string literals. Starts by calculating
- * the length of the resultant string from the lengths of the two operands.
- * Allocates a character array for the result and copies the two halves in.
- * It finally properly terminates the string.
+ * concatentate - joins together the two strings on top of the stack. The
+ * operands stay on the stack until the result exists so a collection
+ * cannot free them.
 */
 static void concatenate()
 {
-	ObjStringVec* b = AS_STRING(pop());
-	ObjStringVec* a = AS_STRING(pop());
+	Obj* b = AS_OBJ(peek(0));
+	Obj* a = AS_OBJ(peek(1));
 
-	ObjStringVec* result = takeStringVec(a, b);
+	Obj* result = concatStrings(a, b);
+	pop();
+	pop();
 	push(OBJ_VAL(result));
 }
 
 /**
  * resetStack - resets the stack by setting the pointer `stackTop`
  * to point to the beginning of the array signifying an empty stack.
- * Ensures there are no allocated objects.
+ * Objects are left alone for the garbage collector to reclaim, and the
+ * slots are not cleared: nothing reads a slot before writing it.
 */
 static void resetStack()
 {
-	memset(vm.stack, 0, 256 * sizeof(Value));
 	vm.stackTop = vm.stack;
-	vm.objects = NULL;
+	vm.frameCount = 0;
+	vm.openUpvalues = NULL;
 }
 
 /**
- * runtimeError - reports a useful error message to the user with the line
- * of their code that was being executed when the error occurred.
+ * runtimeError - reports a useful error message to the user followed by a
+ * stack trace: the line each ongoing call was executing, innermost first.
  * @format: the message string with a format layout.
 */
 static void runtimeError(const char* format, ...)
@@ -64,21 +105,597 @@ static void runtimeError(const char* format, ...)
 	va_end(args);
 	fputs("\n", stderr);
 
-	size_t instruction = vm.ip - vm.chunk->code - 1;
-	int line = vm.chunk->lines[instruction];
-	fprintf(stderr, "[line %d] in script\n", line);
+	for (int i = vm.frameCount - 1; i >= 0; i--)
+	{
+		// a runaway recursion can leave far too many frames to list.
+		if (i == vm.frameCount - 1 - TRACE_FRAMES && i >= TRACE_FRAMES)
+		{
+			fprintf(stderr, "[... %d more calls]\n", i - TRACE_FRAMES + 1);
+			i = TRACE_FRAMES - 1;
+		}
+		CallFrame* frame = &vm.frames[i];
+		size_t instruction = frame->ip - frame->chunk->code - 1;
+		fprintf(stderr, "[line %d] in ", getLine(frame->chunk, (int)instruction));
+		if (frame->function == NULL)
+		{
+			fprintf(stderr, "script\n");
+		} else
+		{
+			fprintf(stderr, "%s()\n", frame->function->name->chars);
+		}
+	}
 	resetStack();
 
 }
 
-static InterpretResult run()
+#if defined(DEBUG_TRACE_EXECUTION)
+/**
+ * traceExecution - prints the contents of the stack followed by the
+ * instruction about to be executed.
+*/
+static void traceExecution()
+{
+	printf("          ");
+	for (Value* slot = vm.stack; slot < vm.stackTop; slot++)
+	{
+		printf("[ ");
+		printValue(*slot);
+		printf(" ]");
+	}
+	printf("\n");
+	CallFrame* frame = &vm.frames[vm.frameCount - 1];
+	disassembleInstruction(frame->chunk, (int)(frame->ip - frame->chunk->code));
+}
+#endif // DEBUG_TRACE_EXECUTION
+
+/**
+ * defineNative - binds a C function to a global variable.
+ * @name: name of the global.
+ * @function: the C function.
+*/
+static void defineNative(const char* name, NativeFn function)
+{
+	// both objects stay on the stack while the other one is allocated.
+	push(OBJ_VAL(copyStringVec(name, (int)strlen(name))));
+	push(OBJ_VAL(newNative(function)));
+	int slot = globalSlot(AS_STRING(vm.stack[0]));
+	vm.globalValues.values[slot] = vm.stack[1];
+	pop();
+	pop();
+}
+
+#if !defined(STACK_GUARD_PAGE)
+/**
+ * growStack - moves the stack to a bigger allocation with at least
+ * `needed` free slots above its top, then fixes up every pointer into the
+ * old one: the top, the window of each frame and the location of each
+ * open upvalue.
+ * @needed: number of free slots required above `vm.stackTop`.
+ * @limited: whether to refuse growing past `vmOptions.stackLimit`.
+ * Return: false if the stack would outgrow the limit, in which case it
+ * is left alone.
+*/
+static bool growStack(int needed, bool limited)
+{
+	int count = (int)(vm.stackTop - vm.stack);
+	if (limited && count + needed > vmOptions.stackLimit) return false;
+
+	int capacity = (int)(vm.stackEnd - vm.stack);
+	while (capacity < count + needed) capacity *= 2;
+	if (limited && capacity > vmOptions.stackLimit)
+	{
+		capacity = vmOptions.stackLimit;
+	}
+
+	Value* stack = malloc(sizeof(Value) * capacity);
+	if (stack == NULL) exit(EXIT_FAILURE);
+	memcpy(stack, vm.stack, sizeof(Value) * count);
+
+	for (int i = 0; i < vm.frameCount; i++)
+	{
+		vm.frames[i].slots = stack + (vm.frames[i].slots - vm.stack);
+	}
+	for (ObjUpvalue* upvalue = vm.openUpvalues;
+		 upvalue != NULL;
+		 upvalue = upvalue->next)
+	{
+		upvalue->location = stack + (upvalue->location - vm.stack);
+	}
+
+	free(vm.stack);
+	vm.stack = stack;
+	vm.stackEnd = stack + capacity;
+	vm.stackTop = stack + count;
+	return true;
+}
+#else
+/**
+ * guardHandler - turns a fault in the guard page past the end of the
+ * stack into a jump back to `interpretChunk()`, which reports the
+ * overflow. Any other fault gets the default action once the handler
+ * returns and the faulting instruction runs again.
+ * @signal: SIGSEGV.
+ * @info: details of the fault, including its address.
+ * @context: unused.
+*/
+static void guardHandler(int signal, siginfo_t* info, void* context)
+{
+	(void)context;
+	char* address = info->si_addr;
+	if (guardArmed && address >= (char*)vm.stackEnd &&
+		address < (char*)vm.stackEnd + sysconf(_SC_PAGESIZE))
+	{
+		guardArmed = 0;
+		siglongjmp(stackOverflow, 1);
+	}
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = SIG_DFL;
+	sigaction(signal, &action, NULL);
+}
+
+/**
+ * mapStack - reserves `vmOptions.stackLimit` slots of address space for the
+ * stack followed by an inaccessible guard page. The kernel only backs the
+ * pages that are touched, so the stack grows on demand without ever
+ * moving, and a push past the limit faults in the guard page instead of
+ * being checked for.
+*/
+static void mapStack()
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t size = sizeof(Value) * vmOptions.stackLimit;
+	size = (size + page - 1) / page * page;
+	char* base = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+					  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED || mprotect(base + size, page, PROT_NONE) != 0)
+	{
+		exit(EXIT_FAILURE);
+	}
+	vm.stack = (Value*)base;
+	vm.stackEnd = (Value*)(base + size);
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = guardHandler;
+	action.sa_flags = SA_SIGINFO;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, NULL);
+}
+#endif // STACK_GUARD_PAGE
+
+/**
+ * growFrames - doubles the frame array. `run()` reloads its frame pointer
+ * after every call, so nothing else points into the old array. The
+ * profiler is paused meanwhile, as its signal handler reads the frames.
+*/
+static void growFrames()
+{
+	profilerPaused = 1;
+	vm.frameCapacity *= 2;
+	vm.frames = realloc(vm.frames, sizeof(CallFrame) * vm.frameCapacity);
+	if (vm.frames == NULL) exit(EXIT_FAILURE);
+	profilerPaused = 0;
+}
+
+/**
+ * call - starts a call to a Lox function. The callee and its arguments are
+ * already on the stack and become the first slots of the new frame, so
+ * nothing is copied or allocated.
+ * @function: the function to call.
+ * @closure: the closure wrapping the function, or NULL if it has none.
+ * @argCount: number of arguments passed.
+ * Return: false if the call failed and a runtime error was reported.
+*/
+static bool call(ObjFunction* function, ObjClosure* closure, int argCount)
+{
+	if (argCount != function->arity)
+	{
+		runtimeError("Expected %d arguments but got %d.",
+					 function->arity, argCount);
+		return false;
+	}
+
+	#if !defined(STACK_GUARD_PAGE)
+	// room for the callee's whole frame, which starts at the callee.
+	int needed = function->chunk.stackSize + STACK_HEADROOM - argCount - 1;
+	if (vm.stackEnd - vm.stackTop < needed && !growStack(needed, true))
+	{
+		runtimeError("Stack overflow.");
+		return false;
+	}
+	#endif // STACK_GUARD_PAGE
+
+	if (vm.frameCount == vm.frameCapacity) growFrames();
+
+	CallFrame* frame = &vm.frames[vm.frameCount];
+	frame->function = function;
+	frame->closure = closure;
+	frame->chunk = &function->chunk;
+	frame->ip = function->chunk.code;
+	frame->slots = vm.stackTop - argCount - 1;
+	// the profiler's signal handler must not see the frame half filled in.
+	atomic_signal_fence(memory_order_release);
+	vm.frameCount++;
+	return true;
+}
+
+/**
+ * callValue - calls whatever value sits below the arguments on the stack.
+ * Natives run straight away and leave their result in place of the
+ * callee and arguments.
+ * @callee: the value being called.
+ * @argCount: number of arguments passed.
+ * Return: false if the value cannot be called or the call failed.
+*/
+static bool callValue(Value callee, int argCount)
+{
+	if (IS_OBJ(callee))
+	{
+		switch (OBJ_TYPE(callee))
+		{
+			case OBJ_FUNCTION:
+				return call(AS_FUNCTION(callee), NULL, argCount);
+
+			case OBJ_CLOSURE: {
+				ObjClosure* closure = AS_CLOSURE(callee);
+				return call(closure->function, closure, argCount);
+			}
+
+			case OBJ_BOUND_METHOD: {
+				ObjBoundMethod* bound = AS_BOUND_METHOD(callee);
+				vm.stackTop[-argCount - 1] = bound->receiver;
+				return callValue(bound->method, argCount);
+			}
+
+			case OBJ_CLASS: {
+				ObjClass* klass = AS_CLASS(callee);
+				vm.stackTop[-argCount - 1] = OBJ_VAL(newInstance(klass));
+				if (!IS_NIL(klass->initializer))
+				{
+					return callValue(klass->initializer, argCount);
+				} else if (argCount != 0)
+				{
+					runtimeError("Expected 0 arguments but got %d.", argCount);
+					return false;
+				}
+				return true;
+			}
+
+			case OBJ_NATIVE: {
+				NativeFn native = AS_NATIVE(callee);
+				Value result = native(argCount, vm.stackTop - argCount);
+				vm.stackTop -= argCount + 1;
+				push(result);
+				return true;
+			}
+
+			default:
+				break;
+		}
+	}
+	runtimeError("Can only call functions and classes.");
+	return false;
+}
+
+/**
+ * getField - reads a field of an instance through the access site's
+ * inline cache. On a miss the slot is looked up in the instance's shape
+ * and remembered for that shape, unless the site has already seen
+ * `PROPERTY_CACHE_WAYS` shapes.
+ * @cache: the inline cache of the access site.
+ * @instance: the instance.
+ * @value: where to store the field's value.
+ * Return: false if the instance has no such field.
+*/
+static inline bool getField(PropertyCache* cache, ObjInstance* instance,
+							Value* value)
+{
+	#if defined(HIDDEN_CLASSES)
+	ObjShape* shape = instance->shape;
+	for (int way = 0; way < cache->count; way++)
+	{
+		if (cache->shapes[way] == shape)
+		{
+			*value = instance->fields[cache->slots[way]];
+			return true;
+		}
+	}
+
+	Value index;
+	if (!tableGet(&shape->fields, cache->name, &index)) return false;
+	int slot = (int)AS_NUMBER(index);
+	if (cache->count < PROPERTY_CACHE_WAYS)
+	{
+		cache->shapes[cache->count] = shape;
+		cache->transitions[cache->count] = shape;
+		cache->slots[cache->count] = slot;
+		cache->count++;
+	}
+	*value = instance->fields[slot];
+	return true;
+	#else
+	return tableGet(&instance->table, cache->name, value);
+	#endif // HIDDEN_CLASSES
+}
+
+/**
+ * setField - stores into a field of an instance through the access site's
+ * inline cache, adding the field if the instance does not have it yet.
+ * Adding a field moves the instance to the next shape, and the cache
+ * remembers that transition so that instances built by the same code
+ * skip the lookup.
+ * @cache: the inline cache of the access site.
+ * @instance: the instance.
+ * @value: the value to store, kept on the stack by the caller.
+*/
+static inline void setField(PropertyCache* cache, ObjInstance* instance,
+							Value value)
+{
+	#if defined(HIDDEN_CLASSES)
+	ObjShape* shape = instance->shape;
+	ObjShape* next = NULL;
+	int slot = 0;
+	for (int way = 0; way < cache->count; way++)
+	{
+		if (cache->shapes[way] == shape)
+		{
+			next = cache->transitions[way];
+			slot = cache->slots[way];
+			break;
+		}
+	}
+
+	if (next == NULL)
+	{
+		Value index;
+		if (tableGet(&shape->fields, cache->name, &index))
+		{
+			next = shape;
+			slot = (int)AS_NUMBER(index);
+		} else
+		{
+			next = shapeTransition(shape, cache->name);
+			slot = shape->fieldCount;
+		}
+
+		if (cache->count < PROPERTY_CACHE_WAYS)
+		{
+			cache->shapes[cache->count] = shape;
+			cache->transitions[cache->count] = next;
+			cache->slots[cache->count] = slot;
+			cache->count++;
+		}
+	}
+
+	if (slot >= instance->fieldCapacity)
+	{
+		int oldCapacity = instance->fieldCapacity;
+		instance->fieldCapacity = GROW_CAPACITY(oldCapacity);
+		instance->fields = GROW_ARRAY(Value, instance->fields,
+									  oldCapacity, instance->fieldCapacity);
+	}
+	instance->fields[slot] = value;
+	instance->shape = next;
+	#else
+	tableSet(&instance->table, cache->name, value);
+	#endif // HIDDEN_CLASSES
+}
+
+/**
+ * bindMethod - replaces the instance on top of the stack with one of its
+ * class's methods bound to it.
+ * @klass: the class to look the method up in.
+ * @name: name of the method.
+ * Return: false if the class has no such method.
+*/
+static bool bindMethod(ObjClass* klass, ObjStringVec* name)
 {
-	#define READ_BYTE() (*vm.ip++)
-	#define READ_CONSTANT() (vm.chunk->constants.values[READ_BYTE()])
+	Value method;
+	if (!tableGet(&klass->methods, name, &method))
+	{
+		runtimeError("Undefined property '%s'.", name->chars);
+		return false;
+	}
+
+	ObjBoundMethod* bound = newBoundMethod(peek(0), method);
+	vm.stackTop[-1] = OBJ_VAL(bound);
+	return true;
+}
+
+/**
+ * cacheMethod - remembers the method an invocation site found for a
+ * shape, unless the site is already full.
+ * @cache: the inline cache of the invocation site.
+ * @shape: the shape the method was found for.
+ * @method: the method.
+*/
+static inline void cacheMethod(PropertyCache* cache, ObjShape* shape,
+							   Value method)
+{
+	if (cache->count == PROPERTY_CACHE_WAYS) return;
+	cache->shapes[cache->count] = shape;
+	cache->transitions[cache->count] = shape;
+	cache->slots[cache->count] = -1;
+	cache->methods[cache->count] = method;
+	cache->count++;
+}
+
+/**
+ * invoke - calls a method of the instance below the arguments on the
+ * stack without creating a bound method: the instance is already where
+ * the callee's `this` slot goes. A field of the same name takes precedence
+ * and is called like any other value. The site's inline cache remembers
+ * which it was for each shape, so a hit skips both lookups.
+ * @cache: the inline cache of the invocation site.
+ * @argCount: number of arguments passed.
+ * Return: false if the call failed and a runtime error was reported.
+*/
+static inline bool invoke(PropertyCache* cache, int argCount)
+{
+	Value receiver = peek(argCount);
+	if (!IS_INSTANCE(receiver))
+	{
+		runtimeError("Only instances have methods.");
+		return false;
+	}
+	ObjInstance* instance = AS_INSTANCE(receiver);
+
+	#if defined(HIDDEN_CLASSES)
+	ObjShape* shape = instance->shape;
+	for (int way = 0; way < cache->count; way++)
+	{
+		if (cache->shapes[way] != shape) continue;
+		if (cache->slots[way] == -1)
+		{
+			return callValue(cache->methods[way], argCount);
+		}
+		Value field = instance->fields[cache->slots[way]];
+		vm.stackTop[-argCount - 1] = field;
+		return callValue(field, argCount);
+	}
+	#endif // HIDDEN_CLASSES
+
+	Value field;
+	if (getField(cache, instance, &field))
+	{
+		vm.stackTop[-argCount - 1] = field;
+		return callValue(field, argCount);
+	}
+
+	Value method;
+	if (!tableGet(&instance->klass->methods, cache->name, &method))
+	{
+		runtimeError("Undefined property '%s'.", cache->name->chars);
+		return false;
+	}
+	#if defined(HIDDEN_CLASSES)
+	cacheMethod(cache, shape, method);
+	#endif // HIDDEN_CLASSES
+	return callValue(method, argCount);
+}
+
+/**
+ * superInvoke - calls a method of the superclass on the receiver below
+ * the arguments. The superclass at a site only changes when the class
+ * declaration runs again, so the site caches the method keyed by the
+ * superclass's empty shape.
+ * @cache: the inline cache of the invocation site.
+ * @superclass: the class to look the method up in.
+ * @argCount: number of arguments passed.
+ * Return: false if the call failed and a runtime error was reported.
+*/
+static inline bool superInvoke(PropertyCache* cache, ObjClass* superclass,
+							   int argCount)
+{
+	for (int way = 0; way < cache->count; way++)
+	{
+		if (cache->shapes[way] == superclass->shape)
+		{
+			return callValue(cache->methods[way], argCount);
+		}
+	}
+
+	Value method;
+	if (!tableGet(&superclass->methods, cache->name, &method))
+	{
+		runtimeError("Undefined property '%s'.", cache->name->chars);
+		return false;
+	}
+	cacheMethod(cache, superclass->shape, method);
+	return callValue(method, argCount);
+}
+
+/**
+ * captureUpvalue - finds the open upvalue for a stack slot, creating it if
+ * no closure has captured the slot yet. The open upvalues are kept sorted
+ * from the top of the stack down, so the search stops as soon as it walks
+ * past the slot.
+ * @local: pointer to the captured variable's slot.
+ * Return: pointer to the upvalue.
+*/
+static ObjUpvalue* captureUpvalue(Value* local)
+{
+	ObjUpvalue* prevUpvalue = NULL;
+	ObjUpvalue* upvalue = vm.openUpvalues;
+	while (upvalue != NULL && upvalue->location > local)
+	{
+		prevUpvalue = upvalue;
+		upvalue = upvalue->next;
+	}
+
+	if (upvalue != NULL && upvalue->location == local) return upvalue;
+
+	ObjUpvalue* createdUpvalue = newUpvalue(local);
+	createdUpvalue->next = upvalue;
+	if (prevUpvalue == NULL)
+	{
+		vm.openUpvalues = createdUpvalue;
+	} else
+	{
+		prevUpvalue->next = createdUpvalue;
+	}
+	return createdUpvalue;
+}
+
+/**
+ * closeUpvalues - closes every open upvalue pointing at or above the given
+ * slot by moving the variable off the stack into the upvalue.
+ * @last: lowest slot to close.
+*/
+static void closeUpvalues(Value* last)
+{
+	while (vm.openUpvalues != NULL && vm.openUpvalues->location >= last)
+	{
+		ObjUpvalue* upvalue = vm.openUpvalues;
+		upvalue->closed = *upvalue->location;
+		upvalue->location = &upvalue->closed;
+		vm.openUpvalues = upvalue->next;
+	}
+}
+
+/**
+ * dropFrame - ends the current call in favor of the tail call about to be
+ * made from it. The callee and its arguments are slid down over the
+ * frame's stack window, so the callee's frame takes the place of the
+ * current one. A callee that pushes no frame (a native or a class with no
+ * initializer) leaves its result in that same place, where the caller
+ * expects the value of the call.
+ * @frame: the current frame.
+ * @argCount: number of arguments on top of the stack.
+*/
+static void dropFrame(CallFrame* frame, int argCount)
+{
+	closeUpvalues(frame->slots);
+	Value* callee = vm.stackTop - argCount - 1;
+	memmove(frame->slots, callee, sizeof(Value) * (argCount + 1));
+	vm.stackTop = frame->slots + argCount + 1;
+	vm.frameCount--;
+}
+
+/**
+ * run - the bytecode interpreter loop. With `THREADED_DISPATCH` each
+ * handler ends by jumping straight to the handler of the next opcode
+ * through a table of label addresses, giving every opcode its own
+ * indirect branch (and branch predictor entry). Otherwise a single
+ * `switch` decodes every instruction.
+ * @exitDepth: the number of frames left when `run` is done: 0 to run the
+ * script to its end, or the depth of the register VM frame that made the
+ * call on top, whose result is then left in the callee's slot.
+ * Return: INTERPRET_RUNTIME_ERROR | INTERPRET_OK
+*/
+static InterpretResult run(int exitDepth)
+{
+	CallFrame* frame = &vm.frames[vm.frameCount - 1];
+
+	#define READ_BYTE() (*frame->ip++)
+	#define READ_CONSTANT() (frame->chunk->constants.values[READ_BYTE()])
 	#define READ_SHORT() \
-		(vm.ip += 2, (uint16_t)((vm.ip[-2] << 8) | vm.ip[-1]))
-	#define READ_STRING() AS_STRING(READ_CONSTANT())
-	#define BINARY_OP(valueType, op) \
+		(frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+	#define READ_CONSTANT_LONG() \
+		(frame->ip += 3, frame->chunk->constants.values[ \
+			(frame->ip[-3] << 16) | (frame->ip[-2] << 8) | frame->ip[-1]])
+	#define BINARY_OP(valueType, op, quickened) \
 			do { \
 				if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
 					runtimeError("Operands must be numbers."); \
@@ -87,185 +704,1075 @@ static InterpretResult run()
 				double b = AS_NUMBER(pop()); \
 				double a = AS_NUMBER(pop()); \
 				push(valueType(a op b)); \
+				QUICKEN(quickened); \
 			} while (false)
 
+	// the quickened form of `BINARY_OP`. Its operands are expected to be
+	// numbers, so it works on the top of the stack in place. When they are
+	// not, the instruction turns back into the generic opcode and runs
+	// again as that, which also reports any type error.
+	#define BINARY_NUM_OP(valueType, op, generic) \
+			do { \
+				Value b = vm.stackTop[-1]; \
+				Value a = vm.stackTop[-2]; \
+				if (!IS_NUMBER(a) || !IS_NUMBER(b)) DEQUICKEN(generic); \
+				vm.stackTop[-2] = valueType(AS_NUMBER(a) op AS_NUMBER(b)); \
+				vm.stackTop--; \
+			} while (false)
 
-	for (;;)
+	#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+	// the opcode of the instruction being executed, which is rewritten in
+	// place. Serialized chunks are mapped privately, so this never writes
+	// through to the file.
+	#define CURRENT_OPCODE() (frame->ip[-1])
+	#if defined(QUICKENING)
+	#define QUICKEN(quickened) (CURRENT_OPCODE() = (quickened))
+	#else
+	#define QUICKEN(quickened) do { } while (false)
+	#endif // QUICKENING
+	#define DEQUICKEN(generic) \
+			do { \
+				CURRENT_OPCODE() = (generic); \
+				frame->ip--; \
+				DISPATCH(); \
+			} while (false)
+
+	#if defined(DEBUG_TRACE_EXECUTION)
+	#define TRACE_EXECUTION() traceExecution()
+	#else
+	#define TRACE_EXECUTION() do { } while (false)
+	#endif // DEBUG_TRACE_EXECUTION
+
+	#if defined(OPCODE_STATS)
+	#define RECORD_OPCODE() \
+			do { \
+				if (vmOptions.stats) recordOpcode(instruction); \
+			} while (false)
+	#else
+	#define RECORD_OPCODE() do { } while (false)
+	#endif // OPCODE_STATS
+
+	// control moves to a new spot in the bytecode, which is where C
+	// compiled ahead of time, or machine code for a hot chunk, takes over
+	// from the interpreter.
+	#if defined(JIT)
+	#define NATIVE_ENTER() \
+			do { \
+				if (frame->chunk->aot != NULL) runAot(frame); \
+				else if (vmOptions.jit) runJit(frame); \
+			} while (false)
+	#else
+	#define NATIVE_ENTER() \
+			do { \
+				if (frame->chunk->aot != NULL) runAot(frame); \
+			} while (false)
+	#endif // JIT
+
+	uint8_t instruction;
+
+	#if defined(THREADED_DISPATCH)
+	// the range gives every opcode without a handler of its own
+	// `L_UNKNOWN`, and the entries after it override that on purpose.
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Woverride-init"
+	static void* dispatchTable[UINT8_COUNT] = {
+		[0 ... UINT8_MAX]		= &&L_UNKNOWN,
+		[OP_CONSTANT]			= &&L_OP_CONSTANT,
+		[OP_CONSTANT_LONG]		= &&L_OP_CONSTANT_LONG,
+		[OP_NIL]				= &&L_OP_NIL,
+		[OP_TRUE]				= &&L_OP_TRUE,
+		[OP_FALSE]				= &&L_OP_FALSE,
+		[OP_EQUAL]				= &&L_OP_EQUAL,
+		[OP_NOT_EQUAL]			= &&L_OP_NOT_EQUAL,
+		[OP_GREATER]			= &&L_OP_GREATER,
+		[OP_GREATER_EQUAL]		= &&L_OP_GREATER_EQUAL,
+		[OP_LESS]				= &&L_OP_LESS,
+		[OP_LESS_EQUAL]			= &&L_OP_LESS_EQUAL,
+		[OP_ADD]				= &&L_OP_ADD,
+		[OP_SUBTRACT]			= &&L_OP_SUBTRACT,
+		[OP_MULTIPLY]			= &&L_OP_MULTIPLY,
+		[OP_DIVIDE]				= &&L_OP_DIVIDE,
+		[OP_NOT]				= &&L_OP_NOT,
+		[OP_NEGATE]				= &&L_OP_NEGATE,
+		[OP_PRINT]				= &&L_OP_PRINT,
+		[OP_JUMP]				= &&L_OP_JUMP,
+		[OP_JUMP_IF_FALSE]		= &&L_OP_JUMP_IF_FALSE,
+		[OP_LOOP]				= &&L_OP_LOOP,
+		[OP_POP]				= &&L_OP_POP,
+		[OP_POPN]				= &&L_OP_POPN,
+		[OP_GET_LOCAL]			= &&L_OP_GET_LOCAL,
+		[OP_SET_LOCAL]			= &&L_OP_SET_LOCAL,
+		[OP_GET_GLOBAL]			= &&L_OP_GET_GLOBAL,
+		[OP_DEFINE_GLOBAL]		= &&L_OP_DEFINE_GLOBAL,
+		[OP_SET_GLOBAL]			= &&L_OP_SET_GLOBAL,
+		[OP_GET_PROPERTY]		= &&L_OP_GET_PROPERTY,
+		[OP_SET_PROPERTY]		= &&L_OP_SET_PROPERTY,
+		[OP_GET_SUPER]			= &&L_OP_GET_SUPER,
+		[OP_GET_UPVALUE]		= &&L_OP_GET_UPVALUE,
+		[OP_SET_UPVALUE]		= &&L_OP_SET_UPVALUE,
+		[OP_CALL]				= &&L_OP_CALL,
+		[OP_INVOKE]				= &&L_OP_INVOKE,
+		[OP_SUPER_INVOKE]		= &&L_OP_SUPER_INVOKE,
+		[OP_TAIL_CALL]			= &&L_OP_TAIL_CALL,
+		[OP_TAIL_INVOKE]		= &&L_OP_TAIL_INVOKE,
+		[OP_CLOSURE]			= &&L_OP_CLOSURE,
+		[OP_CLOSE_UPVALUE]		= &&L_OP_CLOSE_UPVALUE,
+		[OP_CLASS]				= &&L_OP_CLASS,
+		[OP_INHERIT]			= &&L_OP_INHERIT,
+		[OP_METHOD]				= &&L_OP_METHOD,
+		[OP_RETURN]				= &&L_OP_RETURN,
+		[OP_ADD_NUM]			= &&L_OP_ADD_NUM,
+		[OP_ADD_STR]			= &&L_OP_ADD_STR,
+		[OP_SUBTRACT_NUM]		= &&L_OP_SUBTRACT_NUM,
+		[OP_MULTIPLY_NUM]		= &&L_OP_MULTIPLY_NUM,
+		[OP_DIVIDE_NUM]			= &&L_OP_DIVIDE_NUM,
+		[OP_GREATER_NUM]		= &&L_OP_GREATER_NUM,
+		[OP_GREATER_EQUAL_NUM]	= &&L_OP_GREATER_EQUAL_NUM,
+		[OP_LESS_NUM]			= &&L_OP_LESS_NUM,
+		[OP_LESS_EQUAL_NUM]		= &&L_OP_LESS_EQUAL_NUM,
+	};
+	#pragma GCC diagnostic pop
+
+	#define INTERPRET_LOOP	DISPATCH();
+	#define CASE(op)		L_##op
+	#define CASE_UNKNOWN	L_UNKNOWN
+	#define DISPATCH() \
+			do { \
+				TRACE_EXECUTION(); \
+				instruction = READ_BYTE(); \
+				RECORD_OPCODE(); \
+				goto *dispatchTable[instruction]; \
+			} while (false)
+	#else
+	#define INTERPRET_LOOP \
+			loop: \
+				TRACE_EXECUTION(); \
+				instruction = READ_BYTE(); \
+				RECORD_OPCODE(); \
+				switch (instruction)
+	#define CASE(op)		case op
+	#define CASE_UNKNOWN	default
+	#define DISPATCH()		goto loop
+	#endif // THREADED_DISPATCH
+
+	NATIVE_ENTER();
+	INTERPRET_LOOP
 	{
-		#if defined(DEBUG_TRACE_EXECUTION)
-		printf("          ");
-		for (Value* slot = vm.stack; slot < vm.stackTop; slot++)
-		{
-			printf("[ ");
-			printValue(*slot);
-			printf(" ]");
+		CASE(OP_CONSTANT): {
+			Value constant = READ_CONSTANT();
+			push(constant);
+			DISPATCH();
 		}
-		printf("\n");
-		disassembleInstruction(vm.chunk, (int)(vm.ip - vm.chunk->code));
 
-		#endif // DEBUG_TRACE_EXECUTION
-		
-		u_int8_t instruction;
+		CASE(OP_CONSTANT_LONG): {
+			Value constant = READ_CONSTANT_LONG();
+			push(constant);
+			DISPATCH();
+		}
 
-		switch (instruction = READ_BYTE())
-		{
-			case OP_CONSTANT: {
-				Value constant = READ_CONSTANT();
-				push(constant);
-				break;
+		CASE(OP_FALSE): push(BOOL_VAL(false)); DISPATCH();
+		CASE(OP_TRUE): push(BOOL_VAL(true)); DISPATCH();
+		CASE(OP_NIL): push(NIL_VAL); DISPATCH();
+
+		CASE(OP_EQUAL): {
+			Value b = pop();
+			Value a = pop();
+			push(BOOL_VAL(valuesEqual(a, b)));
+			DISPATCH();
+		}
+		CASE(OP_NOT_EQUAL): {
+			Value b = pop();
+			Value a = pop();
+			push(BOOL_VAL(!valuesEqual(a, b)));
+			DISPATCH();
+		}
+		CASE(OP_GREATER):	BINARY_OP(BOOL_VAL, >, OP_GREATER_NUM); DISPATCH();
+		CASE(OP_LESS):		BINARY_OP(BOOL_VAL, <, OP_LESS_NUM); DISPATCH();
+		// fused by the optimizer from `OP_LESS, OP_NOT` and `OP_GREATER,
+		// OP_NOT`, so they negate the opposite comparison to keep the
+		// same result when an operand is NaN.
+		CASE(OP_GREATER_EQUAL):
+			BINARY_OP(NOT_BOOL_VAL, <, OP_GREATER_EQUAL_NUM);
+			DISPATCH();
+		CASE(OP_LESS_EQUAL):
+			BINARY_OP(NOT_BOOL_VAL, >, OP_LESS_EQUAL_NUM);
+			DISPATCH();
+
+		CASE(OP_ADD): {
+			if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
+			{
+				concatenate();
+				QUICKEN(OP_ADD_STR);
+			} else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+			{
+				double a = AS_NUMBER(pop());
+				double b = AS_NUMBER(pop());
+				push(NUMBER_VAL(a + b));
+				QUICKEN(OP_ADD_NUM);
+			} else
+			{
+				
+				runtimeError("Operands must be two numbers or two strings");
+				return INTERPRET_RUNTIME_ERROR;
 			}
+			DISPATCH();
+		}
+		CASE(OP_SUBTRACT): 	BINARY_OP(NUMBER_VAL, -, OP_SUBTRACT_NUM); DISPATCH();
+		CASE(OP_MULTIPLY): 	BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM); DISPATCH();
+		CASE(OP_DIVIDE): 	BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUM); DISPATCH();
 
-			case OP_FALSE: push(BOOL_VAL(false)); break;
-			case OP_TRUE: push(BOOL_VAL(true)); break;
-			case OP_NIL: push(NIL_VAL); break;
+		CASE(OP_ADD_NUM):		BINARY_NUM_OP(NUMBER_VAL, +, OP_ADD); DISPATCH();
+		CASE(OP_ADD_STR): {
+			if (!IS_STRING(peek(0)) || !IS_STRING(peek(1))) DEQUICKEN(OP_ADD);
+			concatenate();
+			DISPATCH();
+		}
+		CASE(OP_SUBTRACT_NUM):	BINARY_NUM_OP(NUMBER_VAL, -, OP_SUBTRACT); DISPATCH();
+		CASE(OP_MULTIPLY_NUM):	BINARY_NUM_OP(NUMBER_VAL, *, OP_MULTIPLY); DISPATCH();
+		CASE(OP_DIVIDE_NUM):	BINARY_NUM_OP(NUMBER_VAL, /, OP_DIVIDE); DISPATCH();
+		CASE(OP_GREATER_NUM):	BINARY_NUM_OP(BOOL_VAL, >, OP_GREATER); DISPATCH();
+		CASE(OP_LESS_NUM):		BINARY_NUM_OP(BOOL_VAL, <, OP_LESS); DISPATCH();
+		CASE(OP_GREATER_EQUAL_NUM):
+			BINARY_NUM_OP(NOT_BOOL_VAL, <, OP_GREATER_EQUAL);
+			DISPATCH();
+		CASE(OP_LESS_EQUAL_NUM):
+			BINARY_NUM_OP(NOT_BOOL_VAL, >, OP_LESS_EQUAL);
+			DISPATCH();
 
-			case OP_EQUAL: {
-				Value b = pop();
-				Value a = pop();
-				push(BOOL_VAL(valuesEqual(a, b)));
-				break;
+		CASE(OP_NOT): push(BOOL_VAL(isFalsey(pop()))); DISPATCH();
+
+		CASE(OP_NEGATE): {
+			if (!IS_NUMBER(peek(0)))
+			{
+				runtimeError("Operand must be a number");
+				return INTERPRET_RUNTIME_ERROR;
 			}
-			case OP_GREATER:	BINARY_OP(BOOL_VAL, >); break;
-			case OP_LESS:		BINARY_OP(BOOL_VAL, <); break;
 
-			case OP_ADD: {
-				if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
-				{
-					concatenate();
-				} else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+			// push(-pop()); break;
+			*(vm.stack + (int)(vm.stackTop - vm.stack) - 1) =
+				NUMBER_VAL(-AS_NUMBER(*(vm.stack + (int)(vm.stackTop - vm.stack) - 1)));
+			DISPATCH();
+		}
+
+		CASE(OP_POP): pop(); DISPATCH();
+		CASE(OP_POPN): {
+			uint8_t count = READ_BYTE();
+			vm.stackTop -= count;
+			DISPATCH();
+		}
+		CASE(OP_GET_LOCAL): {
+			uint8_t slot = READ_BYTE();
+			push(frame->slots[slot]);
+			DISPATCH();
+		}
+		CASE(OP_SET_LOCAL): {
+			uint8_t slot = READ_BYTE();
+			frame->slots[slot] = peek(0);
+			DISPATCH();
+		}
+		CASE(OP_SET_GLOBAL): {
+			uint16_t slot = READ_SHORT();
+			if (IS_UNDEFINED(vm.globalValues.values[slot]))
+			{
+				runtimeError("Undefined variable '%s'.",
+							 AS_CSTRING(vm.globalNames.values[slot]));
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			vm.globalValues.values[slot] = peek(0);
+			DISPATCH();
+		}
+		CASE(OP_GET_GLOBAL): {
+			uint16_t slot = READ_SHORT();
+			Value value = vm.globalValues.values[slot];
+			if (IS_UNDEFINED(value))
+			{
+				runtimeError("Undefined variable '%s'.",
+							 AS_CSTRING(vm.globalNames.values[slot]));
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			push(value);
+			DISPATCH();
+		}
+		CASE(OP_DEFINE_GLOBAL): {
+			uint16_t slot = READ_SHORT();
+			vm.globalValues.values[slot] = peek(0);
+			pop();
+			DISPATCH();
+		}
+
+		CASE(OP_PRINT): {
+			printValue(pop());
+			printf("\n");
+			DISPATCH();
+		}
+
+		CASE(OP_JUMP): {
+			uint16_t offset = READ_SHORT();
+			frame->ip += offset;
+			DISPATCH();
+		}
+
+		CASE(OP_JUMP_IF_FALSE): {
+			uint16_t offset = READ_SHORT();
+			if(isFalsey(peek(0))) frame->ip += offset;
+			DISPATCH();
+		}
+
+		CASE(OP_LOOP): {
+			uint16_t offset = READ_SHORT();
+			uint16_t loop = READ_SHORT();
+			frame->chunk->loops[loop].iterations++;
+			frame->ip -= offset;
+			NATIVE_ENTER();
+			DISPATCH();
+		}
+
+		CASE(OP_GET_PROPERTY): {
+			PropertyCache* cache = &frame->chunk->caches[READ_SHORT()];
+			if (!IS_INSTANCE(peek(0)))
+			{
+				runtimeError("Only instances have properties.");
+				return INTERPRET_RUNTIME_ERROR;
+			}
+
+			ObjInstance* instance = AS_INSTANCE(peek(0));
+			Value value;
+			if (getField(cache, instance, &value))
+			{
+				vm.stackTop[-1] = value;
+				DISPATCH();
+			}
+
+			if (!bindMethod(instance->klass, cache->name))
+			{
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			DISPATCH();
+		}
+
+		CASE(OP_SET_PROPERTY): {
+			PropertyCache* cache = &frame->chunk->caches[READ_SHORT()];
+			if (!IS_INSTANCE(peek(1)))
+			{
+				runtimeError("Only instances have fields.");
+				return INTERPRET_RUNTIME_ERROR;
+			}
+
+			setField(cache, AS_INSTANCE(peek(1)), peek(0));
+			vm.stackTop[-2] = vm.stackTop[-1];
+			vm.stackTop--;
+			DISPATCH();
+		}
+
+		CASE(OP_GET_SUPER): {
+			PropertyCache* cache = &frame->chunk->caches[READ_SHORT()];
+			// the compiler only ever loads a class here, but the verifier
+			// does not track types, so a loaded chunk may not.
+			if (!IS_CLASS(peek(0)))
+			{
+				runtimeError("Superclass must be a class.");
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			ObjClass* superclass = AS_CLASS(pop());
+			if (!bindMethod(superclass, cache->name))
+			{
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			DISPATCH();
+		}
+
+		CASE(OP_GET_UPVALUE): {
+			uint8_t slot = READ_BYTE();
+			push(*frame->closure->upvalues[slot]->location);
+			DISPATCH();
+		}
+
+		CASE(OP_SET_UPVALUE): {
+			uint8_t slot = READ_BYTE();
+			*frame->closure->upvalues[slot]->location = peek(0);
+			DISPATCH();
+		}
+
+		CASE(OP_CALL): {
+			int argCount = READ_BYTE();
+			if (!callValue(peek(argCount), argCount))
+			{
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			frame = &vm.frames[vm.frameCount - 1];
+			NATIVE_ENTER();
+			DISPATCH();
+		}
+
+		CASE(OP_INVOKE): {
+			PropertyCache* cache = &frame->chunk->caches[READ_SHORT()];
+			int argCount = READ_BYTE();
+			if (!invoke(cache, argCount))
+			{
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			frame = &vm.frames[vm.frameCount - 1];
+			NATIVE_ENTER();
+			DISPATCH();
+		}
+
+		CASE(OP_SUPER_INVOKE): {
+			PropertyCache* cache = &frame->chunk->caches[READ_SHORT()];
+			int argCount = READ_BYTE();
+			if (!IS_CLASS(peek(0)))
+			{
+				runtimeError("Superclass must be a class.");
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			ObjClass* superclass = AS_CLASS(pop());
+			if (!superInvoke(cache, superclass, argCount))
+			{
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			frame = &vm.frames[vm.frameCount - 1];
+			NATIVE_ENTER();
+			DISPATCH();
+		}
+
+		CASE(OP_TAIL_CALL): {
+			int argCount = READ_BYTE();
+			dropFrame(frame, argCount);
+			if (!callValue(peek(argCount), argCount))
+			{
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			// a callee that pushed no frame has already returned.
+			if (vm.frameCount == exitDepth) return INTERPRET_OK;
+			frame = &vm.frames[vm.frameCount - 1];
+			NATIVE_ENTER();
+			DISPATCH();
+		}
+
+		CASE(OP_TAIL_INVOKE): {
+			PropertyCache* cache = &frame->chunk->caches[READ_SHORT()];
+			int argCount = READ_BYTE();
+			dropFrame(frame, argCount);
+			if (!invoke(cache, argCount))
+			{
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			if (vm.frameCount == exitDepth) return INTERPRET_OK;
+			frame = &vm.frames[vm.frameCount - 1];
+			NATIVE_ENTER();
+			DISPATCH();
+		}
+
+		CASE(OP_CLOSURE): {
+			ObjFunction* function = AS_FUNCTION(READ_CONSTANT_LONG());
+			ObjClosure* closure = newClosure(function);
+			// on the stack so the upvalues allocated below cannot collect it.
+			push(OBJ_VAL(closure));
+			for (int i = 0; i < closure->upvalueCount; i++)
+			{
+				uint8_t isLocal = READ_BYTE();
+				uint8_t index = READ_BYTE();
+				if (isLocal)
 				{
-					double a = AS_NUMBER(pop());
-					double b = AS_NUMBER(pop());
-					push(NUMBER_VAL(a + b));
+					closure->upvalues[i] = captureUpvalue(frame->slots + index);
 				} else
 				{
-					
-					runtimeError("Operands must be two numbers or two strings");
-					return INTERPRET_RUNTIME_ERROR;
+					closure->upvalues[i] = frame->closure->upvalues[index];
 				}
-				break;
 			}
-			case OP_SUBTRACT: 	BINARY_OP(NUMBER_VAL, -); break;
-			case OP_MULTIPLY: 	BINARY_OP(NUMBER_VAL, *); break;
-			case OP_DIVIDE: 	BINARY_OP(NUMBER_VAL, /); break;
+			DISPATCH();
+		}
 
-			case OP_NOT: push(BOOL_VAL(isFalsey(pop()))); break;
+		CASE(OP_CLOSE_UPVALUE): {
+			closeUpvalues(vm.stackTop - 1);
+			pop();
+			DISPATCH();
+		}
 
-			case OP_NEGATE: {
-				if (!IS_NUMBER(peek(0)))
-				{
-					runtimeError("Operand must be a number");
-					return INTERPRET_RUNTIME_ERROR;
-				}
+		CASE(OP_CLASS): {
+			push(OBJ_VAL(newClass(AS_STRING(READ_CONSTANT_LONG()))));
+			DISPATCH();
+		}
 
-				// push(-pop()); break;
-				*(vm.stack + (int)(vm.stackTop - vm.stack) - 1) =
-					NUMBER_VAL(-AS_NUMBER(*(vm.stack + (int)(vm.stackTop - vm.stack) - 1)));
-				break;
+		CASE(OP_INHERIT): {
+			Value superclass = peek(1);
+			if (!IS_CLASS(superclass))
+			{
+				runtimeError("Superclass must be a class.");
+				return INTERPRET_RUNTIME_ERROR;
+			}
+			if (!IS_CLASS(peek(0)))
+			{
+				runtimeError("Can only inherit into a class.");
+				return INTERPRET_RUNTIME_ERROR;
 			}
 
-			case OP_POP: pop(); break;
-			case OP_GET_LOCAL: {
-				uint8_t slot = READ_BYTE();
-				push(vm.stack[slot]);
-				break;
+			ObjClass* subclass = AS_CLASS(peek(0));
+			tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
+			subclass->initializer = AS_CLASS(superclass)->initializer;
+			pop();
+			DISPATCH();
+		}
+
+		CASE(OP_METHOD): {
+			ObjStringVec* name = AS_STRING(READ_CONSTANT_LONG());
+			Value method = peek(0);
+			if (!IS_CLASS(peek(1)))
+			{
+				runtimeError("Can only add methods to a class.");
+				return INTERPRET_RUNTIME_ERROR;
 			}
-			case OP_SET_LOCAL: {
-				uint8_t slot = READ_BYTE();
-				vm.stack[slot] = peek(0);
-				break;
+			ObjClass* klass = AS_CLASS(peek(1));
+			tableSet(&klass->methods, name, method);
+			if (name->length == 4 && memcmp(name->chars, "init", 4) == 0)
+			{
+				klass->initializer = method;
 			}
-			case OP_SET_GLOBAL: {
-				ObjStringVec* name = READ_STRING();
-				if (tableSet(&vm.globals, name, peek(0)))
-				{
-					tableDelete(&vm.globals, name);
-					runtimeError("Undefined variable '%s'.", name->chars);
-					return INTERPRET_RUNTIME_ERROR;
-				}
-				break;
+			pop();
+			DISPATCH();
+		}
+
+		CASE(OP_RETURN): {
+			Value result = pop();
+			closeUpvalues(frame->slots);
+			vm.frameCount--;
+			vm.stackTop = frame->slots;
+			if (vm.frameCount == exitDepth)
+			{
+				// the script's own result is dropped.
+				if (exitDepth > 0) push(result);
+				return INTERPRET_OK;
 			}
-			case OP_GET_GLOBAL: {
-				ObjStringVec* name = READ_STRING();
-				Value value;
-				if (!tableGet(&vm.globals, name, &value))
-				{
-					runtimeError("Undefined variable '%s'.", name->chars);
-					return INTERPRET_RUNTIME_ERROR;
-				}
-				push(value);
-				break;
+
+			push(result);
+			frame = &vm.frames[vm.frameCount - 1];
+			NATIVE_ENTER();
+			DISPATCH();
+		}
+
+		CASE_UNKNOWN: {
+			runtimeError("Unknown opcode %d.", instruction);
+			return INTERPRET_RUNTIME_ERROR;
+		}
+	}
+
+	#undef BINARY_OP
+	#undef BINARY_NUM_OP
+	#undef NOT_BOOL_VAL
+	#undef CURRENT_OPCODE
+	#undef QUICKEN
+	#undef DEQUICKEN
+	#undef READ_CONSTANT
+	#undef READ_CONSTANT_LONG
+	#undef READ_SHORT
+	#undef READ_BYTE
+	#undef TRACE_EXECUTION
+	#undef RECORD_OPCODE
+	#undef NATIVE_ENTER
+	#undef INTERPRET_LOOP
+	#undef CASE
+	#undef CASE_UNKNOWN
+	#undef DISPATCH
+
+}
+
+#if defined(DEBUG_TRACE_EXECUTION)
+/**
+ * traceRegisters - prints the contents of the registers followed by the
+ * register instruction about to be executed.
+ * @regChunk: the register chunk being executed.
+ * @registers: the first register of the frame.
+ * @rip: pointer to the instruction about to be executed.
+*/
+static void traceRegisters(RegChunk* regChunk, Value* registers,
+						   RegInstruction* rip)
+{
+	printf("          ");
+	for (int i = 0; i < regChunk->registerCount; i++)
+	{
+		printf("[ ");
+		printValue(registers[i]);
+		printf(" ]");
+	}
+	printf("\n");
+	disassembleRegInstruction(regChunk, (int)(rip - regChunk->code));
+}
+#endif // DEBUG_TRACE_EXECUTION
+
+/**
+ * registerCode - gets the register translation of a chunk, translating it
+ * the first time it runs. A chunk that cannot be translated gets an empty
+ * translation, and a note on stderr says which instruction is in the way
+ * and why.
+ * @chunk: the chunk.
+ * @function: the function the chunk belongs to, or NULL for the script.
+ * Return: the translation, empty if the chunk has to run on the stack VM.
+*/
+static RegChunk* registerCode(Chunk* chunk, ObjFunction* function)
+{
+	if (chunk->regChunk != NULL) return chunk->regChunk;
+
+	RegChunk* regChunk = ALLOCATE(RegChunk, 1);
+	initRegChunk(regChunk);
+	chunk->regChunk = regChunk;
+
+	const char* name = function == NULL ? "script" : function->name->chars;
+	int blocked;
+	const char* reason;
+	if (!translateChunk(chunk, function == NULL ? 0 : function->arity + 1,
+						regChunk, &blocked, &reason))
+	{
+		fprintf(stderr, "Note: --regvm runs %s%s on the stack VM: %s at "
+						"offset %d %s.\n",
+				name, function == NULL ? "" : "()",
+				opcodeName(chunk->code[blocked]), blocked, reason);
+	}
+	#if defined(DEBUG_PRINT_CODE)
+	else
+	{
+		disassembleRegChunk(regChunk, name);
+	}
+	#endif // DEBUG_PRINT_CODE
+	return regChunk;
+}
+
+/**
+ * enterRegisters - sets up a frame that has just been pushed to run on
+ * the register VM. Registers past the arguments start out nil, and the
+ * top of the stack goes past the last one so the collector sees them all.
+ * @frame: the new frame.
+ * Return: false if its chunk has to run on the stack VM instead.
+*/
+static bool enterRegisters(CallFrame* frame)
+{
+	RegChunk* regChunk = registerCode(frame->chunk, frame->function);
+	if (regChunk->count == 0) return false;
+
+	int arguments = frame->function == NULL ? 0 : frame->function->arity + 1;
+	for (int i = arguments; i < regChunk->registerCount; i++)
+	{
+		frame->slots[i] = NIL_VAL;
+	}
+	vm.stackTop = frame->slots + regChunk->registerCount;
+	frame->rip = regChunk->code;
+	return true;
+}
+
+/**
+ * runRegisters - the interpreter loop of the register VM. Registers are
+ * the slots of the frame's window into `vm.stack`, so a chunk's locals
+ * are addressed in place and every instruction reads its operands and
+ * writes its result directly instead of going through `push` and `pop`.
+ * A call runs the callee here too if its chunk translates, otherwise a
+ * nested `run` executes it on the stack VM; either way the frames are
+ * the VM's own, so stack traces and the collector see them as usual.
+ * Dispatch works the same way as in `run`.
+ * Return: INTERPRET_RUNTIME_ERROR | INTERPRET_OK
+*/
+static InterpretResult runRegisters()
+{
+	CallFrame* frame;
+	RegChunk* regChunk;
+	Value* registers;
+	Value* constants;
+	RegInstruction* rip;
+
+	// switches to the frame on top, which runs on the register VM.
+	#define LOAD_FRAME() \
+			do { \
+				frame = &vm.frames[vm.frameCount - 1]; \
+				regChunk = frame->chunk->regChunk; \
+				registers = frame->slots; \
+				constants = regChunk->constants.values; \
+				rip = frame->rip; \
+			} while (false)
+	// points the frame's `ip` just past the start of the stack instruction
+	// the current register instruction was translated from, which is where
+	// stack traces and the profiler look for its line.
+	#define SYNC_IP() \
+			(frame->ip = frame->chunk->code + \
+				regChunk->origins[rip - regChunk->code - 1] + 1)
+	#define RUNTIME_ERROR(...) \
+			do { \
+				SYNC_IP(); \
+				runtimeError(__VA_ARGS__); \
+				return INTERPRET_RUNTIME_ERROR; \
+			} while (false)
+	// picks the caller back up once the result of its call is in the
+	// callee's register. The registers above it held the callee's frame
+	// and are cleared, so the collector never sees their stale values.
+	#define RETURN_TO_CALLER() \
+			do { \
+				LOAD_FRAME(); \
+				Value* slot = registers + rip[-1].a + 1; \
+				Value* end = registers + regChunk->registerCount; \
+				while (slot < end) *slot++ = NIL_VAL; \
+				vm.stackTop = end; \
+			} while (false)
+	// carries on after `callValue` has made a call with `frameCount`
+	// frames below it: in the callee if it got a frame that can run here,
+	// otherwise in the caller once the stack VM, a native or a class has
+	// left the result in the callee's slot.
+	#define FINISH_CALL(frameCount) \
+			do { \
+				if (vm.frameCount > (frameCount)) \
+				{ \
+					if (enterRegisters(&vm.frames[vm.frameCount - 1])) \
+					{ \
+						LOAD_FRAME(); \
+						DISPATCH(); \
+					} \
+					InterpretResult result = run(frameCount); \
+					if (result != INTERPRET_OK) return result; \
+				} \
+				RETURN_TO_CALLER(); \
+				DISPATCH(); \
+			} while (false)
+
+	#define RK(operand) \
+		(((operand) & RK_CONSTANT) \
+			? constants[(operand) & RK_MAX_CONSTANT] : registers[operand])
+	#define READ_TARGET() \
+		(regChunk->code + ((instruction->b << 16) | instruction->c))
+	#define BINARY_OP(valueType, op) \
+			do { \
+				Value b = RK(instruction->b); \
+				Value c = RK(instruction->c); \
+				if (!IS_NUMBER(b) || !IS_NUMBER(c)) { \
+					RUNTIME_ERROR("Operands must be numbers."); \
+				} \
+				registers[instruction->a] = \
+					valueType(AS_NUMBER(b) op AS_NUMBER(c)); \
+			} while (false)
+
+	#define NOT_BOOL_VAL(value) BOOL_VAL(!(value))
+
+	#if defined(DEBUG_TRACE_EXECUTION)
+	#define TRACE_EXECUTION() traceRegisters(regChunk, registers, rip)
+	#else
+	#define TRACE_EXECUTION() do { } while (false)
+	#endif // DEBUG_TRACE_EXECUTION
+
+	RegInstruction* instruction;
+
+	#if defined(THREADED_DISPATCH)
+	// the entries override the `L_UNKNOWN` default on purpose.
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Woverride-init"
+	static void* dispatchTable[UINT8_COUNT] = {
+		[0 ... UINT8_MAX]		= &&L_UNKNOWN,
+		[ROP_MOVE]				= &&L_ROP_MOVE,
+		[ROP_LOAD_LONG]			= &&L_ROP_LOAD_LONG,
+		[ROP_GET_GLOBAL]		= &&L_ROP_GET_GLOBAL,
+		[ROP_DEFINE_GLOBAL]		= &&L_ROP_DEFINE_GLOBAL,
+		[ROP_SET_GLOBAL]		= &&L_ROP_SET_GLOBAL,
+		[ROP_EQUAL]				= &&L_ROP_EQUAL,
+		[ROP_NOT_EQUAL]			= &&L_ROP_NOT_EQUAL,
+		[ROP_GREATER]			= &&L_ROP_GREATER,
+		[ROP_GREATER_EQUAL]		= &&L_ROP_GREATER_EQUAL,
+		[ROP_LESS]				= &&L_ROP_LESS,
+		[ROP_LESS_EQUAL]		= &&L_ROP_LESS_EQUAL,
+		[ROP_ADD]				= &&L_ROP_ADD,
+		[ROP_SUBTRACT]			= &&L_ROP_SUBTRACT,
+		[ROP_MULTIPLY]			= &&L_ROP_MULTIPLY,
+		[ROP_DIVIDE]			= &&L_ROP_DIVIDE,
+		[ROP_NOT]				= &&L_ROP_NOT,
+		[ROP_NEGATE]			= &&L_ROP_NEGATE,
+		[ROP_PRINT]				= &&L_ROP_PRINT,
+		[ROP_JUMP]				= &&L_ROP_JUMP,
+		[ROP_JUMP_IF_FALSE]		= &&L_ROP_JUMP_IF_FALSE,
+		[ROP_LOOP]				= &&L_ROP_LOOP,
+		[ROP_CALL]				= &&L_ROP_CALL,
+		[ROP_TAIL_CALL]			= &&L_ROP_TAIL_CALL,
+		[ROP_RETURN]			= &&L_ROP_RETURN,
+	};
+	#pragma GCC diagnostic pop
+
+	#define INTERPRET_LOOP	DISPATCH();
+	#define CASE(op)		L_##op
+	#define CASE_UNKNOWN	L_UNKNOWN
+	#define DISPATCH() \
+			do { \
+				TRACE_EXECUTION(); \
+				instruction = rip++; \
+				goto *dispatchTable[instruction->op]; \
+			} while (false)
+	#else
+	#define INTERPRET_LOOP \
+			loop: \
+				TRACE_EXECUTION(); \
+				instruction = rip++; \
+				switch (instruction->op)
+	#define CASE(op)		case op
+	#define CASE_UNKNOWN	default
+	#define DISPATCH()		goto loop
+	#endif // THREADED_DISPATCH
+
+	LOAD_FRAME();
+	INTERPRET_LOOP
+	{
+		CASE(ROP_MOVE):
+			registers[instruction->a] = RK(instruction->b);
+			DISPATCH();
+		CASE(ROP_LOAD_LONG):
+			registers[instruction->a] = regChunk->source->constants.values[
+				(instruction->b << 16) | instruction->c];
+			DISPATCH();
+
+		CASE(ROP_GET_GLOBAL): {
+			Value value = vm.globalValues.values[instruction->b];
+			if (IS_UNDEFINED(value))
+			{
+				RUNTIME_ERROR("Undefined variable '%s'.",
+							  AS_CSTRING(vm.globalNames.values[instruction->b]));
 			}
-			case OP_DEFINE_GLOBAL: {
-				ObjStringVec* name = READ_STRING();
-				tableSet(&vm.globals, name, peek(0));
-				pop();
-				break;
+			registers[instruction->a] = value;
+			DISPATCH();
+		}
+		CASE(ROP_DEFINE_GLOBAL):
+			vm.globalValues.values[instruction->a] = RK(instruction->b);
+			DISPATCH();
+		CASE(ROP_SET_GLOBAL): {
+			if (IS_UNDEFINED(vm.globalValues.values[instruction->a]))
+			{
+				RUNTIME_ERROR("Undefined variable '%s'.",
+							  AS_CSTRING(vm.globalNames.values[instruction->a]));
 			}
+			vm.globalValues.values[instruction->a] = RK(instruction->b);
+			DISPATCH();
+		}
 
-			case OP_PRINT: {
-				printValue(pop());
-				printf("\n");
-				break;
+		CASE(ROP_EQUAL):
+			registers[instruction->a] =
+				BOOL_VAL(valuesEqual(RK(instruction->b), RK(instruction->c)));
+			DISPATCH();
+		CASE(ROP_NOT_EQUAL):
+			registers[instruction->a] =
+				BOOL_VAL(!valuesEqual(RK(instruction->b), RK(instruction->c)));
+			DISPATCH();
+		CASE(ROP_GREATER):			BINARY_OP(BOOL_VAL, >); DISPATCH();
+		CASE(ROP_LESS):				BINARY_OP(BOOL_VAL, <); DISPATCH();
+		CASE(ROP_GREATER_EQUAL):	BINARY_OP(NOT_BOOL_VAL, <); DISPATCH();
+		CASE(ROP_LESS_EQUAL):		BINARY_OP(NOT_BOOL_VAL, >); DISPATCH();
+
+		CASE(ROP_ADD): {
+			Value b = RK(instruction->b);
+			Value c = RK(instruction->c);
+			if (IS_NUMBER(b) && IS_NUMBER(c))
+			{
+				registers[instruction->a] = NUMBER_VAL(AS_NUMBER(b) + AS_NUMBER(c));
+			} else if (IS_STRING(b) && IS_STRING(c))
+			{
+				// both operands are registers or constants, which the
+				// collector already treats as roots.
+				registers[instruction->a] =
+					OBJ_VAL(concatStrings(AS_OBJ(b), AS_OBJ(c)));
+			} else
+			{
+				RUNTIME_ERROR("Operands must be two numbers or two strings");
+			}
+			DISPATCH();
+		}
+		CASE(ROP_SUBTRACT):	BINARY_OP(NUMBER_VAL, -); DISPATCH();
+		CASE(ROP_MULTIPLY):	BINARY_OP(NUMBER_VAL, *); DISPATCH();
+		CASE(ROP_DIVIDE):	BINARY_OP(NUMBER_VAL, /); DISPATCH();
+
+		CASE(ROP_NOT):
+			registers[instruction->a] = BOOL_VAL(isFalsey(RK(instruction->b)));
+			DISPATCH();
+		CASE(ROP_NEGATE): {
+			Value value = RK(instruction->b);
+			if (!IS_NUMBER(value))
+			{
+				RUNTIME_ERROR("Operand must be a number");
 			}
+			registers[instruction->a] = NUMBER_VAL(-AS_NUMBER(value));
+			DISPATCH();
+		}
 
-			case OP_JUMP: {
-				uint16_t offset = READ_SHORT();
-				vm.ip += offset;
-				break;
+		CASE(ROP_PRINT): {
+			printValue(RK(instruction->a));
+			printf("\n");
+			DISPATCH();
+		}
+
+		CASE(ROP_JUMP):
+			rip = READ_TARGET();
+			DISPATCH();
+		CASE(ROP_JUMP_IF_FALSE):
+			if (isFalsey(registers[instruction->a])) rip = READ_TARGET();
+			DISPATCH();
+		CASE(ROP_LOOP):
+			frame->chunk->loops[instruction->a].iterations++;
+			rip = READ_TARGET();
+			DISPATCH();
+
+		CASE(ROP_CALL): {
+			int argCount = instruction->b;
+			SYNC_IP();
+			frame->rip = rip;
+			vm.stackTop = registers + instruction->a + argCount + 1;
+			int frameCount = vm.frameCount;
+			if (!callValue(registers[instruction->a], argCount))
+			{
+				return INTERPRET_RUNTIME_ERROR;
 			}
+			FINISH_CALL(frameCount);
+		}
 
-			case OP_JUMP_IF_FALSE: {
-				uint16_t offset = READ_SHORT();
-				if(isFalsey(peek(0))) vm.ip += offset;
-				break;
+		CASE(ROP_TAIL_CALL): {
+			int argCount = instruction->b;
+			SYNC_IP();
+			vm.stackTop = registers + instruction->a + argCount + 1;
+			dropFrame(frame, argCount);
+			int frameCount = vm.frameCount;
+			if (!callValue(peek(argCount), argCount))
+			{
+				return INTERPRET_RUNTIME_ERROR;
 			}
+			FINISH_CALL(frameCount);
+		}
 
-			case OP_RETURN: {
+		CASE(ROP_RETURN): {
+			Value result = RK(instruction->a);
+			closeUpvalues(registers);
+			vm.frameCount--;
+			if (vm.frameCount == 0)
+			{
+				vm.stackTop = vm.stack;
 				return INTERPRET_OK;
 			}
+
+			registers[0] = result;
+			RETURN_TO_CALLER();
+			DISPATCH();
+		}
+
+		CASE_UNKNOWN: {
+			RUNTIME_ERROR("Unknown register opcode %d.", instruction->op);
 		}
 	}
 
+	#undef LOAD_FRAME
+	#undef SYNC_IP
+	#undef RUNTIME_ERROR
+	#undef RETURN_TO_CALLER
+	#undef FINISH_CALL
+	#undef RK
+	#undef READ_TARGET
 	#undef BINARY_OP
-	#undef READ_CONSTANT
-	#undef READ_SHORT
-	#undef READ_STRING
-	#undef READ_BYTE
+	#undef NOT_BOOL_VAL
+	#undef TRACE_EXECUTION
+	#undef INTERPRET_LOOP
+	#undef CASE
+	#undef CASE_UNKNOWN
+	#undef DISPATCH
+}
 
+/**
+ * execute - runs `vm.chunk` on the register VM when asked to and it can be
+ * translated, otherwise on the stack VM.
+ * Return: INTERPRET_RUNTIME_ERROR | INTERPRET_OK
+*/
+static InterpretResult execute()
+{
+	if (vmOptions.registerMode && enterRegisters(&vm.frames[vm.frameCount - 1]))
+	{
+		return runRegisters();
+	}
+	return run(0);
+}
+
+#if defined(STACK_GUARD_PAGE)
+/**
+ * runGuarded - executes `vm.chunk`, reporting a push into the guard page
+ * past the end of the stack as a stack overflow.
+ * Return: INTERPRET_RUNTIME_ERROR | INTERPRET_OK
+*/
+static InterpretResult runGuarded()
+{
+	if (sigsetjmp(stackOverflow, 1) != 0)
+	{
+		runtimeError("Stack overflow.");
+		return INTERPRET_RUNTIME_ERROR;
+	}
+	guardArmed = 1;
+	InterpretResult result = execute();
+	guardArmed = 0;
+	return result;
 }
+#endif // STACK_GUARD_PAGE
 
 /**
- * initVM - initializes the internal state of the VM by setting the pointer
- * of the top of the stack to the beginning of the stack array. There is no
- * need to allocate space for the array as it is declared inline within the VM
- * struct. Moreover, there is no need to clear unused cells as they simply won't
- * be accessed until after values are stored within them.
+ * initVM - initializes the internal state of the VM, allocating the stack
+ * and the call frames and setting the pointer of the top of the stack to
+ * the beginning of the stack array. There is no need to clear unused cells
+ * as they simply won't be accessed until after values are stored within
+ * them.
 */
 void initVM()
 {
+	#if defined(STACK_GUARD_PAGE)
+	mapStack();
+	#else
+	vm.stack = malloc(sizeof(Value) * STACK_INITIAL);
+	if (vm.stack == NULL) exit(EXIT_FAILURE);
+	vm.stackEnd = vm.stack + STACK_INITIAL;
+	#endif // STACK_GUARD_PAGE
+	vm.frameCapacity = FRAMES_INITIAL;
+	vm.frames = malloc(sizeof(CallFrame) * vm.frameCapacity);
+	if (vm.frames == NULL) exit(EXIT_FAILURE);
 	resetStack();
+	vm.chunk = NULL;
 	vm.objects = NULL;
+	vm.bytesAllocated = 0;
+	vm.nextGC = 1024 * 1024;
+	vm.grayCount = 0;
+	vm.grayCapacity = 0;
+	vm.grayStack = NULL;
 	initTable(&vm.strings);
 	initTable(&vm.globals);
+	initValueArray(&vm.globalValues);
+	initValueArray(&vm.globalNames);
+
+	defineNative("clock", clockNative);
 }
 
 void freeVM()
 {
 	freeTable(&vm.strings);
 	freeTable(&vm.globals);
+	freeValueArray(&vm.globalValues);
+	freeValueArray(&vm.globalNames);
 	freeObjects();
+	free(vm.frames);
+	#if defined(STACK_GUARD_PAGE)
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	munmap(vm.stack, (size_t)((char*)vm.stackEnd - (char*)vm.stack) + page);
+	#else
+	free(vm.stack);
+	#endif // STACK_GUARD_PAGE
 }
 
 /**
  * push - pushes a new value on o the top of the stack. After which,
  * it increments the `stackTop` pointer to point to the next unused
- * slot in the array since the previous one now holds a value.
+ * slot in the array since the previous one now holds a value. Nothing is
+ * checked: every call reserves the depth the verifier found its frame to
+ * need, plus `STACK_HEADROOM`, up front. `DEBUG_CHECK_STACK` restores
+ * the check, growing the stack if the reservation falls short.
  * @value: value to be placed onto the top of the stack.
  * Return: void.
 */
 void push(Value value)
 {
+	#if defined(DEBUG_CHECK_STACK) && !defined(STACK_GUARD_PAGE)
+	if (vm.stackTop == vm.stackEnd)
+	{
+		fprintf(stderr, "Pushing onto a full stack\n");
+		growStack(1, false);
+	}
+	#endif // DEBUG_CHECK_STACK
 	*vm.stackTop = value;
 	vm.stackTop++;
 }
@@ -273,20 +1780,46 @@ void push(Value value)
 /**
  * pop - retrieves the most recenty pushed value from the top of the stack.
  * It first decrements the `stackTop` pointer to the value at the top of the
- * stack before retrieving said value.
+ * stack before retrieving said value. The verifier has made sure no code
+ * pops more than it pushed, so only `DEBUG_CHECK_STACK` checks for an
+ * empty stack.
  * Return: the value at the top of the stack.
 */
 Value pop()
 {
+	#if defined(DEBUG_CHECK_STACK)
 	if (vm.stackTop == vm.stack)
 	{
 		fprintf(stderr, "Trying to pop from an empty stack\n");
 		return NIL_VAL;
 	}
+	#endif // DEBUG_CHECK_STACK
 	vm.stackTop--;
 	return *vm.stackTop;
 }
 
+/**
+ * globalSlot - resolves the name of a global variable to its slot in
+ * `vm.globalValues`, allocating a new slot on first sight of the name.
+ * Fresh slots hold `UNDEFINED_VAL` until the variable's declaration runs
+ * so that names used before they are declared can still be late-bound.
+ * @name: interned name of the global variable.
+ * Return: index of the global's slot.
+*/
+int globalSlot(ObjStringVec* name)
+{
+	Value slot;
+	if (tableGet(&vm.globals, name, &slot)) return (int)AS_NUMBER(slot);
+
+	int index = vm.globalValues.count;
+	push(OBJ_VAL(name));
+	writeValueArray(&vm.globalValues, UNDEFINED_VAL);
+	writeValueArray(&vm.globalNames, OBJ_VAL(name));
+	tableSet(&vm.globals, name, NUMBER_VAL((double)index));
+	pop();
+	return index;
+}
+
 /**
  * interpret - Fills us a chunk with bytecode generated from the
  * user's program and executes the chunk of bytecode if no
@@ -304,12 +1837,56 @@ InterpretResult interpret(const char* source)
 		return INTERPRET_COMPILE_ERROR;
 	}
 
-	vm.chunk = &chunk;
-	vm.ip = vm.chunk->code;
-
-	InterpretResult result = run();
+	InterpretResult result = interpretChunk(&chunk);
 
 	freeChunk(&chunk);
 
 	return result;
-}
\ No newline at end of file
+}
+
+/**
+ * interpretChunk - executes an already compiled chunk of bytecode, such
+ * as one loaded from a serialized bytecode file.
+ * @chunk: the chunk to execute.
+ * Return: INTERPRET_RUNTIME_ERROR | INTERPRET_OK
+*/
+InterpretResult interpretChunk(Chunk* chunk)
+{
+	#if !defined(STACK_GUARD_PAGE)
+	int needed = chunk->stackSize + STACK_HEADROOM;
+	if (vm.stackEnd - vm.stack < needed && !growStack(needed, true))
+	{
+		runtimeError("Stack overflow.");
+		return INTERPRET_RUNTIME_ERROR;
+	}
+	#endif // STACK_GUARD_PAGE
+
+	vm.chunk = chunk;
+	// the script has no function object and, unlike functions, does not
+	// reserve its first slot for one.
+	CallFrame* frame = &vm.frames[vm.frameCount];
+	frame->function = NULL;
+	frame->closure = NULL;
+	frame->chunk = chunk;
+	frame->ip = chunk->code;
+	frame->slots = vm.stack;
+	vm.frameCount++;
+
+	if (vmOptions.profilePath != NULL) startProfiler(vmOptions.profileRate);
+
+	#if defined(STACK_GUARD_PAGE)
+	InterpretResult result = runGuarded();
+	#else
+	InterpretResult result = execute();
+	#endif // STACK_GUARD_PAGE
+
+	if (vmOptions.profilePath != NULL) stopProfiler(vmOptions.profilePath);
+	if (vmOptions.profileLoops) printLoopProfile(chunk);
+	#if defined(OPCODE_STATS)
+	if (vmOptions.stats) reportStats();
+	#endif // OPCODE_STATS
+
+	vm.frameCount = 0;
+	vm.chunk = NULL;
+	return result;
+}
@@ -2,31 +2,100 @@
 #define clox_vm_h
 
 #include "chunk.h"
+#include "object.h"
+#include "regchunk.h"
 #include "table.h"
 
-#define STACK_MAX 256
+// call frames allocated up front. The array doubles whenever calls nest
+// deeper; the depth is bounded by the stack limit instead.
+#define FRAMES_INITIAL 64
+// every frame can address up to 256 slots with its one-byte operands.
+#define FRAME_SLOTS UINT8_COUNT
+// slots kept free above the depth the verifier found a frame to need, for
+// the values the VM pushes to keep objects alive while it allocates.
+#define STACK_HEADROOM 8
+// slots allocated up front. The stack doubles on demand from there.
+#define STACK_INITIAL (FRAMES_INITIAL * FRAME_SLOTS)
+// default for `vmOptions.stackLimit`, the most slots the stack may grow to
+// before a call reports a stack overflow.
+#define STACK_LIMIT_DEFAULT (1 << 20)
+
+/**
+ * struct callFrame - an ongoing call. Calls rarely allocate: the frame
+ * lives in the VM's frame array and the arguments stay where the caller
+ * pushed them, becoming the first locals of the callee.
+ * @function: the function being called, or NULL for the top-level script.
+ * @closure: the closure being called, or NULL when the function captures
+ * no variables and was called bare.
+ * @chunk: the bytecode being executed, the function's or the script's.
+ * @ip: pointer to the next instruction to execute. The caller's `ip` is
+ * where execution resumes when the call returns.
+ * On the register VM it is only brought up to date at calls and errors.
+ * @slots: the first slot of the frame's window into the VM's stack. Slot
+ * zero of a function's frame holds the function itself, followed by its
+ * arguments and locals.
+ * @rip: pointer to the next register instruction to execute, for a frame
+ * running on the register VM.
+*/
+typedef struct callFrame
+{
+	ObjFunction* function;
+	ObjClosure* closure;
+	Chunk* chunk;
+	uint8_t* ip;
+	Value* slots;
+	RegInstruction* rip;
+} CallFrame;
 
 /**
  * struct vm - structure to hold the vm's internal state.
- * @chunk: pointer to the chunk the vm executes.
- * @ip: pointer to the location of the currently executing instruction.
+ * @chunk: pointer to the top-level chunk the vm executes.
+ * @frames: the ongoing calls, the script's own frame first.
+ * @frameCount: number of ongoing calls.
+ * @frameCapacity: allocated size of `frames`.
  * @stack: keeps track of the temporary values generated by an expression.
+ * Heap allocated; growing it moves every value, so pointers into it are
+ * fixed up by `growStack()` and must not be held across a call.
+ * @stackEnd: pointer just past the last allocated slot of the stack.
  * @strings: a hash table to hold all the "interned" strings.
- * @globals: a hash table to hold all the global variables.
+ * @globals: a hash table mapping each global variable's name to its slot
+ * in `globalValues`. Only consulted by the compiler.
+ * @globalValues: flat array holding the value of every global variable,
+ * indexed by the slot the compiler resolved the name to.
+ * @globalNames: the name of the global in each slot, for error messages.
  * @stacktop: pointer to the top of the stack where the next value will
  * be written to.
+ * @openUpvalues: the upvalues still pointing into the stack, topmost slot
+ * first, so that a variable captured twice shares one upvalue.
  * @objects: pointer to the head of an intrusive list that keeps track of
  * the heap-allocated `Objs`.
+ * @bytesAllocated: running total of the bytes of managed memory in use.
+ * @nextGC: threshold of `bytesAllocated` that triggers the next collection.
+ * @grayCount: number of objects on the gray stack.
+ * @grayCapacity: allocated size of the gray stack.
+ * @grayStack: worklist of marked objects whose references still need to
+ * be traced.
 */
 typedef struct virtualMachine
 {
 	Chunk* chunk;
-	u_int8_t* ip;
-	Value stack[STACK_MAX];
+	CallFrame* frames;
+	int frameCount;
+	int frameCapacity;
+	Value* stack;
+	Value* stackEnd;
 	Value* stackTop;
+	ObjUpvalue* openUpvalues;
 	Table globals;
+	ValueArray globalValues;
+	ValueArray globalNames;
 	Table strings;
 	Obj* objects;
+	size_t bytesAllocated;
+	size_t nextGC;
+	int grayCount;
+	int grayCapacity;
+	Obj** grayStack;
 } VM;
 
 /**
@@ -43,11 +112,49 @@ typedef enum status
 	INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
+/**
+ * struct vmOptions - switches that control how chunks are executed.
+ * @registerMode: translate the script and each function called from it
+ * to the register-based instruction set and run them on the register VM.
+ * Chunks that cannot be translated run on the stack VM, which a note on
+ * stderr reports.
+ * @profileLoops: after running a chunk, print how many iterations each of
+ * its loops ran, keyed by source line.
+ * @stackLimit: the most slots the stack may hold. A call whose frame would
+ * need more reports a stack overflow. Must be set before `initVM()`.
+ * @jit: compile chunks that run often to machine code. Ignored by builds
+ * without `JIT`.
+ * @profilePath: sample the call stack while a chunk runs, then print the
+ * time spent on each source line and write the sampled stacks to this
+ * file. NULL to not profile.
+ * @profileRate: samples per second of CPU time when profiling.
+ * @stats: count the opcodes `run()` executes and report them after running
+ * a chunk. Ignored by builds without `OPCODE_STATS`.
+ * @statsCycles: also time each opcode with the time stamp counter, where
+ * the CPU has one.
+ * @statsPath: file to also write the counts to as JSON, or NULL.
+*/
+typedef struct vmOptions
+{
+	bool registerMode;
+	bool profileLoops;
+	int stackLimit;
+	bool jit;
+	const char* profilePath;
+	int profileRate;
+	bool stats;
+	bool statsCycles;
+	const char* statsPath;
+} VMOptions;
+
 extern VM vm;
+extern VMOptions vmOptions;
 
 void initVM();
 void freeVM();
 InterpretResult interpret(const char* source);
+InterpretResult interpretChunk(Chunk* chunk);
+int globalSlot(ObjStringVec* name);
 void push(Value value); // stack protocol supports these two operations.
 Value pop();
 